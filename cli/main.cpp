@@ -5,6 +5,7 @@
 #include <iostream>
 
 #include <Unet.h>
+#include <Unet/Trace.h>
 
 #define S2_IMPL
 #include "s2string.h"
@@ -23,11 +24,16 @@
 
 #if defined(PLATFORM_WINDOWS)
 #include <Windows.h>
+#include <psapi.h>
 #else
 #include <unistd.h>
 #include <poll.h>
 #endif
 
+#if defined(PLATFORM_MACOS)
+#include <mach/mach.h>
+#endif
+
 #include "termcolor.hpp"
 #define LOG_TYPE(prefix, func) func(); printf("[" prefix "] "); termcolor::reset()
 #define LOG_ERROR(fmt, ...) LOG_TYPE("ERROR", termcolor::red); printf(fmt "\n", ##__VA_ARGS__)
@@ -419,6 +425,375 @@ static bool IsKeyPressed()
 #endif
 }
 
+#if defined(UNET_MODULE_ENET)
+struct BenchOptions
+{
+	int Clients = 50;
+	int Rate = 30; // Messages per second per client
+	int Size = 256;
+	int Seconds = 10;
+	int Channels = 1;
+	int Reliable = 50; // Percentage of messages sent reliably
+	bool ToAll = false; // Send to all members instead of only the host
+	int Shards = 0;
+	int Port = 4460;
+};
+
+class BenchCallbacks : public Unet::ICallbacks
+{
+public:
+	int NumErrors = 0;
+	std::string LastError;
+
+public:
+	virtual void OnLogError(const std::string &str) override
+	{
+		NumErrors++;
+		LastError = str;
+	}
+};
+
+// Latencies in 100 microsecond buckets, up to 1 second
+class BenchLatency
+{
+private:
+	std::vector<uint64_t> m_buckets;
+	uint64_t m_count = 0;
+	uint64_t m_max = 0;
+
+public:
+	BenchLatency() : m_buckets(10001) {}
+
+	void Add(uint64_t us)
+	{
+		m_buckets[std::min<uint64_t>(us / 100, m_buckets.size() - 1)]++;
+		m_count++;
+		m_max = std::max(m_max, us);
+	}
+
+	uint64_t GetCount() { return m_count; }
+	double GetMax() { return m_max / 1000.0; }
+
+	double GetPercentile(double percentile)
+	{
+		uint64_t target = (uint64_t)(m_count * percentile / 100.0);
+		uint64_t total = 0;
+		for (size_t i = 0; i < m_buckets.size(); i++) {
+			total += m_buckets[i];
+			if (total > target) {
+				return (i + 1) / 10.0;
+			}
+		}
+		return GetMax();
+	}
+};
+
+static uint64_t BenchNow()
+{
+	static auto start = std::chrono::steady_clock::now();
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static size_t GetResidentMemory()
+{
+#if defined(PLATFORM_WINDOWS)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return (size_t)counters.WorkingSetSize;
+	}
+	return 0;
+#elif defined(PLATFORM_MACOS)
+	mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS) {
+		return (size_t)info.resident_size;
+	}
+	return 0;
+#else
+	FILE* fh = fopen("/proc/self/statm", "r");
+	if (fh == nullptr) {
+		return 0;
+	}
+	long pages = 0, residentPages = 0;
+	if (fscanf(fh, "%ld %ld", &pages, &residentPages) != 2) {
+		residentPages = 0;
+	}
+	fclose(fh);
+	return (size_t)residentPages * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static void BenchReceive(Unet::IContext* ctx, int numChannels, BenchLatency &latency, uint64_t &bytesReceived)
+{
+	for (int channel = 0; channel < numChannels; channel++) {
+		while (auto msg = ctx->ReadMessage(channel)) {
+			bytesReceived += msg->m_size;
+
+			if (msg->m_size >= sizeof(uint64_t)) {
+				uint64_t sendTime;
+				memcpy(&sendTime, msg->m_data, sizeof(uint64_t));
+				latency.Add(BenchNow() - sendTime);
+			}
+		}
+	}
+}
+
+static void RunBench(const BenchOptions &options)
+{
+	LOG_INFO("Bench: %d clients, %d msg/s each, %d bytes, %d%% reliable, %d channel(s), sending to %s, %d shard(s), %d seconds",
+		options.Clients, options.Rate, options.Size, options.Reliable, options.Channels, options.ToAll ? "all" : "host", options.Shards, options.Seconds);
+
+	size_t memoryStart = GetResidentMemory();
+
+	// The host runs on its own server, so it doesn't get in the way of the interactive context
+	auto server = Unet::CreateServer((uint16_t)options.Port, options.Clients + 1, options.Channels);
+	if (server == nullptr) {
+		LOG_ERROR("Couldn't create bench server on port %d", options.Port);
+		return;
+	}
+
+	auto hostCallbacks = new BenchCallbacks;
+	auto host = server->CreateContext();
+	host->SetCallbacks(hostCallbacks);
+	host->SetHostShards(options.Shards);
+	host->CreateLobby(Unet::LobbyPrivacy::Private, options.Clients + 1, "Bench");
+
+	uint64_t timeout = BenchNow() + 2000 * 1000;
+	while (host->GetStatus() != Unet::ContextStatus::Connected && BenchNow() < timeout) {
+		server->RunCallbacks();
+	}
+
+	Unet::ServiceID entryPoint;
+	if (host->CurrentLobby() != nullptr) {
+		auto entry = host->CurrentLobby()->GetInfo().GetEntryPoint(Unet::ServiceType::Enet);
+		if (entry != nullptr) {
+			entryPoint = *entry;
+		}
+	}
+
+	if (!entryPoint.IsValid()) {
+		LOG_ERROR("Bench host couldn't create a lobby");
+		Unet::DestroyServer(server);
+		return;
+	}
+
+	// The entry point has the "any" address, so connect to localhost instead
+	ENetAddress localhost;
+	enet_address_set_host(&localhost, "127.0.0.1");
+	entryPoint.ID = (entryPoint.ID & ~0xFFFFFFFFULL) | (uint64_t)localhost.host;
+
+	// Join clients in small batches, so we don't flood the host with handshakes
+	std::vector<Unet::IContext*> clients;
+	std::vector<BenchCallbacks*> clientCallbacks;
+
+	uint64_t joinStart = BenchNow();
+	timeout = joinStart + 5000 * 1000 + (uint64_t)options.Clients * 20 * 1000;
+
+	int numJoined = 0;
+	while (numJoined < options.Clients && BenchNow() < timeout) {
+		for (int i = 0; i < 8 && (int)clients.size() < options.Clients; i++) {
+			auto callbacks = new BenchCallbacks;
+			auto client = Unet::CreateContext(options.Channels);
+			client->SetCallbacks(callbacks);
+			client->EnableService(Unet::ServiceType::Enet);
+			client->JoinLobby(entryPoint);
+
+			clients.emplace_back(client);
+			clientCallbacks.emplace_back(callbacks);
+		}
+
+		server->RunCallbacks();
+
+		numJoined = 0;
+		for (auto client : clients) {
+			client->RunCallbacks();
+			if (client->GetStatus() == Unet::ContextStatus::Connected && client->GetLocalPeer() != -1) {
+				numJoined++;
+			}
+		}
+
+		UnetSleep(1);
+	}
+
+	LOG_INFO("  Joined: %d / %d clients in %d ms", numJoined, options.Clients, (int)((BenchNow() - joinStart) / 1000));
+
+	std::vector<uint8_t> payload(std::max(options.Size, (int)sizeof(uint64_t)));
+	for (size_t i = 0; i < payload.size(); i++) {
+		payload[i] = (uint8_t)(rand() % 255);
+	}
+
+	std::vector<double> sendBudget(clients.size(), 0.0);
+
+	BenchLatency latency;
+	uint64_t numSent = 0;
+	uint64_t bytesSent = 0;
+	uint64_t bytesReceived = 0;
+	uint64_t hostTime = 0;
+	uint64_t hostTimeMax = 0;
+	uint64_t clientTime = 0;
+	uint64_t numTicks = 0;
+
+	std::clock_t cpuStart = std::clock();
+	uint64_t benchStart = BenchNow();
+	uint64_t benchEnd = benchStart + (uint64_t)options.Seconds * 1000 * 1000;
+
+	// Keep running for a bit after we stop sending, so messages in flight still arrive
+	uint64_t drainEnd = benchEnd + 500 * 1000;
+
+	uint64_t lastTick = benchStart;
+	while (true) {
+		uint64_t now = BenchNow();
+		if (now >= drainEnd) {
+			break;
+		}
+
+		double dt = (now - lastTick) / 1000000.0;
+		lastTick = now;
+
+		uint64_t tickStart = BenchNow();
+		server->RunCallbacks();
+		BenchReceive(host, options.Channels, latency, bytesReceived);
+		uint64_t tickTime = BenchNow() - tickStart;
+		hostTime += tickTime;
+		hostTimeMax = std::max(hostTimeMax, tickTime);
+
+		tickStart = BenchNow();
+		for (size_t i = 0; i < clients.size(); i++) {
+			auto client = clients[i];
+			client->RunCallbacks();
+
+			if (options.ToAll) {
+				BenchReceive(client, options.Channels, latency, bytesReceived);
+			}
+
+			if (now >= benchEnd || client->GetLocalPeer() == -1) {
+				continue;
+			}
+
+			sendBudget[i] += options.Rate * dt;
+			while (sendBudget[i] >= 1.0) {
+				sendBudget[i] -= 1.0;
+
+				uint64_t sendTime = BenchNow();
+				memcpy(payload.data(), &sendTime, sizeof(uint64_t));
+
+				auto type = (rand() % 100) < options.Reliable ? Unet::PacketType::Reliable : Unet::PacketType::Unreliable;
+				uint8_t channel = (uint8_t)(numSent % options.Channels);
+
+				if (options.ToAll) {
+					client->SendToAll(payload.data(), payload.size(), type, channel);
+				} else {
+					client->SendToHost(payload.data(), payload.size(), type, channel);
+				}
+
+				numSent++;
+				bytesSent += payload.size();
+			}
+		}
+		clientTime += BenchNow() - tickStart;
+		numTicks++;
+
+		UnetSleep(1);
+	}
+
+	double wallSeconds = (BenchNow() - benchStart) / 1000000.0;
+	double cpuSeconds = (std::clock() - cpuStart) / (double)CLOCKS_PER_SEC;
+	size_t memoryEnd = GetResidentMemory();
+
+	// With SendToAll, every message is delivered to every other member
+	uint64_t numExpected = numSent;
+	if (options.ToAll) {
+		numExpected *= (uint64_t)numJoined;
+	}
+
+	LOG_INFO("  Sent: %" PRIu64 " messages (%.2f MB/s)", numSent, bytesSent / (double)options.Seconds / (1024.0 * 1024.0));
+	LOG_INFO("  Received: %" PRIu64 " of %" PRIu64 " expected messages (%.2f MB/s)", latency.GetCount(), numExpected, bytesReceived / wallSeconds / (1024.0 * 1024.0));
+	LOG_INFO("  Latency: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f ms", latency.GetPercentile(50), latency.GetPercentile(95), latency.GetPercentile(99), latency.GetMax());
+
+	if (numTicks > 0) {
+		LOG_INFO("  Host tick: %.1f us average, %.1f ms max", hostTime / (double)numTicks, hostTimeMax / 1000.0);
+	}
+	if (numTicks > 0 && clients.size() > 0) {
+		LOG_INFO("  Client tick: %.1f us average per client", clientTime / (double)numTicks / (double)clients.size());
+	}
+
+	LOG_INFO("  Process CPU: %.1f%% of a core (%.2f%% per client)", cpuSeconds / wallSeconds * 100.0, clients.size() > 0 ? cpuSeconds / wallSeconds * 100.0 / clients.size() : 0.0);
+
+	auto &hostStats = host->GetStats();
+	LOG_INFO("  Host relayed: %" PRId64 " packets (%" PRId64 " bytes), %" PRId64 " messages allocated", hostStats.RelayedPackets.Get(), hostStats.RelayedBytes.Get(), hostStats.MessagesAllocated.Get());
+	LOG_INFO("  Process memory: %.1f MB before, %.1f MB after (%.1f KB per client)", memoryStart / (1024.0 * 1024.0), memoryEnd / (1024.0 * 1024.0),
+		clients.size() > 0 ? ((double)memoryEnd - (double)memoryStart) / 1024.0 / clients.size() : 0.0);
+
+	int numErrors = hostCallbacks->NumErrors;
+	std::string lastError = hostCallbacks->LastError;
+	for (auto callbacks : clientCallbacks) {
+		numErrors += callbacks->NumErrors;
+		if (callbacks->NumErrors > 0) {
+			lastError = callbacks->LastError;
+		}
+	}
+	if (numErrors > 0) {
+		LOG_WARN("  %d errors, last: %s", numErrors, lastError.c_str());
+	}
+
+	// Leave properly so the clients' Enet hosts are cleaned up
+	for (auto client : clients) {
+		client->LeaveLobby();
+	}
+
+	timeout = BenchNow() + 1000 * 1000;
+	while (BenchNow() < timeout) {
+		server->RunCallbacks();
+
+		bool allIdle = true;
+		for (auto client : clients) {
+			client->RunCallbacks();
+			if (client->GetStatus() != Unet::ContextStatus::Idle) {
+				allIdle = false;
+			}
+		}
+
+		if (allIdle) {
+			break;
+		}
+		UnetSleep(1);
+	}
+
+	for (auto client : clients) {
+		Unet::DestroyContext(client);
+	}
+	Unet::DestroyServer(server);
+
+	LOG_INFO("Bench done!");
+}
+#endif
+
+static void PrintStats(const Unet::NetworkStats &stats)
+{
+	for (int i = 0; i < stats.NumChannels(); i++) {
+		auto &channel = stats.GetChannel(i);
+		LOG_INFO("  Channel %d: sent %" PRId64 " (%" PRId64 " bytes), received %" PRId64 " (%" PRId64 " bytes), %" PRId64 " queued", i,
+			channel.PacketsSent.Get(), channel.BytesSent.Get(),
+			channel.PacketsReceived.Get(), channel.BytesReceived.Get(),
+			channel.MessagesQueued.Get());
+	}
+
+	LOG_INFO("  Fragments: %" PRId64 " sent, %" PRId64 " received, %" PRId64 " bytes in reassembly, %" PRId64 " messages expired", stats.FragmentsSent.Get(), stats.FragmentsReceived.Get(), stats.ReassemblyBytes.Get(), stats.ReassemblyExpired.Get());
+	LOG_INFO("  Send queue: %" PRId64 " bytes", stats.SendQueueBytes.Get());
+	LOG_INFO("  Relayed: %" PRId64 " packets (%" PRId64 " bytes)", stats.RelayedPackets.Get(), stats.RelayedBytes.Get());
+	LOG_INFO("  Messages allocated: %" PRId64 ", %" PRId64 " stale messages dropped", stats.MessagesAllocated.Get(), stats.StaleMessagesDropped.Get());
+
+	LOG_INFO("  Round trip: %.1f ms mean, %d ms p50, %d ms p99 (%" PRId64 " samples)", stats.RoundTrip.GetMean(), stats.RoundTrip.GetPercentile(50), stats.RoundTrip.GetPercentile(99), stats.RoundTrip.GetCount());
+	LOG_INFO("  Jitter: %.1f ms mean, %d ms p50, %d ms p99", stats.Jitter.GetMean(), stats.Jitter.GetPercentile(50), stats.Jitter.GetPercentile(99));
+
+	if (stats.JoinQueueTime.GetCount() > 0 || stats.JoinsPending.Get() > 0) {
+		LOG_INFO("  Joins: %" PRId64 " admitted, %" PRId64 " pending, waited %.1f ms mean, %d ms p99", stats.JoinQueueTime.GetCount(), stats.JoinsPending.Get(), stats.JoinQueueTime.GetMean(), stats.JoinQueueTime.GetPercentile(99));
+	}
+	if (stats.JoinLatency.GetCount() > 0) {
+		LOG_INFO("  Join latency: %.1f ms mean, %d ms p99", stats.JoinLatency.GetMean(), stats.JoinLatency.GetPercentile(99));
+	}
+}
+
 static void HandleCommand(const s2::string &line)
 {
 	auto parse = line.commandlinesplit();
@@ -438,8 +813,15 @@ static void HandleCommand(const s2::string &line)
 		LOG_INFO("  enable <name> [...] - Enables a service by the given name, including optional parameters");
 		LOG_INFO("  primary <name>      - Changes the primary service");
 		LOG_INFO("  persona <name>      - Sets your persona name");
+		LOG_INFO("  shards <num>        - Sets the number of host worker threads (0 to disable)");
+		LOG_INFO("  sendrate <bytes>    - Limits outgoing traffic to a number of bytes per second (0 to disable)");
+		LOG_INFO("  priority <channel|files> <priority> [weight] - Sets the send priority of a channel or of file transfers");
+		LOG_INFO("  joinbudget <num>    - Sets how many joining members the host admits per update (0 for no limit)");
 		LOG_INFO("");
 		LOG_INFO("  status              - Prints current network status");
+		LOG_INFO("  stats [peer]        - Prints network statistics for the context, or for the given peer");
+		LOG_INFO("  trace <on|off|clear> - Controls recording of trace zones (if built with --trace)");
+		LOG_INFO("  trace save <filename> - Saves recorded trace zones as Chrome trace JSON (if built with --trace)");
 		LOG_INFO("  wait                - Keeps running callbacks until a key is pressed or when disconnected");
 		LOG_INFO("");
 		LOG_INFO("  create [name]       - Creates a public lobby");
@@ -450,6 +832,9 @@ static void HandleCommand(const s2::string &line)
 		LOG_INFO("  connect <ip> [port] - Connect to a server directly by IP address (if enet is enabled)");
 		LOG_INFO("  leave               - Leaves the current lobby with all services");
 		LOG_INFO("  outage <service>    - Simulates a service outage");
+		LOG_INFO("  capture <filename>  - Starts writing all sent and received packets to a capture file");
+		LOG_INFO("  capture stop        - Stops writing the packet capture");
+		LOG_INFO("  replay <filename> [speed] - Enables a service that replays a packet capture once a lobby is created or joined");
 		LOG_INFO("");
 		LOG_INFO("  setname <name>      - Sets the lobby name (only available on the host)");
 		LOG_INFO("  data [num]          - Shows all lobby data by the number in the list, or the current lobby");
@@ -460,6 +845,8 @@ static void HandleCommand(const s2::string &line)
 		LOG_INFO("  remmemberdata <peer> <name> - Removes member lobby data (only available on the host and the local peer)");
 		LOG_INFO("  kick <peer>         - Kicks the given peer with an optional reason");
 		LOG_INFO("  chat <message>      - Sends a chat message to the lobby");
+		LOG_INFO("  group <join|leave> <name> - Joins or leaves a group of members");
+		LOG_INFO("  updates <on|off>    - Sets whether we hear about other members' data and files");
 		LOG_INFO("");
 		LOG_INFO("  addfile <filename>  - Adds a file to the available lobby files for the local member");
 		LOG_INFO("  delfile <filename>  - Removes a file from the available lobby files for the local member");
@@ -467,8 +854,12 @@ static void HandleCommand(const s2::string &line)
 		LOG_INFO("");
 		LOG_INFO("  send <peer> <num>   - Sends the given peer a reliable packet with a number of random bytes on channel 0");
 		LOG_INFO("  sendu <peer> <num>  - Sends the given peer an unreliable packet with a number of random bytes on channel 0");
+		LOG_INFO("  sendbuf <peer> <num> - Like send, but writes the random bytes straight into the context's send buffer");
+		LOG_INFO("  sendgroup <group> <num> - Sends all members of a group a reliable packet with a number of random bytes on channel 0");
 		LOG_INFO("");
 		LOG_INFO("  stress <peer> <sec> - Stress test the given peer for the given amount of seconds.");
+		LOG_INFO("  bench [key=value...] - Load tests a local host with many simulated Enet clients. Options (with defaults):");
+		LOG_INFO("                        clients=50 rate=30 size=256 sec=10 channels=1 reliable=50 to=host|all shards=0 port=4460");
 		LOG_INFO("");
 		LOG_INFO("Or just hit Enter to run callbacks.");
 
@@ -549,6 +940,26 @@ static void HandleCommand(const s2::string &line)
 		auto nameString = parse[1];
 		g_ctx->SetPersonaName(nameString.c_str());
 
+	} else if (parse[0] == "shards" && parse.len() == 2) {
+		g_ctx->SetHostShards(atoi(parse[1]));
+		LOG_INFO("Host worker threads: %d", g_ctx->GetHostShards());
+
+	} else if (parse[0] == "sendrate" && parse.len() == 2) {
+		g_ctx->SetSendRate(atoi(parse[1]));
+		LOG_INFO("Send rate: %d bytes per second", g_ctx->GetSendRate());
+
+	} else if (parse[0] == "priority" && parse.len() >= 3) {
+		int weight = (parse.len() >= 4 ? atoi(parse[3]) : 1);
+		if (parse[1] == "files") {
+			g_ctx->SetFileTransferPriority(atoi(parse[2]), weight);
+		} else {
+			g_ctx->SetChannelPriority(atoi(parse[1]), atoi(parse[2]), weight);
+		}
+
+	} else if (parse[0] == "joinbudget" && parse.len() == 2) {
+		g_ctx->SetJoinBudget(atoi(parse[1]));
+		LOG_INFO("Join budget: %d members per update", g_ctx->GetJoinBudget());
+
 	} else if (parse[0] == "status") {
 		auto status = g_ctx->GetStatus();
 		const char* statusStr = "Undefined";
@@ -587,10 +998,20 @@ static void HandleCommand(const s2::string &line)
 				auto memberGuid = member->UnetGuid.str();
 				LOG_INFO("    %d: \"%s\" (%s) (%s)", member->UnetPeer, member->Name.c_str(), member->Valid ? "Valid" : "Invalid", memberGuid.c_str());
 
-				LOG_INFO("      Ping: %d", member->Ping);
+				LOG_INFO("      Ping: %d (rtt %.2f ms, variance %.2f ms, min %.2f ms)", member->Ping, member->GetRoundTrip(), member->GetRoundTripVariance(), member->GetMinRoundTrip());
+				LOG_INFO("      Payload limit: %d bytes", (int)member->GetPayloadLimit());
 
 				LOG_INFO("      %d datas", (int)member->m_data.size());
 
+				if (member->Groups.size() > 0) {
+					s2::string groups;
+					for (auto &group : member->Groups) {
+						groups += (groups.len() > 0 ? ", " : "");
+						groups += group.c_str();
+					}
+					LOG_INFO("      Groups: %s", groups.c_str());
+				}
+
 				LOG_INFO("      %d IDs:", (int)member->IDs.size());
 				for (auto &id : member->IDs) {
 					LOG_INFO("        %s (0x%016" PRIx64 ")%s", Unet::GetServiceNameByType(id.Service), id.ID, member->UnetPrimaryService == id.Service ? " Primary" : "");
@@ -603,13 +1024,66 @@ static void HandleCommand(const s2::string &line)
 			}
 		}
 
+	} else if (parse[0] == "stats") {
+		if (parse.len() == 2) {
+			auto currentLobby = g_ctx->CurrentLobby();
+			if (currentLobby == nullptr) {
+				LOG_ERROR("Not in a lobby.");
+				return;
+			}
+
+			int peer = atoi(parse[1]);
+			auto member = currentLobby->GetMember(peer);
+			if (member == nullptr) {
+				LOG_ERROR("Couldn't find member for peer %d", peer);
+				return;
+			}
+
+			LOG_INFO("Stats for peer %d:", peer);
+			PrintStats(member->GetStats());
+			return;
+		}
+
+		LOG_INFO("Stats:");
+		PrintStats(g_ctx->GetStats());
+
+	} else if (parse[0] == "trace" && parse.len() >= 2) {
+#if defined(UNET_TRACE)
+		if (parse[1] == "on") {
+			Unet::Trace::SetEnabled(true);
+			LOG_INFO("Trace recording enabled");
+
+		} else if (parse[1] == "off") {
+			Unet::Trace::SetEnabled(false);
+			LOG_INFO("Trace recording disabled");
+
+		} else if (parse[1] == "clear") {
+			Unet::Trace::Clear();
+			LOG_INFO("Trace cleared");
+
+		} else if (parse[1] == "save" && parse.len() == 3) {
+			int numZones = Unet::Trace::Export(parse[2]);
+			if (numZones < 0) {
+				LOG_ERROR("Couldn't open \"%s\" for writing", parse[2].c_str());
+			} else {
+				LOG_INFO("Saved %d trace zones to \"%s\"", numZones, parse[2].c_str());
+			}
+
+		} else {
+			LOG_ERROR("Unknown trace command \"%s\"", parse[1].c_str());
+		}
+#else
+		LOG_ERROR("Unet was built without tracing. Run genie with --trace to enable it.");
+#endif
+
 	} else if (parse[0] == "wait") {
 		LOG_INFO("Entering wait mode. Press any key to stop.");
 
 		while (true) {
 			RunCallbacks();
 
-			UnetSleep(1);
+			// Wake up now and then to check for key presses
+			g_ctx->WaitForEvents(50);
 
 			if (IsKeyPressed()) {
 				break;
@@ -925,6 +1399,24 @@ static void HandleCommand(const s2::string &line)
 			RunCallbacks();
 		}
 
+	} else if (parse[0] == "capture" && parse.len() == 2) {
+		if (parse[1] == "stop") {
+			g_ctx->StopCapture();
+			LOG_INFO("Packet capture stopped");
+		} else if (g_ctx->StartCapture(parse[1])) {
+			LOG_INFO("Capturing packets to \"%s\"", parse[1].c_str());
+		}
+
+	} else if (parse[0] == "replay" && parse.len() >= 2) {
+		float speed = 1.0f;
+		if (parse.len() == 3) {
+			speed = (float)atof(parse[2]);
+		}
+
+		if (g_ctx->EnableReplay(parse[1], speed)) {
+			LOG_INFO("Replay service enabled at %.1fx speed, create or join a lobby to start playback", speed);
+		}
+
 	} else if (parse[0] == "outage" && parse.len() == 2) {
 		s2::string strService = parse[1];
 		Unet::ServiceType service = Unet::GetServiceTypeByName(strService);
@@ -960,6 +1452,37 @@ static void HandleCommand(const s2::string &line)
 	} else if (parse[0] == "chat" && parse.len() == 2) {
 		g_ctx->SendChat(parse[1]);
 
+	} else if (parse[0] == "group" && parse.len() == 3) {
+		if (parse[1] == "join") {
+			g_ctx->JoinGroup(parse[2]);
+		} else if (parse[1] == "leave") {
+			g_ctx->LeaveGroup(parse[2]);
+		}
+
+	} else if (parse[0] == "updates" && parse.len() == 2) {
+		g_ctx->SetReceiveMemberData(parse[1] == "on");
+		LOG_INFO("Member updates: %s", g_ctx->GetReceiveMemberData() ? "on" : "off");
+
+	} else if (parse[0] == "sendgroup" && parse.len() == 3) {
+		int num = atoi(parse[2]);
+
+		auto currentLobby = g_ctx->CurrentLobby();
+		if (currentLobby == nullptr) {
+			LOG_ERROR("Not in a lobby.");
+			return;
+		}
+
+		uint8_t* bytes = (uint8_t*)malloc(num);
+		if (bytes != nullptr) {
+			for (int i = 0; i < num; i++) {
+				bytes[i] = (uint8_t)(rand() % 255);
+			}
+			g_ctx->SendToGroup(parse[1], bytes, num, Unet::PacketType::Reliable);
+			free(bytes);
+		}
+
+		LOG_INFO("0x%X reliable bytes sent to %d members of group \"%s\"", num, (int)currentLobby->GetGroupMembers(parse[1].c_str()).size(), parse[1].c_str());
+
 	} else if (parse[0] == "send" && parse.len() == 3) {
 		int peer = atoi(parse[1]);
 		int num = atoi(parse[2]);
@@ -987,6 +1510,35 @@ static void HandleCommand(const s2::string &line)
 
 		LOG_INFO("0x%X reliable bytes sent to peer %d: \"%s\"!", num, member->UnetPeer, member->Name.c_str());
 
+	} else if (parse[0] == "sendbuf" && parse.len() == 3) {
+		int peer = atoi(parse[1]);
+		int num = atoi(parse[2]);
+
+		if (num <= 0) {
+			LOG_ERROR("Number of bytes must be more than 0!");
+			return;
+		}
+
+		auto currentLobby = g_ctx->CurrentLobby();
+		if (currentLobby == nullptr) {
+			LOG_ERROR("Not in a lobby.");
+			return;
+		}
+
+		auto member = currentLobby->GetMember(peer);
+		if (member == nullptr) {
+			LOG_ERROR("Peer ID %d does not belong to a member!", peer);
+			return;
+		}
+
+		uint8_t* bytes = g_ctx->AcquireSendBuffer((size_t)num);
+		for (int i = 0; i < num; i++) {
+			bytes[i] = (uint8_t)(rand() % 255);
+		}
+		g_ctx->CommitSendBuffer(member, (size_t)num, Unet::PacketType::Reliable);
+
+		LOG_INFO("0x%X reliable bytes sent from the send buffer to peer %d: \"%s\"!", num, member->UnetPeer, member->Name.c_str());
+
 	} else if (parse[0] == "sendu" && parse.len() == 3) {
 		int peer = atoi(parse[1]);
 		int num = atoi(parse[2]);
@@ -1080,6 +1632,53 @@ static void HandleCommand(const s2::string &line)
 
 		free(randomBuffer);
 
+	} else if (parse[0] == "bench") {
+#if defined(UNET_MODULE_ENET)
+		if (!g_enetEnabled) {
+			LOG_ERROR("Enet is not enabled!");
+			return;
+		}
+
+		BenchOptions options;
+		for (size_t i = 1; i < parse.len(); i++) {
+			s2::string arg = parse[i];
+			auto kv = arg.split("=", 2);
+			if (kv.len() != 2) {
+				LOG_ERROR("Invalid bench option \"%s\", expected key=value", arg.c_str());
+				return;
+			}
+
+			s2::string key = kv[0];
+			s2::string value = kv[1];
+			if (key == "clients") {
+				options.Clients = std::max(1, atoi(value));
+			} else if (key == "rate") {
+				options.Rate = std::max(0, atoi(value));
+			} else if (key == "size") {
+				options.Size = std::max(1, atoi(value));
+			} else if (key == "sec") {
+				options.Seconds = std::max(1, atoi(value));
+			} else if (key == "channels") {
+				options.Channels = std::max(1, std::min(atoi(value), 250));
+			} else if (key == "reliable") {
+				options.Reliable = atoi(value);
+			} else if (key == "to") {
+				options.ToAll = (value == "all");
+			} else if (key == "shards") {
+				options.Shards = std::max(0, atoi(value));
+			} else if (key == "port") {
+				options.Port = atoi(value);
+			} else {
+				LOG_ERROR("Unknown bench option \"%s\"", key.c_str());
+				return;
+			}
+		}
+
+		RunBench(options);
+#else
+		LOG_ERROR("Unet was built without Enet, which the bench needs.");
+#endif
+
 	} else {
 		LOG_ERROR("Unknown command \"%s\"! Try \"help\".", parse[0].c_str());
 	}
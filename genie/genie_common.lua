@@ -1,5 +1,10 @@
 local DIR_GENIE = (path.getabsolute('.') .. '/')
 
+newoption {
+	trigger = 'trace',
+	description = 'Compile in trace zones that can be exported as Chrome trace JSON (UNET_TRACE)',
+}
+
 -- Verifies and returns a valid options object
 function unet_verify_options(options)
 	if not options then options = {} end
@@ -43,6 +48,10 @@ function unet_defines()
 		defines { 'PLATFORM_MACOS' }
 	end
 
+	if _OPTIONS['trace'] then
+		defines { 'UNET_TRACE' }
+	end
+
 	configuration 'Debug'
 		defines { 'DEBUG' }
 	configuration 'Release'
@@ -81,9 +90,9 @@ function unet_guid()
 		defines { 'GUID_GENERIC' }
 	end
 
-	-- Guid links
+	-- Guid links (and threads for host shards)
 	if os.get() == 'linux' then
-		links { 'uuid' }
+		links { 'uuid', 'pthread' }
 	elseif os.get() == 'macosx' then
 		links { 'CoreFoundation.framework' }
 	end
@@ -13,7 +13,9 @@ return function(options, core)
 		-- Files
 		files {
 			DIR_ROOT .. 'include/Unet/Services/ServiceEnet.h',
+			DIR_ROOT .. 'include/Unet/Services/EnetDiscovery.h',
 			DIR_ROOT .. 'src/Services/ServiceEnet.cpp',
+			DIR_ROOT .. 'src/Services/EnetDiscovery.cpp',
 		}
 	end
 
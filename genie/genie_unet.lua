@@ -24,6 +24,7 @@ function unet_project(options)
 			DIR_ROOT .. 'src/*.cpp',
 			DIR_ROOT .. 'src/*.c',
 			DIR_ROOT .. 'src/Results/*.cpp',
+			DIR_ROOT .. 'src/Services/ServiceReplay.cpp',
 			DIR_ROOT .. 'include/**.hpp',
 			DIR_ROOT .. 'include/**.h',
 		}
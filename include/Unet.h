@@ -4,6 +4,7 @@
 
 #include <Unet/ICallbacks.h>
 #include <Unet/IContext.h>
+#include <Unet/IServer.h>
 
 namespace Unet
 {
@@ -13,6 +14,13 @@ namespace Unet
 	// Destroy a context
 	void DestroyContext(IContext* ctx);
 
+	// Create a server, which hosts many lobbies in a single process on one shared Enet host that is
+	// bound to the given port. Returns nullptr if Unet was built without the Enet module.
+	IServer* CreateServer(uint16_t port, int maxPeers, int numChannels = 1);
+
+	// Destroy a server, including all of its contexts
+	void DestroyServer(IServer* server);
+
 	// Get the current version string of the library
 	const char* GetVersion();
 }
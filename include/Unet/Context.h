@@ -8,6 +8,11 @@
 #include <Unet/MultiCallback.h>
 #include <Unet/NetworkMessage.h>
 #include <Unet/Reassembly.h>
+#include <Unet/SendScheduler.h>
+#include <Unet/NetworkStats.h>
+#include <Unet/PacketCapture.h>
+#include <Unet/TimerWheel.h>
+#include <Unet/HostShards.h>
 #include <Unet/IContext.h>
 
 namespace Unet
@@ -16,9 +21,11 @@ namespace Unet
 	{
 		class Context : public IContext
 		{
+			friend class ::Unet::HostShards;
 			friend class ::Unet::Lobby;
 			friend class ::Unet::LobbyMember;
 			friend struct ::Unet::LobbyListResult;
+			friend class Server;
 
 		public:
 			Context(int numChannels = 1);
@@ -30,6 +37,20 @@ namespace Unet
 			virtual ICallbacks* GetCallbacks() override;
 
 			virtual void RunCallbacks() override;
+			virtual bool WaitForEvents(int timeoutMs) override;
+
+			virtual void SetHostShards(int numShards) override;
+			virtual int GetHostShards() override;
+
+			virtual void SetSendRate(int bytesPerSecond) override;
+			virtual int GetSendRate() override;
+			virtual void SetChannelPriority(int channel, int priority, int weight = 1) override;
+			virtual void SetFileTransferPriority(int priority, int weight = 1) override;
+
+			virtual void SetJoinBudget(int joinsPerUpdate) override;
+			virtual int GetJoinBudget() override;
+
+			virtual const NetworkStats &GetStats() override;
 
 			virtual void SetPrimaryService(ServiceType service) override;
 			virtual ServiceType GetPrimaryService() override;
@@ -38,6 +59,10 @@ namespace Unet
 			virtual int ServiceCount() override;
 			virtual void SimulateServiceOutage(ServiceType service) override;
 
+			virtual bool StartCapture(const char* filename) override;
+			virtual void StopCapture() override;
+			virtual bool EnableReplay(const char* filename, float speed = 1.0f) override;
+
 			virtual void CreateLobby(LobbyPrivacy privacy, int maxPlayers, const char* name = nullptr) override;
 
 			virtual void GetLobbyList(const LobbyListFilter &filter) override;
@@ -63,15 +88,27 @@ namespace Unet
 			virtual void RequestFile(LobbyMember* member, const char* filename) override;
 			virtual void RequestFile(LobbyMember* member, LobbyFile* file) override;
 
+			virtual void JoinGroup(const char* group) override;
+			virtual void LeaveGroup(const char* group) override;
+
+			virtual void SetReceiveMemberData(bool receive) override;
+			virtual bool GetReceiveMemberData() override;
+
 			virtual void SendChat(const char* message) override;
 
 			virtual bool IsMessageAvailable(int channel) override;
 			virtual NetworkMessageRef ReadMessage(int channel) override;
 
-			void SendTo_Impl(LobbyMember* member, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0);
+			// Headroom is the number of bytes in front of data that may be overwritten with headers
+			void SendTo_Impl(LobbyMember* member, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0, size_t headroom = 0);
+			void SendTo_Headroom(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel, size_t headroom);
 			virtual void SendTo(LobbyMember* member, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
+			virtual void SendTo(LobbyMember* member, const Slice* parts, int count, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
+			virtual uint8_t* AcquireSendBuffer(size_t size) override;
+			virtual void CommitSendBuffer(LobbyMember* member, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
 			virtual void SendToAll(uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
 			virtual void SendToAllExcept(LobbyMember* exceptMember, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
+			virtual void SendToGroup(const char* group, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
 			virtual void SendToHost(uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
 
 		private:
@@ -81,21 +118,73 @@ namespace Unet
 		public:
 			void InternalSendTo(LobbyMember* member, const json &js, uint8_t* binaryData = nullptr, size_t binarySize = 0);
 			void InternalSendTo(const ServiceID &id, const json &js, uint8_t* binaryData = nullptr, size_t binarySize = 0);
+			void InternalSendPackedTo(LobbyMember* member, const std::vector<uint8_t> &msg, uint8_t* binaryData = nullptr, size_t binarySize = 0);
 			void InternalSendToAll(const json &js, uint8_t* binaryData = nullptr, size_t binarySize = 0);
 			void InternalSendToAllExcept(LobbyMember* exceptMember, const json &js, uint8_t* binaryData = nullptr, size_t binarySize = 0);
 			void InternalSendToHost(const json &js, uint8_t* binaryData = nullptr, size_t binarySize = 0);
 
+			// Sends an announcement about a member's data or files to everyone that wants to hear about it
+			void InternalSendMemberUpdate(LobbyMember* member, const json &js, LobbyMember* exceptMember = nullptr);
+
+			// Sends an internal message that's scheduled as file transfer traffic
+			void InternalSendFileData(LobbyMember* member, const json &js, uint8_t* binaryData, size_t binarySize);
+
+			// Sends a binary-only internal message (see Lobby::HandleBinaryMessage), starting with a LobbyPacketType
+			void InternalSendBinaryTo(LobbyMember* member, const uint8_t* data, size_t size, PacketType type = PacketType::Reliable);
+			void InternalSendBinaryTo(const ServiceID &id, const uint8_t* data, size_t size, PacketType type = PacketType::Reliable);
+
+			// Filters and queues a received UnreliableSequenced or LatestOnly message
+			void HandleSequencedMessage(LobbyMember* sender, int channel, PacketType type, uint32_t sequence, uint8_t* data, size_t size);
+
 		private:
+			void SendSequenced(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel, size_t headroom);
+
+			// Sends a message once to the host, which sends it on to everyone but us and the given member
+			bool TrySendRelayBroadcast(LobbyMember* exceptMember, uint8_t* data, size_t size, PacketType type, uint8_t channel);
+			void SendRelayBroadcast_Impl(Service* serviceHost, const ServiceID &idHost, int exceptPeer, const uint8_t* data, size_t size, bool unsequencedMarker, PacketType type, uint8_t channel);
+			void InternalSendTo_Impl(const ServiceID &id, const std::vector<uint8_t> &msg, uint8_t* binaryData, size_t binarySize, int sendClass);
+
 			void OnLobbyCreated(const CreateLobbyResult &result);
 			void OnLobbyList(const LobbyListResult &result);
 			void OnLobbyJoined(const LobbyJoinResult &result);
 			void OnLobbyLeft(const LobbyLeftResult &result);
 
+			// Asks the host for the lobby info, with the version of our cached snapshot if we have one
+			void SendHello();
+
 			void OnLobbyPlayerLeft(LobbyMember* member);
 
+			template<typename TResult>
+			void BeginRequest(MultiCallback<TResult> &callback);
+
+			void OnJoinTimeout();
+			void OnKickTimeout(LobbyMember* member);
+			void OnExpireTimer();
+
+			bool ForwardRelayPacket(Service* service);
+
+			// Sends a relay broadcast from the given client to everyone else in the lobby (including us)
+			void BroadcastRelayPacket(const ServiceID &peer, uint8_t* data, size_t size);
+			void HandleRelayedMessage(LobbyMember* sender, uint8_t channel, PacketType type, uint8_t* data, size_t size, size_t packetSizeLimit);
+			void ReadShardPacket(Service* service, size_t packetSize, uint8_t serviceChannel, int channel);
+
+			void QueueMessage(NetworkMessage* msg);
+			void ClearQueuedMessages();
+			void OnMessageRead(NetworkMessage* msg);
+
 			void PrepareReceiveBuffer(size_t size);
 			void PrepareSendBuffer(size_t size);
 
+			// Checked by the public send functions, before anything is indexed by the channel
+			bool IsValidSendChannel(uint8_t channel);
+
+			// Only once we know the lobby supports them, so messages before joining use the older format
+			bool UseFragmentStreams();
+
+			// Adds the sockets to wait on, and returns how long we can wait at most (but no longer than maxWait)
+			int GetWaitTime(std::vector<System::SocketHandle> &sockets, int maxWait);
+			static bool WaitForSockets(System::SocketWaiter &waiter, std::vector<System::SocketHandle> &sockets, int waitTime);
+
 		private:
 			std::string m_personaName;
 
@@ -110,15 +199,54 @@ namespace Unet
 			xg::Guid m_localGuid;
 			int m_localPeer;
 
+			// Whether we want the host to tell us about other members' data and files
+			bool m_receiveMemberData;
+
+			// Waits for the lobby info from the host after joining
+			TimerID m_joinTimer;
+			std::chrono::steady_clock::time_point m_helloTime;
+
+			// New members the host admits per RunCallbacks, or 0 for no limit
+			int m_joinBudget;
+
+			// The last lobby info received from a host, so that rejoining only needs the changes
+			LobbySnapshotCache m_lobbyCache;
+
 			std::vector<Service*> m_services;
 
 			std::vector<std::queue<NetworkMessage*>> m_queuedMessages;
+
+			// Whether messages were queued since the last GetWaitTime
+			bool m_messagesArrived;
+
+			// Queued LatestOnly messages by sender, channel and key
+			std::unordered_map<uint64_t, NetworkMessage*> m_latestMessages;
 			Reassembly m_reassembly;
+			SendScheduler m_scheduler;
+			HostShards* m_shards;
 
 			std::vector<uint8_t> m_receiveBuffer;
 			std::vector<uint8_t> m_sendBuffer;
 
+			// Handed out by AcquireSendBuffer, with SEND_HEADROOM bytes in front
+			std::vector<uint8_t> m_acquiredBuffer;
+
+			// Where SendTo puts the parts of a message together, laid out like m_acquiredBuffer
+			std::vector<uint8_t> m_gatherBuffer;
+
+			System::SocketWaiter m_waiter;
+			std::vector<System::SocketHandle> m_waitSockets;
+
 		public:
+			// Updated directly by services, reassembly and host shards
+			NetworkStats m_stats;
+
+			// Written to directly by services, only while capturing
+			PacketCaptureWriter* m_capture;
+
+			// Advanced once per RunCallbacks, for all periodic work
+			TimerWheel m_timers;
+
 			MultiCallback<CreateLobbyResult> m_callbackCreateLobby;
 			MultiCallback<LobbyListResult> m_callbackLobbyList;
 			MultiCallback<LobbyJoinResult> m_callbackLobbyJoin;
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Unet_common.h>
+#include <Unet/NetworkMessage.h>
+#include <Unet/Reassembly.h>
+#include <Unet/SpscQueue.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace Unet
+{
+	// Spreads the host's receive, reassembly and relay work over a number of worker threads. Every
+	// lobby member is owned by exactly one shard (by hashing its service ID), so all packets from one
+	// member are always handled in order by the same thread.
+	//
+	// Services are not thread safe, so packets are still read and sent on the thread that calls
+	// RunCallbacks. Workers push relayed packets onto a lock-free forwarding queue which the calling
+	// thread drains (and sends) while the workers are still busy.
+	class HostShards
+	{
+	public:
+		struct Forward
+		{
+			ServiceID Recipient; // The sender for broadcasts
+			PacketType Type;
+			NetworkMessage* Message;
+			bool Broadcast = false;
+		};
+
+	private:
+		struct Incoming
+		{
+			ServiceID Peer;
+			int Channel; // -1 for the internal lobby channel, -2 for the relay channel
+			NetworkMessage* Message;
+		};
+
+		struct Shard
+		{
+			Shard(size_t forwardCapacity);
+
+			Reassembly m_reassembly;
+
+			std::vector<Incoming> m_input;
+			std::vector<NetworkMessage*> m_ready;
+			std::vector<std::string> m_errors;
+
+			SpscQueue<Forward> m_forwards;
+			bool m_sendInline = false;
+			int m_numForwarded = 0;
+
+			std::thread m_thread;
+		};
+
+	private:
+		Internal::Context* m_ctx;
+
+		std::vector<Shard*> m_shards;
+		size_t m_numInput = 0;
+
+		std::mutex m_mutex;
+		std::condition_variable m_cvWork;
+		uint64_t m_generation = 0;
+		bool m_stopping = false;
+		std::atomic<int> m_numBusy;
+
+	public:
+		HostShards(Internal::Context* ctx, int numShards);
+		~HostShards();
+
+		int NumShards();
+
+		// Queues a received packet for the shard that owns the given peer. Channel -1 is the internal
+		// lobby channel and channel -2 is the relay channel. Takes ownership of the message.
+		void Add(const ServiceID &peer, int channel, NetworkMessage* msg);
+
+		// Handles all queued packets. Must be called from the thread that calls RunCallbacks. Returns true
+		// if any packets were relayed.
+		bool Process();
+
+		// Drops all queued and partially reassembled packets.
+		void Clear();
+
+		// Drops partially reassembled packets whose first fragment arrived before the given time. Must be
+		// called from the thread that calls RunCallbacks.
+		void Expire(std::chrono::steady_clock::time_point before, std::chrono::steady_clock::time_point unreliableBefore);
+
+	private:
+		void WorkerThread(Shard* shard);
+
+		void ProcessShard(Shard* shard);
+		void HandleRelay(Shard* shard, const Incoming &in);
+		void PushForward(Shard* shard, const Forward &forward);
+
+		bool DrainForwards();
+		void SendForward(const Forward &forward);
+	};
+}
@@ -4,6 +4,7 @@
 #include <Unet/NetworkMessage.h>
 #include <Unet/LobbyMember.h>
 #include <Unet/LobbyListFilter.h>
+#include <Unet/NetworkStats.h>
 
 namespace Unet
 {
@@ -36,6 +37,60 @@ namespace Unet
 		// Call this every frame in order to run callbacks and handle all the networking logic.
 		virtual void RunCallbacks() = 0;
 
+		// Blocks until RunCallbacks has something to do, or until the timeout (in milliseconds) runs out.
+		// This wakes up as soon as packets arrive on a service's sockets or a timer is due, so dedicated
+		// servers can call it in between RunCallbacks instead of sleeping. Services without sockets to
+		// wait on (Steam and Galaxy) are still polled every few milliseconds. Messages that are still
+		// unread don't keep this from waiting, only ones that arrived since the last call do, so read
+		// them before waiting again. Returns false if the timeout ran out without anything happening.
+		virtual bool WaitForEvents(int timeoutMs) = 0;
+
+		// Spread the host's receive, reassembly and relay work over the given number of worker threads.
+		// This is only worth it for very big lobbies, where a single core can't keep up with relaying
+		// packets. Pass 0 to do everything on the calling thread again, which is the default. This can
+		// only be changed while not in a lobby.
+		//
+		// Relayed packets are always handled by the workers. Other channels only are for services that
+		// need packet reassembly. Packets are still read and sent on the thread that calls RunCallbacks.
+		virtual void SetHostShards(int numShards) = 0;
+
+		// Gets the number of host worker threads, or 0 if sharding is disabled.
+		virtual int GetHostShards() = 0;
+
+		// Limits outgoing traffic to the given number of bytes per second, across all peers and services.
+		// While there's a limit, messages are queued and sent in order of their channel's priority. Pass 0
+		// to send everything right away again, which is the default.
+		//
+		// Internal lobby messages are never held back, except for file transfers (see
+		// SetFileTransferPriority).
+		virtual void SetSendRate(int bytesPerSecond) = 0;
+
+		// Gets the send rate in bytes per second, or 0 if there is no limit.
+		virtual int GetSendRate() = 0;
+
+		// Sets the priority of a channel while there's a send rate. Channels with a higher priority are
+		// always sent first, and channels with the same priority share the send rate by their weight.
+		// All channels have a priority of 0 and a weight of 1 by default.
+		virtual void SetChannelPriority(int channel, int priority, int weight = 1) = 0;
+
+		// Sets the priority of file transfers, the same way as SetChannelPriority. File transfers have a
+		// priority of -1 by default, so they only use what the channels leave of the send rate.
+		virtual void SetFileTransferPriority(int priority, int weight = 1) = 0;
+
+		// Limits how many new members the host admits per RunCallbacks. Admitting a member sends it the
+		// lobby info and tells everyone else about it, so when a lot of clients join at once, the rest
+		// wait in line for the next updates, after the traffic of members that are already in the lobby.
+		// Pass 0 to admit everyone right away. The default is 8.
+		virtual void SetJoinBudget(int joinsPerUpdate) = 0;
+
+		// Gets how many new members the host admits per RunCallbacks, or 0 if there is no limit.
+		virtual int GetJoinBudget() = 0;
+
+		// Gets the network statistics of this context. These are counted since the context was created,
+		// across all lobbies. Counters can be read from any thread. For statistics about a single lobby
+		// member, see LobbyMember::GetStats.
+		virtual const NetworkStats &GetStats() = 0;
+
 		// Set the primary service to the given service type. The service type must already be enabled
 		// using EnableService.
 		//
@@ -54,6 +109,21 @@ namespace Unet
 		// Simulate a service outage on the given service. This should only be used for testing!
 		virtual void SimulateServiceOutage(ServiceType service) = 0;
 
+		// Start writing every packet that goes through the enabled services to the given file, with its
+		// timing, until StopCapture is called. Captures can be played back with EnableReplay. Returns
+		// false if the file can't be opened.
+		virtual bool StartCapture(const char* filename) = 0;
+
+		// Stop writing the packet capture.
+		virtual void StopCapture() = 0;
+
+		// Enable a service that plays back the received packets of a capture made with StartCapture, in
+		// place of the first service that was captured (so that service can't be enabled as well).
+		// Playback starts once a lobby is created or joined, at the captured timing sped up by the given
+		// factor, or all at once if speed is 0. This is meant for load testing and benchmarking
+		// RunCallbacks against real sessions.
+		virtual bool EnableReplay(const char* filename, float speed = 1.0f) = 0;
+
 		// Create a lobby. Before a lobby can be created, at least 1 service needs to be enabled.
 		//
 		// The callback OnLobbyCreated will be called with a CreateLobbyResult object.
@@ -132,6 +202,20 @@ namespace Unet
 		// between server and client.
 		virtual void RequestFile(LobbyMember* member, LobbyFile* file) = 0;
 
+		// Joins or leaves a group of lobby members. Groups are created as soon as someone joins them, and
+		// everyone in the lobby knows who's in which group, so anyone can send to a group with SendToGroup.
+		virtual void JoinGroup(const char* group) = 0;
+		virtual void LeaveGroup(const char* group) = 0;
+
+		// Sets whether we want to hear about other members changing their data or files. Members that
+		// don't care about each other (like spectators) can turn this off, so the host doesn't have to
+		// tell them about every change. While it's off, the member data and files of others are not kept
+		// up to date, they stay as they were when we joined (or turned this off). Turning it back on makes
+		// the host send everyone's current data and files once, without running the data and file
+		// callbacks for them. This is on by default, and can be set before joining a lobby.
+		virtual void SetReceiveMemberData(bool receive) = 0;
+		virtual bool GetReceiveMemberData() = 0;
+
 		// Sends a chat message to the lobby. This will also immediately trigger OnLobbyChat in the callbacks
 		// for the local chat message.
 		virtual void SendChat(const char* message) = 0;
@@ -154,21 +238,47 @@ namespace Unet
 		// messages will not always be fast, depending on which service the data is being sent through.
 		// Typical LAN tests show that speeds can be as low as 1 MB/s.
 		//
-		// Unreliable packets should not be bigger than 1198 bytes. Unreliable packets are always sent
-		// unsequenced, and as such don't allow for bigger sizes than MTU. While MTU may be 1200 bytes,
-		// we have to account for the possibility of sending relay-packet header data, so having a safety
-		// margin of at least 2 bytes is recommended.
+		// Unreliable packets should preferably not be bigger than LobbyMember::GetPayloadLimit, which takes
+		// the service, the path to the member and relay headers into account. If that's not known, stay
+		// below 1196 bytes (1200 bytes of MTU, minus the relay header). Bigger unreliable messages are
+		// split into unreliable fragments (by Unet on Steam, by Enet itself on Enet), and if any fragment
+		// is lost, the whole message is lost. Incomplete messages are dropped after a second. Older lobby
+		// hosts don't support this on Steam, in which case the message is sent as is.
+		//
+		// UnreliableSequenced and LatestOnly messages are unreliable too, but they carry a sequence number,
+		// so they should stay at least 12 bytes below MTU. Stale messages are dropped on the receiving end
+		// (see PacketType), so they're always queued until they're read with ReadMessage.
 		//
 		// The channel you send data on is an index starting at 0. You must have created the context with
 		// a sufficient number of channels if you wish to use multiple channels.
 		virtual void SendTo(LobbyMember* member, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) = 0;
 
+		// Send a message made up of several buffers, which are sent as one message in the given order. This
+		// only copies the parts once, into the buffer the packet is sent from. See SendTo for more details.
+		virtual void SendTo(LobbyMember* member, const Slice* parts, int count, PacketType type = PacketType::Reliable, uint8_t channel = 0) = 0;
+
+		// Gets a buffer of at least the given size to write a message into, which is then sent with
+		// CommitSendBuffer. The buffer has room for the headers in front of it, so direct (unfragmented)
+		// packets go to the service without being copied. The buffer stays valid until the next call to
+		// AcquireSendBuffer, and can be committed to several members.
+		virtual uint8_t* AcquireSendBuffer(size_t size) = 0;
+
+		// Sends the first size bytes of the buffer from AcquireSendBuffer. See SendTo for more details.
+		virtual void CommitSendBuffer(LobbyMember* member, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) = 0;
+
 		// Send a message to all clients in the lobby. See SendTo for more details.
+		//
+		// When more than one member would have to be reached through the host, clients send the message
+		// to the host only once, and the host sends it on to everyone (including members we could reach
+		// directly). This doesn't apply to UnreliableSequenced and LatestOnly messages.
 		virtual void SendToAll(uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) = 0;
 
 		// Send a message to all clients in the lobby, except the given one. See SendTo for more details.
 		virtual void SendToAllExcept(LobbyMember* exceptMember, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) = 0;
 
+		// Send a message to all members of the given group, except ourselves. See SendTo for more details.
+		virtual void SendToGroup(const char* group, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) = 0;
+
 		// Send a message to the host of the lobby. See SendTo for more details.
 		virtual void SendToHost(uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) = 0;
 	};
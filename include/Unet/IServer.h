@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Unet_common.h>
+#include <Unet/ICallbacks.h>
+#include <Unet/IContext.h>
+
+namespace Unet
+{
+	class IServer
+	{
+	public:
+		virtual ~IServer() {}
+
+		// Create a new context that hosts its lobby on the server's shared Enet host. The context is owned
+		// by the server and must only be destroyed using DestroyContext. Other services may still be
+		// enabled on the context as usual.
+		//
+		// All lobbies created by the server's contexts share a single socket. Each lobby gets its own
+		// lobby key, which is part of its Enet entry point ID, so clients joining through the entry point
+		// are automatically connected to the right lobby.
+		virtual IContext* CreateContext() = 0;
+
+		// Destroy a context that was created using CreateContext.
+		virtual void DestroyContext(IContext* ctx) = 0;
+
+		// Gets how many contexts currently exist on this server.
+		virtual int ContextCount() = 0;
+
+		// Gets a context by its index.
+		virtual IContext* GetContext(int index) = 0;
+
+		// Call this every frame instead of calling RunCallbacks on each context. This services the shared
+		// Enet host once, passes all events on to the lobbies they belong to, and then runs callbacks on
+		// all contexts.
+		virtual void RunCallbacks() = 0;
+
+		// Blocks until RunCallbacks has something to do for any of the contexts, or until the timeout
+		// runs out. See IContext::WaitForEvents.
+		virtual bool WaitForEvents(int timeoutMs) = 0;
+	};
+}
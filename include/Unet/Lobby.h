@@ -4,6 +4,16 @@
 #include <Unet/LobbyInfo.h>
 #include <Unet/LobbyMember.h>
 #include <Unet/LobbyData.h>
+#include <Unet/LobbySnapshot.h>
+
+#include <deque>
+#include <unordered_map>
+
+// Peer IDs in relay headers are 2 bytes, unless the host is older and only knows 1 byte peer IDs
+#define UNET_PEER_BYTES 2
+
+// Relay packets to this peer ID are sent on to every member by the host (only with 2 byte peer IDs)
+#define UNET_RELAY_BROADCAST 0xFFFF
 
 namespace Unet
 {
@@ -11,6 +21,15 @@ namespace Unet
 	{
 		friend class Internal::Context;
 
+	private:
+		// A member that said hello, waiting for the host to admit it
+		struct PendingJoin
+		{
+			xg::Guid Guid;
+			uint32_t SnapshotBase;
+			std::chrono::steady_clock::time_point Received;
+		};
+
 	private:
 		Internal::Context* m_ctx;
 		LobbyInfo m_info;
@@ -18,6 +37,29 @@ namespace Unet
 		std::vector<LobbyMember*> m_members;
 		std::vector<OutgoingFileTransfer> m_outgoingFileTransfers;
 
+		// Lookups for m_members. Every service ID belongs to only one member.
+		std::unordered_map<int, LobbyMember*> m_membersByPeer;
+		std::unordered_map<xg::Guid, LobbyMember*> m_membersByGuid;
+		std::unordered_map<ServiceID, LobbyMember*> m_membersByID;
+
+		// Members of every group that has at least one member
+		std::unordered_map<std::string, std::vector<LobbyMember*>> m_groups;
+
+		// Peer IDs are handed out by the host. Freed IDs are only reused once every ID has been handed out,
+		// oldest first, so that packets still on their way to a member that left don't end up at a new member.
+		int m_nextPeer = 0;
+		std::deque<int> m_freePeers;
+
+		// Size of the peer ID in relay headers, as decided by the host
+		int m_peerBytes = 1;
+
+		// Whether fragments get stream headers (see Reassembly), as decided by the host
+		bool m_fragmentStreams = false;
+
+		// Only used by the host, for sending LobbyInfo to joining members
+		LobbySnapshot m_snapshot;
+		std::deque<PendingJoin> m_pendingJoins;
+
 	private:
 		Lobby(Internal::Context* ctx, const LobbyInfo &lobbyInfo);
 		~Lobby();
@@ -34,12 +76,34 @@ namespace Unet
 		LobbyMember* GetMember(const ServiceID &serviceId);
 		LobbyMember* GetHostMember();
 
+		// Gets the members of a group, which is empty if nobody is in it.
+		const std::vector<LobbyMember*> &GetGroupMembers(const std::string &group);
+
 		void HandleMessage(const ServiceID &peer, uint8_t* data, size_t size);
+		void HandleBinaryMessage(const ServiceID &peer, uint8_t* data, size_t size);
 		LobbyMember* DeserializeMember(const json &member);
 
 		void AddEntryPoint(const ServiceID &id);
 		void ServiceDisconnected(ServiceType service);
 
+		// Relay packets start with the peer ID (the recipient when sent to the host, the sender when relayed
+		// by the host), followed by the channel and the packet type.
+		size_t GetRelayHeaderSize() const;
+		void WriteRelayPeer(uint8_t* data, int peer) const;
+		int ReadRelayPeer(const uint8_t* data) const;
+
+		// Relay broadcasts have the peer ID of an extra member to skip after the relay header, or
+		// UNET_RELAY_BROADCAST to skip nobody (other than the sender).
+		bool SupportsRelayBroadcast() const;
+		size_t GetRelayBroadcastHeaderSize() const;
+
+		// Fragments may only have stream headers if every member understands them.
+		bool SupportsFragmentStreams() const;
+
+		// Only changes local state, returns false if the member was already in (or not in) the group.
+		bool InternalJoinGroup(LobbyMember* member, const std::string &group);
+		bool InternalLeaveGroup(LobbyMember* member, const std::string &group);
+
 		LobbyMember* AddMemberService(const xg::Guid &guid, const ServiceID &id);
 		void RemoveMemberService(const ServiceID &id);
 		void RemoveMember(LobbyMember* member);
@@ -51,12 +115,26 @@ namespace Unet
 
 		void SetRichPresence();
 
+		// Admits up to the given number of members that are waiting to join, or all of them if the budget is 0.
+		void AdmitPendingJoins(int budget);
+		bool HasPendingJoins();
+
 		virtual void SetData(const std::string &name, const std::string &value) override;
 		virtual std::string GetData(const std::string &name) const override;
 		virtual void RemoveData(const std::string &name) override;
 
 	private:
-		int GetNextAvailablePeer();
+		int AllocatePeer();
+		void ReleasePeer(int peer);
+
+		void AddMember(LobbyMember* member);
+		void IndexMember(LobbyMember* member);
+		void UnindexMember(LobbyMember* member);
+
+		void AdmitMember(LobbyMember* member, uint32_t snapshotBase);
+
+		// Sends the lobby info, with only the changes since the given snapshot version if that's not 0
+		void SendLobbyInfo(LobbyMember* member, uint32_t snapshotBase);
 
 		void HandleOutgoingFileTransfers();
 	};
@@ -16,10 +16,15 @@ namespace Unet
 	class LobbyDataContainer
 	{
 		friend class Lobby;
+		friend class LobbySnapshot;
 
 	public:
 		std::vector<LobbyData> m_data;
 
+	protected:
+		// Set when the data changes, and cleared once the host's lobby snapshot has picked up the change
+		bool m_dataChanged = true;
+
 	public:
 		virtual void SetData(const std::string &name, const std::string &value);
 		virtual std::string GetData(const std::string &name) const;
@@ -4,15 +4,68 @@
 #include <Unet/ServiceID.h>
 #include <Unet/LobbyData.h>
 #include <Unet/LobbyFile.h>
+#include <Unet/NetworkStats.h>
+#include <Unet/TimerWheel.h>
+
+#include <unordered_map>
+
+// The minimum round trip time is taken over this many of the most recent samples
+#define UNET_MIN_RTT_SAMPLES 16
 
 namespace Unet
 {
 	class LobbyMember : public LobbyDataContainer
 	{
 		friend class ::Unet::Internal::Context;
+		friend class ::Unet::Lobby;
+		friend class ::Unet::LobbySnapshot;
 
 	private:
 		Internal::Context* m_ctx;
+		NetworkStats m_stats;
+
+		TimerID m_pingTimer = 0;
+		TimerID m_kickTimer = 0;
+
+		double m_lastRtt = -1.0;
+		double m_smoothedRtt = -1.0;
+		double m_rttVariance = 0.0;
+
+		double m_rttSamples[UNET_MIN_RTT_SAMPLES];
+		int m_numRttSamples = 0;
+
+		// Sequence numbers of UnreliableSequenced and LatestOnly messages. One counter per channel is used
+		// for sending, received sequence numbers are kept per channel, or per channel and key for LatestOnly.
+		std::vector<uint32_t> m_sendSequence;
+		std::unordered_map<uint64_t, uint32_t> m_receiveSequence;
+
+		// The packed member info in the host's lobby snapshot, with the hash and version it was packed at
+		std::vector<uint8_t> m_snapshot;
+		uint64_t m_snapshotHash = 0;
+		uint32_t m_snapshotVersion = 0;
+
+		// Set when anything but the data changes (which sets m_dataChanged), so the snapshot only hashes
+		// members that might have changed
+		bool m_snapshotDirty = true;
+
+		// Only kept by the host: whether this member wants other members' data and file announcements
+		bool m_receivesMemberData = true;
+
+		// Probing the path to this member, on services that know their payload limit per peer. The limit the
+		// service had before probing is what later probes start at, so a limit that was lowered can be raised
+		// again once the path allows it.
+		size_t m_probeLimit = 0;
+		int m_probeRounds = 0;
+		size_t m_probeStart = 0;
+		size_t m_probeLargest = 0;
+
+		// Rounds in which the biggest probe was lost while a smaller one came back, and the biggest size that
+		// came back in all of them
+		int m_probeFailures = 0;
+		size_t m_probeAcked = 0;
+
+		bool m_probeDone = false;
+		std::chrono::steady_clock::time_point m_probeDoneTime;
 
 	public:
 		// Only true if all fundamental user data has been received after joining the lobby (should only be a concern on the host)
@@ -21,9 +74,8 @@ namespace Unet
 		xg::Guid UnetGuid;
 		int UnetPeer = -1;
 
+		// The smoothed round trip time in whole milliseconds, or -1 if it's not known yet
 		int Ping = -1;
-		std::chrono::high_resolution_clock::time_point LastPingRequest;
-		std::chrono::system_clock::time_point NextPingRequest;
 
 		// The primary service this member uses to communicate (this is decided by which service the Hello packet is sent through)
 		ServiceType UnetPrimaryService = ServiceType::None;
@@ -32,6 +84,9 @@ namespace Unet
 		std::vector<ServiceID> IDs;
 		std::vector<LobbyFile*> Files;
 
+		// The groups this member is in (see IContext::SendToGroup)
+		std::vector<std::string> Groups;
+
 		// Userdata field which can be set to anything and can be used for anything
 		void* Userdata = nullptr;
 
@@ -58,8 +113,42 @@ namespace Unet
 		void RemoveFile(const std::string &filename);
 		void InternalRemoveFile(const std::string &filename);
 
+		bool InGroup(const std::string &group) const;
+
+		// Only the host can change the groups of other members, clients can only change their own.
+		void JoinGroup(const std::string &group);
+		void LeaveGroup(const std::string &group);
+
+		// Gets the traffic and round trip statistics for this member. See NetworkStats for details.
+		const NetworkStats &GetStats() const;
+
+		// Round trip times in milliseconds, all -1 until the first pong has been received. The smoothed
+		// value and its variance are estimated like TCP does (RFC 6298), with gains of 1/8 and 1/4.
+		double GetRoundTrip() const;
+		double GetRoundTripVariance() const;
+		double GetMinRoundTrip() const;
+		double GetLastRoundTrip() const;
+
 		void SendPing();
-		void SetNextPingRequest();
+		void OnPong(uint64_t timestamp);
+
+		// The biggest unreliable message that can be sent to this member without being split up (by Unet,
+		// the service or IP), taking relaying into account, or 0 if that's not known. On services that
+		// know their packet size per peer (Enet), the path is probed after joining, and this is lowered if
+		// bigger packets don't get through.
+		size_t GetPayloadLimit() const;
+
+		void OnProbeAck(size_t size);
+
+	private:
+		bool IsReachable(const ServiceID &id) const;
+
+		void SchedulePing();
+		void OnPingTimer();
+		void UpdateProbing();
+		void FinishProbing();
+
+	public:
 
 		template<typename T> inline void SetUserData(T* p) { Userdata = (void*)p; }
 		template<typename T> inline T* GetUserData() { return (T*)Userdata; }
@@ -9,22 +9,25 @@ namespace Unet
 		// Sent by the client via all services to announce our Guid and verify our associated Service ID to the host
 		Handshake,
 
-		// Sent by the client via the primary service to announce basic member data such as the player name
+		// Sent by the client via the primary service to announce basic member data such as the player name, and
+		// the lobby and version of the last LobbyInfo it received
 		Hello,
 
-		// Sent by a peer to another peer to determine ping time
+		// Sent by a peer to another peer to determine round trip time, as an unreliable binary message with
+		// the sender's u64 steady clock timestamp in microseconds
 		Ping,
-		// Sent by a peer as a response to Ping
+		// Sent by a peer as a response to Ping, echoing the timestamp
 		Pong,
 
-		// Sent by the server to give basic lobby information, which readies the client
+		// Sent by the server to give basic lobby information, which readies the client. The members are packed
+		// in the binary data. If the client already has an older version, only the changes are sent.
 		LobbyInfo,
 
 		// Sent by the server to announce a new member has joined
 		MemberInfo,
 		// Sent by the server to announce a member has left
 		MemberLeft,
-		// Sent by the server telling a member to leave (TODO: Force player to leave if they don't disconnect after a timeout)
+		// Sent by the server telling a member to leave (the server disconnects them if they're still around after a few seconds)
 		MemberKick,
 
 		// Sent by the server to announce that a member has connected with a new service ID
@@ -65,5 +68,26 @@ namespace Unet
 		// Sent by the client to announce a chat message they wrote
 		// Sent by the server to announce a chat message was sent by a client
 		LobbyChatMessage,
+
+		// Sent by the server to tell a client to establish a direct connection to another client
+		MemberConnect,
+
+		// Sent by a peer to another peer for UnreliableSequenced and LatestOnly messages, as an unreliable
+		// binary message with the user channel, the packet type and a u32 sequence number before the data
+		SequencedMessage,
+
+		// Sent by the client to join or leave a group itself
+		// Sent by the server to announce that a member joined or left a group
+		MemberGroupJoined,
+		MemberGroupLeft,
+
+		// Sent by the client to tell the server whether it wants to hear about other members' data and files
+		MemberOptions,
+
+		// Sent by a peer to another peer to find the biggest packet that gets through, as unreliable binary
+		// messages with the u16 size of the packet on the service, padded up to that size
+		PathProbe,
+		// Sent by a peer as a response to PathProbe, echoing the size
+		PathProbeAck,
 	};
 }
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Unet_common.h>
+#include <Unet/LobbyData.h>
+
+#include <deque>
+#include <unordered_map>
+
+// How many member removals the host remembers, for clients that rejoin with an older snapshot
+#define UNET_SNAPSHOT_MAX_REMOVALS 256
+
+namespace Unet
+{
+	class LobbyMember;
+
+	// The host's cached LobbyInfo for joining clients. Every change to the lobby data or to a member
+	// bumps the snapshot version, and members are only serialized again when they changed. Only the
+	// lobby data and members that were marked as changed (see LobbyMember::m_snapshotDirty) are hashed
+	// again, and the hash keeps changes that were undone from bumping the version.
+	//
+	// Clients remember the last snapshot they received (see LobbySnapshotCache), so when they rejoin
+	// the same lobby they only get the lobby data and members that changed since, and the members that
+	// were removed.
+	class LobbySnapshot
+	{
+	private:
+		struct Removal
+		{
+			xg::Guid Guid;
+			uint32_t Version;
+		};
+
+		uint32_t m_version = 0;
+
+		uint64_t m_dataHash = 0;
+		uint32_t m_dataVersion = 0;
+		json m_data;
+
+		// Members in the snapshot, by the version they last changed in
+		std::unordered_map<xg::Guid, uint32_t> m_memberVersions;
+
+		std::deque<Removal> m_removals;
+
+		// Changes can only be sent from this version on, older removals have been forgotten
+		uint32_t m_deltaBase = 0;
+
+		// The packed members of a full snapshot, each with a u32 size in front
+		std::vector<uint8_t> m_members;
+
+	public:
+		// Brings the snapshot up to date with the lobby. Only members that changed are serialized.
+		void Update(Lobby* lobby);
+
+		uint32_t GetVersion() const;
+
+		// Fills in a LobbyInfo message with the lobby data, and the packed members as binary data. If a
+		// base version is given that's recent enough, only changes since that version are written.
+		void Write(Lobby* lobby, uint32_t base, json &js, std::vector<uint8_t> &members);
+
+		// Reads the packed members from the binary data of a LobbyInfo message.
+		static bool ReadMembers(const uint8_t* data, size_t size, std::vector<json> &members);
+
+	private:
+		static uint64_t HashData(const std::vector<LobbyData> &data);
+		static uint64_t HashMember(const LobbyMember* member);
+		static void AppendMember(std::vector<uint8_t> &buffer, const LobbyMember* member);
+	};
+
+	// The last lobby info a client received, kept by the context across lobbies.
+	struct LobbySnapshotCache
+	{
+		xg::Guid LobbyGuid;
+		uint32_t Version = 0;
+
+		json Data;
+		std::vector<json> Members;
+	};
+}
@@ -14,30 +14,75 @@ namespace Unet
 		{
 			Result Code = Result::None;
 			TResult* Data = nullptr;
+
+			// Set when the service took too long to answer. It may still answer later.
+			bool TimedOut = false;
 		};
 
 	private:
-		TResult m_result;
-		std::vector<ServiceRequest*> m_requests;
+		struct Round
+		{
+			TResult Data;
+			std::vector<ServiceRequest*> Requests;
+
+			~Round()
+			{
+				for (auto serviceRequest : Requests) {
+					delete serviceRequest;
+				}
+			}
+		};
+
+		Round* m_round;
+		uint64_t m_roundIndex = 0;
+
+		// Services hold on to their requests (and the result they point to) until they answer, so rounds
+		// that still have unanswered requests are kept until the callback is destroyed
+		std::vector<Round*> m_abandoned;
 
 	public:
+		MultiCallback()
+		{
+			m_round = new Round;
+		}
+
 		~MultiCallback()
 		{
-			Clear();
+			delete m_round;
+			for (auto round : m_abandoned) {
+				delete round;
+			}
 		}
 
 		TResult &GetResult()
 		{
-			return m_result;
+			return m_round->Data;
+		}
+
+		// Identifies the current set of requests, which changes every time the callback is cleared
+		uint64_t GetRound()
+		{
+			return m_roundIndex;
 		}
 
 		void Clear()
 		{
-			for (auto serviceRequest : m_requests) {
-				delete serviceRequest;
+			bool answered = true;
+			for (auto serviceRequest : m_round->Requests) {
+				if (serviceRequest->Code == Result::None) {
+					answered = false;
+					break;
+				}
+			}
+
+			if (answered) {
+				delete m_round;
+			} else {
+				m_abandoned.emplace_back(m_round);
 			}
-			m_requests.clear();
-			m_result = TResult();
+
+			m_round = new Round;
+			m_roundIndex++;
 		}
 
 		void Begin()
@@ -47,22 +92,40 @@ namespace Unet
 
 		bool Ready()
 		{
-			if (m_requests.size() == 0) {
+			if (m_round->Requests.size() == 0) {
 				return false;
 			}
 
-			for (auto serviceRequest : m_requests) {
-				if (serviceRequest->Code == Result::None) {
+			for (auto serviceRequest : m_round->Requests) {
+				if (serviceRequest->Code == Result::None && !serviceRequest->TimedOut) {
 					return false;
 				}
 			}
 			return true;
 		}
 
+		// Stops waiting for the requests of the given round that haven't been answered yet, so the
+		// callback becomes ready. Returns the number of requests that timed out.
+		int TimeOut(uint64_t round)
+		{
+			if (round != m_roundIndex) {
+				return 0;
+			}
+
+			int ret = 0;
+			for (auto serviceRequest : m_round->Requests) {
+				if (serviceRequest->Code == Result::None && !serviceRequest->TimedOut) {
+					serviceRequest->TimedOut = true;
+					ret++;
+				}
+			}
+			return ret;
+		}
+
 		int NumOK()
 		{
 			int ret = 0;
-			for (auto serviceRequest : m_requests) {
+			for (auto serviceRequest : m_round->Requests) {
 				if (serviceRequest->Code == Result::OK) {
 					ret++;
 				}
@@ -72,14 +135,14 @@ namespace Unet
 
 		int NumRequests()
 		{
-			return (int)m_requests.size();
+			return (int)m_round->Requests.size();
 		}
 
 		ServiceRequest* AddServiceRequest(Service* service)
 		{
 			auto newServiceRequest = new ServiceRequest;
-			newServiceRequest->Data = &m_result;
-			m_requests.emplace_back(newServiceRequest);
+			newServiceRequest->Data = &m_round->Data;
+			m_round->Requests.emplace_back(newServiceRequest);
 			return newServiceRequest;
 		}
 	};
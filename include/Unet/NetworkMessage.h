@@ -3,33 +3,81 @@
 #include <Unet_common.h>
 #include <Unet/ServiceID.h>
 
+struct XXH32_state_s;
+
 namespace Unet
 {
 	enum class PacketType
 	{
+		// Unreliable and unsequenced, so messages can arrive out of order
 		Unreliable,
 		Reliable,
+
+		// Unreliable, but messages that are older than one already received on the same channel (from the
+		// same sender) are dropped
+		UnreliableSequenced,
+
+		// Unreliable, and keyed by the first 4 bytes of the message (such as an entity ID). Only the newest
+		// message per key is delivered: older arrivals are dropped, and a newer message replaces one with
+		// the same key that's still waiting to be read.
+		LatestOnly,
+	};
+
+	// A part of a message that's sent from several separate buffers (see IContext::SendTo)
+	struct Slice
+	{
+		const uint8_t* Data;
+		size_t Size;
 	};
 
 	class NetworkMessage
 	{
 	public:
-		uint8_t m_sequenceId = 0;
+		uint16_t m_sequenceId = 0;
 		uint32_t m_sequenceSize = 0;
 		uint32_t m_sequenceHash = 0;
 
+		// Bytes of the message received so far, while it's still being reassembled
+		uint32_t m_sequenceReceived = 0;
+
+		// Whether the fragments have stream headers (see Reassembly), rather than the older 7 bit sequence ID
+		bool m_sequenceStream = false;
+
+		// Unreliable fragments can arrive in any order (or not at all), so they're tracked in a bitmap
+		bool m_sequenceUnreliable = false;
+		uint8_t m_sequenceCount = 0;
+		uint64_t m_sequenceFragments[4] = {};
+
+		// Hash of the fragments so far, if the sender hashed the message
+		XXH32_state_s* m_sequenceHashState = nullptr;
+
+		// When the first fragment arrived, while the message is still being reassembled
+		std::chrono::steady_clock::time_point m_sequenceStart;
+
 		ServiceID m_peer;
 		int m_channel = 0;
 
+		// Set while a LatestOnly message is queued, so newer messages with the same key can replace it
+		bool m_latestOnly = false;
+		uint64_t m_latestKey = 0;
+
 		uint8_t* m_data;
 		size_t m_size;
 
+		// How many bytes m_data has room for
+		size_t m_capacity;
+
 	public:
 		NetworkMessage(size_t size);
 		NetworkMessage(uint8_t* data, size_t size);
 		~NetworkMessage();
 
-		void Append(uint8_t* data, size_t size);
+		// Makes sure there's room for at least the given number of bytes, without changing the size. Returns
+		// false if that can't be allocated, in which case the data is left as is.
+		bool Reserve(size_t capacity);
+
+		// Appends data, growing the buffer to at least twice its capacity if it doesn't fit.
+		bool Append(const uint8_t* data, size_t size);
 	};
 
 	// A refcounted pointer to a NetworkMessage object.
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Unet_common.h>
+
+#include <atomic>
+
+namespace Unet
+{
+	// A single statistics value. All operations are relaxed atomics, so they're cheap and can be done
+	// from any thread, but separate counters are not guaranteed to be consistent with each other.
+	class StatCounter
+	{
+	private:
+		std::atomic<int64_t> m_value;
+
+	public:
+		StatCounter() : m_value(0) {}
+
+		inline void Add(int64_t amount = 1) { m_value.fetch_add(amount, std::memory_order_relaxed); }
+		inline void Sub(int64_t amount = 1) { m_value.fetch_sub(amount, std::memory_order_relaxed); }
+		inline void Set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+		inline int64_t Get() const { return m_value.load(std::memory_order_relaxed); }
+	};
+
+	// A histogram of millisecond values. Buckets are powers of 2: bucket 0 holds 0 ms, bucket 1 holds
+	// 1 ms, bucket 2 holds 2-3 ms, bucket 3 holds 4-7 ms, and so on. The last bucket also holds
+	// everything above it.
+	class StatHistogram
+	{
+	public:
+		static const int NumBuckets = 14;
+
+	private:
+		StatCounter m_buckets[NumBuckets];
+		StatCounter m_count;
+		StatCounter m_sum;
+
+	public:
+		void Add(int ms);
+
+		int64_t GetBucket(int index) const;
+		static int GetBucketStart(int index);
+
+		int64_t GetCount() const;
+		double GetMean() const;
+
+		// Gets the highest value in the bucket the given percentile (0 to 100) falls in, or -1 if nothing
+		// has been added yet.
+		int GetPercentile(double percentile) const;
+	};
+
+	struct ChannelStats
+	{
+		StatCounter PacketsSent;
+		StatCounter BytesSent;
+		StatCounter PacketsReceived;
+		StatCounter BytesReceived;
+
+		// Number of messages waiting to be read with ReadMessage (only tracked on the context)
+		StatCounter MessagesQueued;
+	};
+
+	// Network statistics of a context or a lobby member. Channels are service channels: 0 is the
+	// internal lobby channel, 1 is the relay channel, and channel N of SendTo is channel 2 + N.
+	//
+	// The context counts every packet that goes through a service (so fragments and relay headers
+	// are included). Lobby members count messages instead, and only track traffic and round trips.
+	class NetworkStats
+	{
+	private:
+		int m_numChannels;
+		std::unique_ptr<ChannelStats[]> m_channels;
+
+	public:
+		// Packets of messages that were split up to fit the service's packet limit
+		StatCounter FragmentsSent;
+		StatCounter FragmentsReceived;
+
+		// Bytes of fragmented messages that are still waiting for the rest of their fragments
+		StatCounter ReassemblyBytes;
+
+		// Fragmented messages that were dropped because the rest of their fragments never arrived (or, for
+		// unreliable messages, because they were too old)
+		StatCounter ReassemblyExpired;
+
+		// Bytes waiting in the send scheduler for the send rate to allow them through
+		StatCounter SendQueueBytes;
+
+		// Packets and bytes relayed by the host on behalf of clients
+		StatCounter RelayedPackets;
+		StatCounter RelayedBytes;
+
+		// Number of network message buffers allocated
+		StatCounter MessagesAllocated;
+
+		// UnreliableSequenced and LatestOnly messages that were dropped (or replaced while queued) because
+		// a newer one arrived
+		StatCounter StaleMessagesDropped;
+
+		// Round trip times, and the difference between consecutive round trip times
+		StatHistogram RoundTrip;
+		StatHistogram Jitter;
+
+		// Members waiting for the host to admit them (see IContext::SetJoinBudget), and how long they
+		// waited once admitted
+		StatCounter JoinsPending;
+		StatHistogram JoinQueueTime;
+
+		// How long it took for the lobby info to arrive after saying hello to the host
+		StatHistogram JoinLatency;
+
+	public:
+		NetworkStats(int numChannels);
+
+		int NumChannels() const;
+
+		ChannelStats &GetChannel(int channel);
+		const ChannelStats &GetChannel(int channel) const;
+
+		int64_t GetTotalBytesSent() const;
+		int64_t GetTotalBytesReceived() const;
+	};
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Unet_common.h>
+#include <Unet/ServiceID.h>
+
+namespace Unet
+{
+	enum class CaptureRecordType : uint8_t
+	{
+		// Describes one of the capturing context's services
+		Service,
+
+		// A packet that went through Service::SendPacket (or ForwardPacket)
+		Sent,
+
+		// A packet that came out of Service::ReadPacket (or was peeked and popped)
+		Received,
+	};
+
+	struct CaptureRecord
+	{
+		CaptureRecordType Type = CaptureRecordType::Service;
+
+		// Microseconds since the capture was started
+		uint64_t Time = 0;
+
+		// The other side of the packet. For service records, this is the local user ID on the service.
+		ServiceID Peer;
+
+		uint8_t Channel = 0;
+
+		// Service records only
+		uint32_t ReliablePacketLimit = 0;
+
+		std::vector<uint8_t> Data;
+	};
+
+	// Writes packets at the service boundary to a compact binary log. The file starts with "UNPC" and a
+	// version byte, followed by records that each start with a record type byte:
+	//
+	//   Service:  u8 service type, u64 user ID, u32 reliable packet limit
+	//   Sent and Received:  varint time delta (us), u8 service type, varint peer ID, u8 channel,
+	//                       varint size, data
+	class PacketCaptureWriter
+	{
+	private:
+		FILE* m_fh = nullptr;
+		std::chrono::steady_clock::time_point m_startTime;
+		uint64_t m_lastTime = 0;
+
+		std::vector<uint8_t> m_buffer;
+
+	public:
+		~PacketCaptureWriter();
+
+		bool Open(const char* filename);
+		void Close();
+		bool IsOpen();
+
+		void WriteService(const ServiceID &userId, size_t reliablePacketLimit);
+		void WritePacket(CaptureRecordType type, const ServiceID &peer, uint8_t channel, const void* data, size_t size);
+
+	private:
+		void WriteVarint(uint64_t value);
+	};
+
+	// Reads a log written by PacketCaptureWriter, one record at a time.
+	class PacketCaptureReader
+	{
+	private:
+		FILE* m_fh = nullptr;
+		uint64_t m_time = 0;
+
+		// Record sizes are checked against this, so a corrupt log can't make us allocate more than it holds
+		uint64_t m_fileSize = 0;
+
+	public:
+		~PacketCaptureReader();
+
+		bool Open(const char* filename);
+		void Close();
+
+		// Reads the next record. Returns false at the end of the log, or when the log is truncated or corrupt.
+		bool Next(CaptureRecord &record);
+
+	private:
+		bool ReadVarint(uint64_t &value);
+	};
+}
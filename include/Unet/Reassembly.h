@@ -3,29 +3,89 @@
 #include <Unet_common.h>
 #include <Unet/NetworkMessage.h>
 #include <Unet/Service.h>
+#include <Unet/NetworkStats.h>
 
 namespace Unet
 {
+	// Splits reliable messages that are too big for a service into fragments, and puts them back together.
+	//
+	// Every packet on a channel that needs reassembly starts with a marker byte:
+	//  - 0: the rest of the packet is a whole message.
+	//  - 1: a fragment with a stream header: a u16 message ID and the u32 offset of the fragment. The first
+	//    fragment (at offset 0) also has the u32 size and u32 hash of the full message. Message IDs are per
+	//    sender, and fragments are matched by sender, channel and ID, so messages on different channels can
+	//    be interleaved (which the send scheduler does when there's a send rate).
+	//  - 2: an unreliable fragment: a u16 message ID, the u8 index and count of fragments, and the u32 size
+	//    of the full message. All fragments but the last are the same size, so they can be put in place in
+	//    any order. Incomplete messages are dropped after a short time, or once a much newer unreliable
+	//    message from the same sender on the same channel arrives.
+	//  - 0x80 and up: the older format, with a 7 bit sequence ID that's shared by all channels. The first
+	//    packet has the u32 size of the full message, followed by the u32 hash if it's fragmented.
+	//
+	// Stream headers are only sent in lobbies whose host supports them, older peers only know the older
+	// format. Both are always understood.
 	class Reassembly
 	{
 	private:
 		Internal::Context* m_ctx;
+		NetworkStats* m_stats = nullptr;
 
+		// Kept in the order the messages were started, so the oldest ones are always at the front
 		std::vector<NetworkMessage*> m_staging;
 		std::queue<NetworkMessage*> m_ready;
 
+		std::queue<std::string> m_errors;
+
 		std::vector<uint8_t> m_tempBuffer;
 		uint8_t m_sequenceId = 0;
+		uint16_t m_streamId = 0;
+		uint16_t m_unreliableId = 0;
 
 	public:
+		// If ctx is null, errors are not logged but kept until they're popped with PopError.
 		Reassembly(Internal::Context* ctx);
 		~Reassembly();
 
+		// Sets the statistics to update with fragment, reassembly and allocation counts. May be null.
+		void SetStats(NetworkStats* stats);
+
 		void HandleMessage(ServiceID peer, int channel, uint8_t* msgData, size_t packetSize);
 		NetworkMessage* PopReady();
+		bool PopError(std::string &error);
+
+		// Drops partially reassembled messages whose first fragment arrived before the given time, or before
+		// unreliableBefore for unreliable messages. Returns the number of messages that were dropped.
+		int Expire(std::chrono::steady_clock::time_point before, std::chrono::steady_clock::time_point unreliableBefore);
 
 		void Clear();
 
-		void SplitMessage(uint8_t* data, size_t size, PacketType type, size_t sizeLimit, const std::function<void(uint8_t*, size_t)> &callback);
+		// Splits a message into packets of at most sizeLimit bytes, so callers that relay the packets have to
+		// leave room for the relay header themselves (Lobby::GetRelayHeaderSize, or
+		// Lobby::GetRelayBroadcastHeaderSize for relay broadcasts). Messages that need more than one packet are hashed so
+		// the receiver can check them, unless hash is false, which sends a hash of 0. Only skip the hash if
+		// the service already checks reliable packets (see Service::ReliablePacketsVerified). Fragments get
+		// stream headers if streams is true. The hash is only skipped for stream headers, since peers that
+		// only know the older format treat a hash of 0 as a mismatch.
+		void SplitMessage(uint8_t* data, size_t size, PacketType type, size_t sizeLimit, bool hash, bool streams, const std::function<void(uint8_t*, size_t)> &callback);
+
+		// Whether an unreliable message fits in a single packet for a service with the given unreliable
+		// packet limit (see Service::UnreliablePacketLimit).
+		static bool FitsUnreliable(size_t size, size_t sizeLimit);
+
+		// Splits an unreliable message into unreliable fragments of at most sizeLimit bytes (again without
+		// room for relay headers). Only for peers that understand stream headers.
+		void SplitUnreliable(uint8_t* data, size_t size, size_t sizeLimit, const std::function<void(uint8_t*, size_t)> &callback);
+
+	private:
+		void HandleLegacyFragment(const ServiceID &peer, int channel, uint8_t* msgData, size_t packetSize);
+		void HandleStreamFragment(const ServiceID &peer, int channel, uint8_t* msgData, size_t packetSize);
+		void HandleUnreliableFragment(const ServiceID &peer, int channel, uint8_t* msgData, size_t packetSize);
+
+		void PushReady(const ServiceID &peer, int channel, uint8_t* data, size_t size);
+		void Complete(std::vector<NetworkMessage*>::iterator it);
+		void Drop(std::vector<NetworkMessage*>::iterator it, const std::string &error);
+		void LogError(const std::string &error);
+
+		void SplitStreams(uint8_t* data, size_t size, size_t sizeLimit, bool hash, const std::function<void(uint8_t*, size_t)> &callback);
 	};
 }
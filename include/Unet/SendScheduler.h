@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Unet_common.h>
+#include <Unet/NetworkMessage.h>
+#include <Unet/NetworkStats.h>
+#include <Unet/Service.h>
+
+namespace Unet
+{
+	// Orders outgoing traffic when the context has a send rate. Every user channel is a traffic class,
+	// and file transfers are one more class. Classes with a higher priority are always sent first, and
+	// classes with the same priority share the send rate by their weight (using deficit round-robin).
+	// Lower priorities only get what's left, so they can starve if higher priorities use up the rate.
+	//
+	// Internal lobby messages (other than file data) are never queued. Without a send rate, nothing is
+	// queued at all and packets go straight to the service.
+	class SendScheduler
+	{
+	public:
+		// The class file transfers are sent on
+		static const int FileClass = 0;
+
+		// The class user channel N is sent on
+		static inline int ChannelClass(int channel) { return channel + 1; }
+
+	private:
+		struct QueuedPacket
+		{
+			Service* Target;
+			ServiceID Peer;
+			PacketType Type;
+			uint8_t ServiceChannel;
+			std::vector<uint8_t> Data;
+		};
+
+		struct TrafficClass
+		{
+			int Priority = 0;
+			int Weight = 1;
+
+			std::queue<QueuedPacket> Queue;
+			size_t QueuedBytes = 0;
+
+			// Bytes this class may still send in the current round
+			int64_t Deficit = 0;
+		};
+
+		NetworkStats* m_stats = nullptr;
+
+		std::vector<TrafficClass> m_classes;
+
+		// Indices of the classes, grouped by priority from high to low
+		std::vector<std::vector<int>> m_order;
+		std::vector<size_t> m_nextInGroup;
+
+		int m_rate = 0;
+		int64_t m_budget = 0;
+		std::chrono::steady_clock::time_point m_lastRefill;
+
+	public:
+		SendScheduler(int numChannels);
+		~SendScheduler();
+
+		// Sets the statistics to update with the number of queued bytes. May be null.
+		void SetStats(NetworkStats* stats);
+
+		void SetPriority(int cls, int priority, int weight);
+
+		// Bytes per second for all classes together, or 0 for no limit.
+		void SetRate(int bytesPerSecond);
+		int GetRate();
+
+		// Sends the packet right away if there's no send rate, otherwise queues a copy of it.
+		void Send(int cls, Service* service, const ServiceID &peer, const uint8_t* data, size_t size, PacketType type, uint8_t serviceChannel);
+
+		size_t GetQueuedBytes(int cls);
+		bool HasQueued();
+
+		// Sends as much queued traffic as the send rate allows since the last flush.
+		void Flush();
+
+		// Drops everything still queued for the given peer.
+		void RemovePeer(const ServiceID &peer);
+		void Clear();
+
+	private:
+		void UpdateOrder();
+		void SendFront(TrafficClass &c);
+	};
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Unet_common.h>
+#include <Unet/IServer.h>
+#include <Unet/Context.h>
+
+namespace Unet
+{
+	class EnetSharedHost;
+
+	namespace Internal
+	{
+		class Server : public IServer
+		{
+		public:
+			Server(uint16_t port, int maxPeers, int numChannels = 1);
+			virtual ~Server();
+
+			virtual IContext* CreateContext() override;
+			virtual void DestroyContext(IContext* ctx) override;
+
+			virtual int ContextCount() override;
+			virtual IContext* GetContext(int index) override;
+
+			virtual void RunCallbacks() override;
+			virtual bool WaitForEvents(int timeoutMs) override;
+
+		private:
+			int m_numChannels;
+
+			EnetSharedHost* m_host;
+			std::vector<Context*> m_contexts;
+
+			System::SocketWaiter m_waiter;
+			std::vector<System::SocketHandle> m_waitSockets;
+		};
+	}
+}
@@ -5,6 +5,9 @@
 #include <Unet/ServiceType.h>
 #include <Unet/NetworkMessage.h>
 
+// How often services that can't be waited on are polled by Context::WaitForEvents
+#define UNET_SERVICE_POLL_MS 5
+
 namespace Unet
 {
 	class Service
@@ -13,12 +16,22 @@ namespace Unet
 		Internal::Context* m_ctx = nullptr;
 		int m_numChannels = 0;
 
+	private:
+		std::vector<uint8_t> m_peekBuffer;
+		ServiceID m_peekPeer;
+		int m_peekChannel = -1;
+
 	public:
 		Service(Internal::Context* ctx, int numChannels);
 		virtual ~Service() {}
 
 		virtual void RunCallbacks() {}
 
+		// Adds the sockets this service receives packets on, for Context::WaitForEvents. Returns how long
+		// (in milliseconds) the service can go without RunCallbacks, or -1 if it only needs RunCallbacks
+		// when something arrives on its sockets. Services without sockets are polled.
+		virtual int GetWaitSockets(std::vector<System::SocketHandle> &sockets) { return UNET_SERVICE_POLL_MS; }
+
 		virtual void SimulateOutage() = 0;
 
 		virtual ServiceType GetType() = 0;
@@ -52,8 +65,58 @@ namespace Unet
 
 		virtual size_t ReliablePacketLimit() = 0;
 
+		// Whether reliable packets are already checked for integrity by the service, so fragmented
+		// messages don't need their own hash.
+		virtual bool ReliablePacketsVerified() { return false; }
+
+		// Size of the biggest unreliable packet the service can send, if it doesn't split them up itself.
+		// Bigger unreliable messages are fragmented, on services that have a reliable packet limit.
+		virtual size_t UnreliablePacketLimit() { return 0; }
+
+		// The biggest payload the service sends to the peer without splitting it up, or 0 if it doesn't know.
+		// Unet probes the path to peers that have one, and lowers it with SetPeerPayloadLimit if bigger
+		// packets don't come through. The path is probed again later, which can raise it back up to the
+		// limit the peer started with.
+		virtual size_t GetPeerPayloadLimit(const ServiceID &peerId) { return 0; }
+		virtual void SetPeerPayloadLimit(const ServiceID &peerId, size_t limit) {}
+
+		// Checks if packets can currently be sent directly to the given peer. Services that connect to
+		// peers on demand don't have to implement this.
+		virtual bool IsPeerConnected(const ServiceID &peerId) { return true; }
+
+		// Called on clients when the host asks two clients to connect directly to each other. Exactly one
+		// side of the connection is the initiator. Until the connection is made, packets between the two
+		// are relayed through the host.
+		virtual void ConnectPeer(const ServiceID &peerId, bool initiator) {}
+
+		// Called on the host to drop the connection to a member that didn't leave after being kicked.
+		// Services that can't force this don't have to implement it.
+		virtual void DisconnectPeer(const ServiceID &peerId) {}
+
 		virtual void SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel) = 0;
 		virtual size_t ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel) = 0;
 		virtual bool IsPacketAvailable(size_t* outPacketSize, uint8_t channel) = 0;
+
+		// Gets the next packet on the given channel without removing it. The data may be modified in
+		// place. The packet stays available until ForwardPacket or PopPacket is called. The default
+		// implementation reads the packet into a buffer, services that can should return their own.
+		virtual bool PeekPacket(uint8_t** outData, size_t* outSize, ServiceID* peerId, uint8_t channel);
+
+		// Sends the peeked packet on the given channel as-is to the given peer on the same channel, and
+		// removes it.
+		virtual void ForwardPacket(const ServiceID &peerId, PacketType type, uint8_t channel);
+
+		// Removes the peeked packet on the given channel.
+		virtual void PopPacket(uint8_t channel);
+
+		// Sends all queued packets right away, if the service queues them. Called once after a batch of
+		// forwarded packets.
+		virtual void FlushPackets() {}
+
+	protected:
+		// Updates the context's traffic statistics and packet capture. Services call these for every
+		// packet they send or receive.
+		void OnPacketSent(const ServiceID &peerId, uint8_t channel, const void* data, size_t size);
+		void OnPacketReceived(const ServiceID &peerId, uint8_t channel, const void* data, size_t size);
 	};
 }
@@ -50,3 +50,15 @@ namespace Unet
 		}
 	};
 }
+
+namespace std
+{
+	template<>
+	struct hash<Unet::ServiceID>
+	{
+		std::size_t operator()(const Unet::ServiceID &id) const
+		{
+			return std::hash<uint64_t>{}(id.ID ^ ((uint64_t)id.Service << 56));
+		}
+	};
+}
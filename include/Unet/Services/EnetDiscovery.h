@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Unet_common.h>
+#include <Unet/ServiceID.h>
+#include <Unet/LobbyData.h>
+
+#include <enet/enet.h>
+
+namespace Unet
+{
+	struct EnetLobbyBeacon
+	{
+		// The entry point of the lobby (the sender's address, with the port and lobby key from the beacon)
+		ServiceID ID;
+
+		xg::Guid UnetGuid;
+		int NumPlayers = 0;
+		int MaxPlayers = 0;
+		std::vector<LobbyData> Data;
+
+		std::chrono::steady_clock::time_point LastSeen;
+
+		std::string GetData(const std::string &name) const;
+	};
+
+	// LAN lobby discovery for Enet. Hosts broadcast a small binary beacon on a fixed UDP port every
+	// second, and everyone with discovery open keeps a cache of the beacons they've received. That way
+	// lobby lists can be answered from the cache without waiting for a round-trip.
+	//
+	// Opening discovery broadcasts a query, which hosts answer right away, so the cache is warm
+	// shortly after.
+	class EnetDiscovery
+	{
+	private:
+		Internal::Context* m_ctx;
+
+		ENetSocket m_socket = ENET_SOCKET_NULL;
+		std::chrono::steady_clock::time_point m_openTime;
+		std::chrono::steady_clock::time_point m_nextAnnounce;
+
+		std::vector<EnetLobbyBeacon> m_lobbies;
+		std::vector<uint8_t> m_buffer;
+
+	public:
+		EnetDiscovery(Internal::Context* ctx);
+		~EnetDiscovery();
+
+		bool Open();
+		void Close();
+		bool IsOpen();
+		ENetSocket GetSocket();
+
+		// Returns true once we've been listening long enough for hosts to have answered our query.
+		bool IsWarm();
+
+		// Asks hosts to send their beacon right away. Broadcasts if no address is given.
+		void Query(const ENetAddress* addr = nullptr);
+
+		// Receives beacons and queries and expires old beacons. If announce is given (only while hosting
+		// a public lobby), it's broadcast periodically and sent in response to queries.
+		void Update(const EnetLobbyBeacon* announce);
+
+		const std::vector<EnetLobbyBeacon> &GetLobbies();
+		const EnetLobbyBeacon* GetLobby(const ServiceID &id);
+
+	private:
+		void Send(const ENetAddress &addr, const EnetLobbyBeacon &beacon);
+		void HandleDatagram(const ENetAddress &from, const uint8_t* data, size_t size, const EnetLobbyBeacon* announce);
+	};
+}
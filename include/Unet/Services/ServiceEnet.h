@@ -3,6 +3,7 @@
 #include <Unet_common.h>
 #include <Unet/Service.h>
 #include <Unet/Context.h>
+#include <Unet/Services/EnetDiscovery.h>
 
 #include <enet/enet.h>
 
@@ -13,37 +14,94 @@
 
 namespace Unet
 {
+	struct EnetPunch
+	{
+		ServiceID ID;
+		bool Initiator;
+		std::chrono::steady_clock::time_point NextPunch;
+		std::chrono::steady_clock::time_point Timeout;
+	};
+
 	struct EnetPacket
 	{
 		ENetPacket* Packet;
 		ENetPeer* Peer;
 	};
 
+	class ServiceEnet;
+
+	// A single Enet host that is shared between multiple Enet services, each hosting their own lobby.
+	// Incoming connections are demultiplexed to the right service by the lobby key that clients pass
+	// as connection data, which is encoded in the upper 16 bits of the lobby's entry point ID.
+	class EnetSharedHost
+	{
+	private:
+		ENetHost* m_host = nullptr;
+		uint16_t m_port = 0;
+		uint16_t m_nextKey = 1;
+
+		std::vector<ServiceEnet*> m_services;
+
+	public:
+		EnetSharedHost(uint16_t port, size_t maxPeers, size_t maxChannels);
+		~EnetSharedHost();
+
+		ENetHost* GetHost();
+		uint16_t GetPort();
+
+		uint16_t Register(ServiceEnet* service);
+		void Unregister(ServiceEnet* service);
+
+		void Service();
+
+	private:
+		ServiceEnet* GetService(uint16_t key);
+	};
+
 	class ServiceEnet : public Service
 	{
+		friend class EnetSharedHost;
+
 	private:
 		ENetHost* m_host = nullptr;
 
+		EnetSharedHost* m_sharedHost = nullptr;
+		uint16_t m_lobbyKey = 0;
+		uint16_t m_hostPort = 0;
+		int m_maxPlayers = 0;
+
 		ENetPeer* m_peerHost = nullptr;
 		std::vector<ENetPeer*> m_peers;
 
 		std::vector<std::queue<EnetPacket>> m_channels;
+		ENetPacket* m_peekedPacket = nullptr;
+
+		LobbyPrivacy m_privacy = LobbyPrivacy::Public;
+		bool m_joinable = true;
+		std::vector<LobbyData> m_lobbyData;
 
+		EnetDiscovery m_discovery;
+		std::vector<std::pair<ServiceID, std::chrono::steady_clock::time_point>> m_fetches;
+
+		MultiCallback<LobbyListResult>::ServiceRequest* m_requestLobbyList = nullptr;
 		MultiCallback<LobbyJoinResult>::ServiceRequest* m_requestLobbyJoin = nullptr;
 		MultiCallback<LobbyLeftResult>::ServiceRequest* m_requestLobbyLeft = nullptr;
 
-		bool m_waitingForPeers = false;
+		std::vector<EnetPunch> m_punches;
 
 	public:
-		static Unet::ServiceID AddressToID(const ENetAddress &addr);
+		static Unet::ServiceID AddressToID(const ENetAddress &addr, uint16_t lobbyKey = 0);
 
 	public:
 		ServiceEnet(Internal::Context* ctx, int numChannels);
 		virtual ~ServiceEnet();
 
+		void SetSharedHost(EnetSharedHost* host);
+
 		virtual void SimulateOutage() override;
 
 		virtual void RunCallbacks() override;
+		virtual int GetWaitSockets(std::vector<System::SocketHandle> &sockets) override;
 
 		virtual ServiceType GetType() override;
 
@@ -76,12 +134,30 @@ namespace Unet
 
 		virtual size_t ReliablePacketLimit() override;
 
+		virtual size_t GetPeerPayloadLimit(const ServiceID &peerId) override;
+		virtual void SetPeerPayloadLimit(const ServiceID &peerId, size_t limit) override;
+
+		virtual bool IsPeerConnected(const ServiceID &peerId) override;
+		virtual void ConnectPeer(const ServiceID &peerId, bool initiator) override;
+		virtual void DisconnectPeer(const ServiceID &peerId) override;
+
 		virtual void SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel) override;
 		virtual size_t ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel) override;
 		virtual bool IsPacketAvailable(size_t* outPacketSize, uint8_t channel) override;
 
+		virtual bool PeekPacket(uint8_t** outData, size_t* outSize, ServiceID* peerId, uint8_t channel) override;
+		virtual void ForwardPacket(const ServiceID &peerId, PacketType type, uint8_t channel) override;
+		virtual void PopPacket(uint8_t channel) override;
+		virtual void FlushPackets() override;
+
 	private:
+		void HandleEvent(const ENetEvent &ev);
+		void DisconnectShared();
+
 		ENetPeer* GetPeer(const ServiceID &id);
+		void UpdatePunches();
+		void UpdateDiscovery();
+		ServiceID GetPeerID(ENetPeer* peer);
 		void Clear(size_t numChannels);
 	};
 }
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Unet_common.h>
+#include <Unet/Service.h>
+#include <Unet/PacketCapture.h>
+#include <Unet/Context.h>
+
+namespace Unet
+{
+	// Plays back the received packets of a capture as if they came from the captured service. It takes
+	// the place of that service (it reports the same service type and user ID), so lobby messages in
+	// the capture recreate the same members. Everything sent through it is counted and dropped.
+	//
+	// Playback starts when a lobby is created or joined. Replaying a host's capture works best by
+	// creating a lobby, a client's capture by joining any lobby ID of the captured service.
+	class ServiceReplay : public Service
+	{
+	private:
+		struct ReplayPacket
+		{
+			ServiceID Peer;
+			std::vector<uint8_t> Data;
+		};
+
+	private:
+		PacketCaptureReader m_reader;
+		ServiceID m_userId;
+		size_t m_reliablePacketLimit = 0;
+
+		float m_speed;
+		bool m_playing = false;
+		std::chrono::steady_clock::time_point m_startTime;
+
+		CaptureRecord m_next;
+		bool m_hasNext = false;
+		uint64_t m_firstTime = 0;
+
+		std::vector<std::queue<ReplayPacket>> m_channels;
+
+		int m_maxPlayers = 0;
+		std::vector<LobbyData> m_lobbyData;
+
+	public:
+		// Speed is a multiplier for the captured timing. A speed of 0 replays everything at once.
+		ServiceReplay(Internal::Context* ctx, int numChannels, float speed);
+		virtual ~ServiceReplay();
+
+		// Opens the capture and picks the first captured service to replay.
+		bool Open(const char* filename);
+
+		// Returns true once all packets have been replayed.
+		bool IsFinished();
+
+		virtual void SimulateOutage() override;
+
+		virtual void RunCallbacks() override;
+
+		virtual ServiceType GetType() override;
+
+		virtual ServiceID GetUserID() override;
+		virtual std::string GetUserName() override;
+
+		virtual void SetRichPresence(const char* key, const char* value) override;
+
+		virtual void CreateLobby(LobbyPrivacy privacy, int maxPlayers) override;
+		virtual void SetLobbyPrivacy(const ServiceID &lobbyId, LobbyPrivacy privacy) override;
+		virtual void SetLobbyJoinable(const ServiceID &lobbyId, bool joinable) override;
+
+		virtual void GetLobbyList() override;
+		virtual bool FetchLobbyInfo(const ServiceID &id) override;
+		virtual void JoinLobby(const ServiceID &id) override;
+		virtual void LeaveLobby() override;
+
+		virtual int GetLobbyPlayerCount(const ServiceID &lobbyId) override;
+		virtual void SetLobbyMaxPlayers(const ServiceID &lobbyId, int amount) override;
+		virtual int GetLobbyMaxPlayers(const ServiceID &lobbyId) override;
+
+		virtual std::string GetLobbyData(const ServiceID &lobbyId, const char* name) override;
+		virtual int GetLobbyDataCount(const ServiceID &lobbyId) override;
+		virtual LobbyData GetLobbyData(const ServiceID &lobbyId, int index) override;
+
+		virtual ServiceID GetLobbyHost(const ServiceID &lobbyId) override;
+
+		virtual void SetLobbyData(const ServiceID &lobbyId, const char* name, const char* value) override;
+		virtual void RemoveLobbyData(const ServiceID &lobbyId, const char* name) override;
+
+		virtual size_t ReliablePacketLimit() override;
+
+		virtual void SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel) override;
+		virtual size_t ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel) override;
+		virtual bool IsPacketAvailable(size_t* outPacketSize, uint8_t channel) override;
+
+	private:
+		void Start();
+		void ReadNext();
+	};
+}
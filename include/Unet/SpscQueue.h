@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Unet_common.h>
+
+#include <atomic>
+
+namespace Unet
+{
+	// A bounded lock-free queue for exactly one producer thread and one consumer thread. Capacity must
+	// be a power of 2.
+	template<typename T>
+	class SpscQueue
+	{
+	private:
+		std::vector<T> m_items;
+		size_t m_mask;
+
+		std::atomic<size_t> m_head;
+		std::atomic<size_t> m_tail;
+
+	public:
+		SpscQueue(size_t capacity)
+			: m_items(capacity), m_mask(capacity - 1), m_head(0), m_tail(0)
+		{
+			assert((capacity & m_mask) == 0);
+		}
+
+		// Producer only. Returns false if the queue is full.
+		bool Push(const T &item)
+		{
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail - m_head.load(std::memory_order_acquire) == m_items.size()) {
+				return false;
+			}
+
+			m_items[tail & m_mask] = item;
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer only. Returns false if the queue is empty.
+		bool Pop(T &item)
+		{
+			size_t head = m_head.load(std::memory_order_relaxed);
+			if (head == m_tail.load(std::memory_order_acquire)) {
+				return false;
+			}
+
+			item = m_items[head & m_mask];
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+	};
+}
@@ -10,5 +10,28 @@ namespace Unet
 
 		bool FolderExists(const char* path);
 		void FolderCreate(const char* path);
+
+		// A native socket handle (a SOCKET on Windows, a file descriptor everywhere else)
+		typedef intptr_t SocketHandle;
+
+		// Blocks until one of a set of sockets has something to read. Uses epoll on Linux, and poll on
+		// other platforms.
+		class SocketWaiter
+		{
+		private:
+			std::vector<SocketHandle> m_sockets;
+			int m_epoll = -1;
+
+		public:
+			SocketWaiter();
+			~SocketWaiter();
+
+			// Sets the sockets to wait on. Call this before every wait, even if the handles look the same, since a
+			// closed socket can be replaced by a new one with the same handle.
+			void SetSockets(const std::vector<SocketHandle> &sockets);
+
+			// Returns true if a socket became readable, or false if the timeout ran out.
+			bool Wait(int timeoutMs);
+		};
 	}
 }
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Unet_common.h>
+
+#include <functional>
+#include <unordered_map>
+
+#define UNET_TIMER_LEVELS 4
+#define UNET_TIMER_SLOT_BITS 6
+#define UNET_TIMER_SLOTS (1 << UNET_TIMER_SLOT_BITS)
+
+namespace Unet
+{
+	typedef uint64_t TimerID;
+
+	// A hierarchical timer wheel on the steady clock with a resolution of 1 millisecond. Each level has
+	// 64 slots, and every level covers 64 times the range of the level below it, so 4 levels cover about
+	// 4.6 hours (anything further away waits in the last level and is cascaded down again).
+	//
+	// Scheduling and cancelling are O(1). Advancing does O(1) work per elapsed tick, plus cascading a
+	// slot of the next level every 64 ticks. Callbacks run from Advance, and may schedule or cancel
+	// timers themselves.
+	class TimerWheel
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+		typedef std::function<void()> Callback;
+
+	private:
+		struct Timer
+		{
+			uint64_t Tick;
+			Callback Func;
+		};
+
+		Clock::time_point m_start;
+		uint64_t m_currentTick = 0;
+
+		TimerID m_nextId = 1;
+
+		// Slots only hold IDs, cancelled timers are skipped when their slot comes up
+		std::unordered_map<TimerID, Timer> m_timers;
+		std::vector<TimerID> m_slots[UNET_TIMER_LEVELS][UNET_TIMER_SLOTS];
+
+	public:
+		TimerWheel();
+
+		// Runs the callback once after the given delay. Returns an ID that can be used to cancel it.
+		TimerID Schedule(Clock::duration delay, const Callback &func);
+		TimerID ScheduleAt(Clock::time_point when, const Callback &func);
+
+		// Does nothing if the timer has already fired or was cancelled. An ID of 0 is never used.
+		void Cancel(TimerID id);
+		bool IsScheduled(TimerID id) const;
+
+		size_t Count() const;
+
+		// Gets the time Advance should be called next, or Clock::time_point::max() if there are no timers.
+		// For timers more than 64 ticks away this is when they move down a level, which can be earlier
+		// than when they're due.
+		Clock::time_point GetNextDeadline() const;
+
+		// Runs all timers that are due at the given time.
+		void Advance(Clock::time_point now);
+
+	private:
+		uint64_t GetTick(Clock::time_point time) const;
+		bool HasLiveTimers(const std::vector<TimerID> &slot) const;
+		void Insert(TimerID id, uint64_t tick);
+		void Cascade(int level);
+	};
+}
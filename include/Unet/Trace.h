@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Unet_common.h>
+
+// Scoped trace zones for finding out where time goes inside RunCallbacks. Tracing is only compiled in
+// when UNET_TRACE is defined (pass --trace to genie), otherwise UNET_TRACE_ZONE expands to nothing.
+//
+// Every thread records into its own lock-free ring buffer, which keeps the last UNET_TRACE_CAPACITY
+// zones. The buffers can be exported at any time as Chrome trace-event JSON, which can be opened in
+// chrome://tracing or Perfetto.
+
+#if defined(UNET_TRACE)
+
+#include <atomic>
+
+#define UNET_TRACE_CAPACITY (64 * 1024)
+
+namespace Unet
+{
+	namespace Trace
+	{
+		struct Event
+		{
+			// Must be a string literal (or otherwise outlive the trace)
+			const char* Name;
+
+			// Microseconds since the first traced zone
+			uint64_t Start;
+			uint64_t Duration;
+		};
+
+		class Zone
+		{
+		private:
+			const char* m_name;
+			uint64_t m_start;
+
+		public:
+			Zone(const char* name);
+			~Zone();
+		};
+
+		// Recording can be paused at runtime. It's enabled by default.
+		void SetEnabled(bool enabled);
+		bool IsEnabled();
+
+		// Drops all recorded zones.
+		void Clear();
+
+		// Writes all recorded zones to the given file as Chrome trace-event JSON. Returns the number of
+		// zones written, or -1 if the file couldn't be opened.
+		int Export(const char* filename);
+	}
+}
+
+#define UNET_TRACE_CONCAT_IMPL(a, b) a##b
+#define UNET_TRACE_CONCAT(a, b) UNET_TRACE_CONCAT_IMPL(a, b)
+#define UNET_TRACE_ZONE(name) ::Unet::Trace::Zone UNET_TRACE_CONCAT(_unetTraceZone, __LINE__)(name)
+
+#else
+
+#define UNET_TRACE_ZONE(name)
+
+#endif
@@ -26,6 +26,7 @@ namespace Unet
 	class ICallbacks;
 
 	class Lobby;
+	class LobbySnapshot;
 	class Service;
 
 	namespace Internal
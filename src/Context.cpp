@@ -1,6 +1,7 @@
 #include <Unet_common.h>
 #include <Unet/Context.h>
 #include <Unet/Service.h>
+#include <Unet/Trace.h>
 
 #if defined(UNET_MODULE_STEAM)
 #	include <Unet/Services/ServiceSteam.h>
@@ -14,12 +15,44 @@
 #	include <Unet/Services/ServiceEnet.h>
 #endif
 
+#include <Unet/Services/ServiceReplay.h>
+
 #include <Unet/LobbyPacket.h>
 
 #include <Unet/xxhash.h>
 
+// Service requests (creating, listing, joining and leaving lobbies) that take longer than this fail
+#define REQUEST_TIMEOUT_MS (15000)
+
+// How long a client waits for the lobby info after the services have joined the lobby
+#define JOIN_TIMEOUT_MS (10000)
+
+// How long kicked members get to leave on their own before the host disconnects them
+#define KICK_TIMEOUT_MS (5000)
+
+// Partially reassembled messages are dropped when the rest of their fragments take longer than this
+#define REASSEMBLY_TIMEOUT_MS (10000)
+#define REASSEMBLY_UNRELIABLE_TIMEOUT_MS (1000)
+#define EXPIRE_INTERVAL_MS (1000)
+
+// How often WaitForEvents wakes up while the send scheduler has queued traffic
+#define SEND_QUEUE_WAIT_MS (5)
+
+// How many new members the host admits per RunCallbacks by default
+#define JOIN_BUDGET_DEFAULT (8)
+
+// Free space in front of messages written with AcquireSendBuffer, so fragment markers, sequence numbers
+// and relay headers can be put in front of them without copying
+#define SEND_HEADROOM (16)
+
+// Leaves room for headers in a service's packet limit, where 0 means there's no limit
+static size_t ReservePacketLimit(size_t limit, size_t reserve)
+{
+	return (limit == 0) ? 0 : limit - reserve;
+}
+
 Unet::Internal::Context::Context(int numChannels)
-	: m_reassembly(this)
+	: m_reassembly(this), m_scheduler(numChannels), m_stats(numChannels + 2)
 {
 	m_numChannels = numChannels;
 	m_queuedMessages.assign(numChannels, std::queue<NetworkMessage*>());
@@ -31,6 +64,21 @@ Unet::Internal::Context::Context(int numChannels)
 
 	m_currentLobby = nullptr;
 	m_localPeer = -1;
+
+	m_joinTimer = 0;
+	m_joinBudget = JOIN_BUDGET_DEFAULT;
+	m_receiveMemberData = true;
+	m_messagesArrived = false;
+
+	m_shards = nullptr;
+	m_capture = nullptr;
+
+	m_reassembly.SetStats(&m_stats);
+	m_scheduler.SetStats(&m_stats);
+
+	m_timers.Schedule(std::chrono::milliseconds(EXPIRE_INTERVAL_MS), [this]() {
+		OnExpireTimer();
+	});
 }
 
 Unet::Internal::Context::~Context()
@@ -44,16 +92,19 @@ Unet::Internal::Context::~Context()
 		delete m_callbacks;
 	}
 
+	if (m_shards != nullptr) {
+		delete m_shards;
+	}
+
+	if (m_capture != nullptr) {
+		delete m_capture;
+	}
+
 	for (auto service : m_services) {
 		delete service;
 	}
 
-	for (auto &channel : m_queuedMessages) {
-		while (channel.size() > 0) {
-			delete channel.front();
-			channel.pop();
-		}
-	}
+	ClearQueuedMessages();
 }
 
 Unet::ContextStatus Unet::Internal::Context::GetStatus()
@@ -95,6 +146,7 @@ static void CheckCallback(Unet::Internal::Context* ctx, Unet::MultiCallback<TRes
 		ctx->GetCallbacks()->OnLogDebug(Unet::strPrintF("There were some errors in the multi-service callback: %d errors", numRequests - numOK));
 	}
 
+	UNET_TRACE_ZONE("Context::ResultCallback");
 	(ctx->*func)(result);
 
 	callback.Clear();
@@ -102,7 +154,13 @@ static void CheckCallback(Unet::Internal::Context* ctx, Unet::MultiCallback<TRes
 
 void Unet::Internal::Context::RunCallbacks()
 {
+	UNET_TRACE_ZONE("Context::RunCallbacks");
+
+	// Queued traffic goes out with the services' next update
+	m_scheduler.Flush();
+
 	for (auto service : m_services) {
+		UNET_TRACE_ZONE("Service::RunCallbacks");
 		service->RunCallbacks();
 	}
 
@@ -125,24 +183,22 @@ void Unet::Internal::Context::RunCallbacks()
 			result.Code = Result::OK;
 			result.Reason = LeaveReason::Disconnected;
 			OnLobbyLeft(result);
-
-		} else {
-			auto now = std::chrono::system_clock::now();
-			for (auto member : m_currentLobby->m_members) {
-				if (member->UnetPeer == m_localPeer) {
-					continue;
-				}
-
-				if (now < member->NextPingRequest) {
-					continue;
-				}
-
-				member->SendPing();
-			}
 		}
 	}
 
+	{
+		UNET_TRACE_ZONE("Context::RunTimers");
+		m_timers.Advance(std::chrono::steady_clock::now());
+	}
+
+	bool relayForwarded = false;
+
 	if (m_currentLobby != nullptr) {
+		UNET_TRACE_ZONE("Context::ReceivePackets");
+
+		// Relay and reassembly work can be handed off to the host shards
+		bool sharded = (m_shards != nullptr && m_currentLobby->m_info.IsHosting);
+
 		for (auto service : m_services) {
 			size_t packetSizeLimit = service->ReliablePacketLimit();
 
@@ -151,6 +207,11 @@ void Unet::Internal::Context::RunCallbacks()
 			if (packetSizeLimit > 0) {
 				// Re-assembly for internal lobby message channel
 				while (service->IsPacketAvailable(&packetSize, 0)) {
+					if (sharded) {
+						ReadShardPacket(service, packetSize, 0, -1);
+						continue;
+					}
+
 					PrepareReceiveBuffer(packetSize);
 
 					ServiceID peer;
@@ -163,6 +224,11 @@ void Unet::Internal::Context::RunCallbacks()
 				// Re-assembly for general purpose channels
 				for (int channel = 0; channel < m_numChannels; channel++) {
 					while (service->IsPacketAvailable(&packetSize, 2 + channel)) {
+						if (sharded) {
+							ReadShardPacket(service, packetSize, 2 + channel, channel);
+							continue;
+						}
+
 						PrepareReceiveBuffer(packetSize);
 
 						ServiceID peer;
@@ -176,80 +242,56 @@ void Unet::Internal::Context::RunCallbacks()
 
 			// Relay packet channel
 			while (service->IsPacketAvailable(&packetSize, 1)) {
-				PrepareReceiveBuffer(packetSize);
-
-				ServiceID peer;
-				service->ReadPacket(m_receiveBuffer.data(), packetSize, &peer, 1);
-				uint8_t* msgData = m_receiveBuffer.data();
-
-				auto peerMember = m_currentLobby->GetMember(peer);
+				if (sharded) {
+					ReadShardPacket(service, packetSize, 1, -2);
+					continue;
+				}
 
 				if (m_currentLobby->m_info.IsHosting) {
 					// We have to relay a packet to some client
-					uint8_t peerRecipient = *(msgData++);
-					uint8_t channel = *(msgData++);
-					PacketType type = (PacketType)*(msgData++);
-					packetSize -= 3;
-
-					auto recipientMember = m_currentLobby->GetMember((int)peerRecipient);
-					if (recipientMember == nullptr) {
-						if (m_callbacks != nullptr) {
-							m_callbacks->OnLogError(strPrintF("Tried relaying packet of %d bytes to unknown peer %d!", (int)packetSize, (int)peerRecipient));
-						}
-						continue;
-					}
-
-					PrepareSendBuffer(packetSize + 2);
-					uint8_t* relayMsg = m_sendBuffer.data();
-					relayMsg[0] = (uint8_t)peerMember->UnetPeer;
-					relayMsg[1] = channel;
-					memcpy(relayMsg + 2, msgData, packetSize);
-
-					auto id = recipientMember->GetDataServiceID();
-					assert(id.IsValid());
-					if (!id.IsValid()) {
-						continue;
-					}
-
-					auto recipientService = GetService(id.Service);
-					assert(recipientService != nullptr);
-					if (recipientService == nullptr) {
-						continue;
+					if (ForwardRelayPacket(service)) {
+						relayForwarded = true;
 					}
+					continue;
+				}
 
-					recipientService->SendPacket(id, relayMsg, packetSize + 2, type, 1);
+				// We received a relayed packet from some client
+				uint8_t* msgData;
+				ServiceID peer;
+				service->PeekPacket(&msgData, &packetSize, &peer, 1);
 
-				} else {
-					// We received a relayed packet from some client
-					uint8_t peerSender = *(msgData++);
-					uint8_t channel = *(msgData++);
-					packetSize -= 2;
+				size_t headerSize = m_currentLobby->GetRelayHeaderSize();
+				if (packetSize < headerSize) {
+					service->PopPacket(1);
+					continue;
+				}
 
-					if (channel >= (uint8_t)m_queuedMessages.size()) {
-						if (m_callbacks != nullptr) {
-							m_callbacks->OnLogError(strPrintF("Invalid channel index in relay packet: %d", (int)channel));
-						}
-						continue;
-					}
+				int peerSender = m_currentLobby->ReadRelayPeer(msgData);
+				msgData += headerSize - 2;
+				uint8_t channel = *(msgData++);
+				auto type = (PacketType)*(msgData++);
+				packetSize -= headerSize;
 
-					auto memberSender = m_currentLobby->GetMember(peerSender);
-					assert(memberSender != nullptr);
-					if (memberSender == nullptr) {
-						if (m_callbacks != nullptr) {
-							m_callbacks->OnLogError(strPrintF("Received a relay packet from unknown peer %d", (int)peerSender));
-						}
-						continue;
+				if (channel >= (uint8_t)m_queuedMessages.size()) {
+					if (m_callbacks != nullptr) {
+						m_callbacks->OnLogError(strPrintF("Invalid channel index in relay packet: %d", (int)channel));
 					}
+					service->PopPacket(1);
+					continue;
+				}
 
-					if (packetSizeLimit > 0) {
-						m_reassembly.HandleMessage(memberSender->GetPrimaryServiceID(), (int)channel, msgData, packetSize);
-					} else {
-						auto newMessage = new NetworkMessage(msgData, packetSize);
-						newMessage->m_channel = (int)channel;
-						newMessage->m_peer = memberSender->GetPrimaryServiceID();
-						m_queuedMessages[channel].push(newMessage);
+				auto memberSender = m_currentLobby->GetMember(peerSender);
+				assert(memberSender != nullptr);
+				if (memberSender == nullptr) {
+					if (m_callbacks != nullptr) {
+						m_callbacks->OnLogError(strPrintF("Received a relay packet from unknown peer %d", peerSender));
 					}
+					service->PopPacket(1);
+					continue;
 				}
+
+				HandleRelayedMessage(memberSender, channel, type, msgData, packetSize, packetSizeLimit);
+				service->PopPacket(1);
 			}
 
 			if (packetSizeLimit == 0) {
@@ -265,15 +307,108 @@ void Unet::Internal::Context::RunCallbacks()
 		}
 	}
 
+	if (m_shards != nullptr && m_shards->Process()) {
+		relayForwarded = true;
+	}
+
+	// Send out all relayed packets at once instead of waiting for the next service update
+	if (relayForwarded) {
+		for (auto service : m_services) {
+			service->FlushPackets();
+		}
+	}
+
 	// Pop any fragmented messages into the message queue
 	while (auto msg = m_reassembly.PopReady()) {
 		if (msg->m_channel == -1) {
 			m_currentLobby->HandleMessage(msg->m_peer, msg->m_data, msg->m_size);
 			delete msg;
 		} else {
-			m_queuedMessages[msg->m_channel].push(msg);
+			QueueMessage(msg);
+		}
+	}
+
+	// New members are only admitted after everyone else's traffic has been handled
+	if (m_currentLobby != nullptr && m_currentLobby->m_info.IsHosting) {
+		m_currentLobby->AdmitPendingJoins(m_joinBudget);
+	}
+}
+
+bool Unet::Internal::Context::WaitForEvents(int timeoutMs)
+{
+	UNET_TRACE_ZONE("Context::WaitForEvents");
+
+	m_waitSockets.clear();
+	int waitTime = GetWaitTime(m_waitSockets, timeoutMs);
+	return WaitForSockets(m_waiter, m_waitSockets, waitTime);
+}
+
+void Unet::Internal::Context::SetHostShards(int numShards)
+{
+	if (m_currentLobby != nullptr) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError("Host shards can't be changed while in a lobby!");
+		}
+		return;
+	}
+
+	if (m_shards != nullptr) {
+		delete m_shards;
+		m_shards = nullptr;
+	}
+
+	if (numShards > 0) {
+		m_shards = new HostShards(this, numShards);
+	}
+}
+
+int Unet::Internal::Context::GetHostShards()
+{
+	if (m_shards == nullptr) {
+		return 0;
+	}
+	return m_shards->NumShards();
+}
+
+void Unet::Internal::Context::SetSendRate(int bytesPerSecond)
+{
+	m_scheduler.SetRate(bytesPerSecond);
+}
+
+int Unet::Internal::Context::GetSendRate()
+{
+	return m_scheduler.GetRate();
+}
+
+void Unet::Internal::Context::SetChannelPriority(int channel, int priority, int weight)
+{
+	if (channel < 0 || channel >= m_numChannels) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Can't set priority of channel %d, there are only %d channels", channel, m_numChannels));
 		}
+		return;
 	}
+	m_scheduler.SetPriority(SendScheduler::ChannelClass(channel), priority, weight);
+}
+
+void Unet::Internal::Context::SetFileTransferPriority(int priority, int weight)
+{
+	m_scheduler.SetPriority(SendScheduler::FileClass, priority, weight);
+}
+
+void Unet::Internal::Context::SetJoinBudget(int joinsPerUpdate)
+{
+	m_joinBudget = std::max(0, joinsPerUpdate);
+}
+
+int Unet::Internal::Context::GetJoinBudget()
+{
+	return m_joinBudget;
+}
+
+const Unet::NetworkStats &Unet::Internal::Context::GetStats()
+{
+	return m_stats;
 }
 
 void Unet::Internal::Context::SetPrimaryService(ServiceType service)
@@ -350,21 +485,80 @@ void Unet::Internal::Context::SimulateServiceOutage(ServiceType type)
 	}
 }
 
+bool Unet::Internal::Context::StartCapture(const char* filename)
+{
+	StopCapture();
+
+	auto capture = new PacketCaptureWriter;
+	if (!capture->Open(filename)) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Couldn't open \"%s\" for packet capture!", filename));
+		}
+		delete capture;
+		return false;
+	}
+
+	// The primary service goes first, as that's the one that will be replayed
+	auto primaryService = GetService(m_primaryService);
+	if (primaryService != nullptr) {
+		capture->WriteService(primaryService->GetUserID(), primaryService->ReliablePacketLimit());
+	}
+	for (auto service : m_services) {
+		if (service != primaryService) {
+			capture->WriteService(service->GetUserID(), service->ReliablePacketLimit());
+		}
+	}
+
+	m_capture = capture;
+	return true;
+}
+
+void Unet::Internal::Context::StopCapture()
+{
+	if (m_capture != nullptr) {
+		delete m_capture;
+		m_capture = nullptr;
+	}
+}
+
+bool Unet::Internal::Context::EnableReplay(const char* filename, float speed)
+{
+	auto newService = new ServiceReplay(this, m_numChannels, speed);
+	if (!newService->Open(filename)) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Couldn't open packet capture \"%s\" for replay!", filename));
+		}
+		delete newService;
+		return false;
+	}
+
+	auto type = newService->GetType();
+	if (GetService(type) != nullptr) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Can't replay a capture of %s while that service is enabled!", GetServiceNameByType(type)));
+		}
+		delete newService;
+		return false;
+	}
+
+	m_services.emplace_back(newService);
+
+	if (m_primaryService == ServiceType::None) {
+		SetPrimaryService(type);
+	}
+	return true;
+}
+
 void Unet::Internal::Context::CreateLobby(LobbyPrivacy privacy, int maxPlayers, const char* name)
 {
 	m_status = ContextStatus::Connecting;
 
-	m_callbackCreateLobby.Begin();
+	BeginRequest(m_callbackCreateLobby);
 
 	m_localGuid = xg::newGuid();
 	m_localPeer = 0;
 
-	for (auto &channel : m_queuedMessages) {
-		while (channel.size() > 0) {
-			delete channel.front();
-			channel.pop();
-		}
-	}
+	ClearQueuedMessages();
 
 	auto &result = m_callbackCreateLobby.GetResult();
 	LobbyInfo newLobbyInfo;
@@ -385,7 +579,7 @@ void Unet::Internal::Context::CreateLobby(LobbyPrivacy privacy, int maxPlayers,
 
 void Unet::Internal::Context::GetLobbyList(const LobbyListFilter &filter)
 {
-	m_callbackLobbyList.Begin();
+	BeginRequest(m_callbackLobbyList);
 
 	auto &result = m_callbackLobbyList.GetResult();
 	result.Ctx = this;
@@ -420,17 +614,12 @@ void Unet::Internal::Context::JoinLobby(const LobbyInfo &lobbyInfo)
 
 	m_status = ContextStatus::Connecting;
 
-	m_callbackLobbyJoin.Begin();
+	BeginRequest(m_callbackLobbyJoin);
 
 	m_localGuid = xg::newGuid();
 	m_localPeer = -1;
 
-	for (auto &channel : m_queuedMessages) {
-		while (channel.size() > 0) {
-			delete channel.front();
-			channel.pop();
-		}
-	}
+	ClearQueuedMessages();
 
 	auto &result = m_callbackLobbyJoin.GetResult();
 	result.JoinGuid = m_localGuid;
@@ -463,7 +652,7 @@ void Unet::Internal::Context::JoinLobby(const ServiceID &id)
 
 	m_status = ContextStatus::Connecting;
 
-	m_callbackLobbyJoin.Begin();
+	BeginRequest(m_callbackLobbyJoin);
 
 	m_localGuid = xg::newGuid();
 	m_localPeer = -1;
@@ -480,8 +669,11 @@ void Unet::Internal::Context::JoinLobby(const ServiceID &id)
 
 void Unet::Internal::Context::LeaveLobby(LeaveReason reason)
 {
-	if (m_status == ContextStatus::Connected) {
-		m_callbackLobbyLeft.Begin();
+	// While waiting for the lobby info, the services have already joined the lobby
+	bool joined = (m_status == ContextStatus::Connecting && m_currentLobby != nullptr);
+
+	if (m_status == ContextStatus::Connected || joined) {
+		BeginRequest(m_callbackLobbyLeft);
 		m_callbackLobbyLeft.GetResult().Reason = reason;
 
 		for (auto service : m_services) {
@@ -513,6 +705,13 @@ void Unet::Internal::Context::KickMember(LobbyMember* member)
 	json js;
 	js["t"] = (uint8_t)LobbyPacketType::MemberKick;
 	InternalSendTo(member, js);
+
+	if (member->m_kickTimer == 0) {
+		member->m_kickTimer = m_timers.Schedule(std::chrono::milliseconds(KICK_TIMEOUT_MS), [this, member]() {
+			member->m_kickTimer = 0;
+			OnKickTimeout(member);
+		});
+	}
 }
 
 bool Unet::Internal::Context::IsHosting()
@@ -548,6 +747,7 @@ void Unet::Internal::Context::SetPersonaName(const char* str)
 		assert(localMember != nullptr);
 		if (localMember != nullptr) {
 			localMember->Name = str;
+			localMember->m_snapshotDirty = true;
 		}
 
 		if (m_currentLobby->m_info.IsHosting) {
@@ -644,6 +844,57 @@ void Unet::Internal::Context::RequestFile(LobbyMember* member, LobbyFile* file)
 	InternalSendTo(member, js);
 }
 
+void Unet::Internal::Context::JoinGroup(const char* group)
+{
+	if (m_currentLobby == nullptr) {
+		return;
+	}
+
+	auto localMember = m_currentLobby->GetMember(m_localPeer);
+	assert(localMember != nullptr);
+	if (localMember == nullptr) {
+		return;
+	}
+
+	localMember->JoinGroup(group);
+}
+
+void Unet::Internal::Context::LeaveGroup(const char* group)
+{
+	if (m_currentLobby == nullptr) {
+		return;
+	}
+
+	auto localMember = m_currentLobby->GetMember(m_localPeer);
+	assert(localMember != nullptr);
+	if (localMember == nullptr) {
+		return;
+	}
+
+	localMember->LeaveGroup(group);
+}
+
+void Unet::Internal::Context::SetReceiveMemberData(bool receive)
+{
+	if (m_receiveMemberData == receive) {
+		return;
+	}
+	m_receiveMemberData = receive;
+
+	// The host already knows everything, and clients that are still joining say this in their Hello
+	if (m_status == ContextStatus::Connected && m_currentLobby != nullptr && !m_currentLobby->m_info.IsHosting) {
+		json js;
+		js["t"] = (uint8_t)LobbyPacketType::MemberOptions;
+		js["memberdata"] = receive;
+		InternalSendToHost(js);
+	}
+}
+
+bool Unet::Internal::Context::GetReceiveMemberData()
+{
+	return m_receiveMemberData;
+}
+
 void Unet::Internal::Context::SendChat(const char* message)
 {
 	if (m_currentLobby == nullptr) {
@@ -701,6 +952,8 @@ bool Unet::Internal::Context::IsMessageAvailable(int channel)
 
 Unet::NetworkMessageRef Unet::Internal::Context::ReadMessage(int channel)
 {
+	UNET_TRACE_ZONE("Context::ReadMessage");
+
 	if (channel < 0) {
 		return nullptr;
 	}
@@ -710,6 +963,11 @@ Unet::NetworkMessageRef Unet::Internal::Context::ReadMessage(int channel)
 		if (queuedChannel.size() > 0) {
 			NetworkMessageRef ret(queuedChannel.front());
 			queuedChannel.pop();
+			if (ret->m_latestOnly) {
+				m_latestMessages.erase(ret->m_latestKey);
+			}
+			m_stats.GetChannel(2 + channel).MessagesQueued.Sub();
+			OnMessageRead(ret.get());
 			return ret;
 		}
 	}
@@ -730,6 +988,8 @@ Unet::NetworkMessageRef Unet::Internal::Context::ReadMessage(int channel)
 			NetworkMessageRef newMessage(new NetworkMessage(packetSize));
 			newMessage->m_channel = channel;
 			newMessage->m_size = service->ReadPacket(newMessage->m_data, packetSize, &newMessage->m_peer, 2 + channel);
+			m_stats.MessagesAllocated.Add();
+			OnMessageRead(newMessage.get());
 			return newMessage;
 		}
 	}
@@ -737,7 +997,7 @@ Unet::NetworkMessageRef Unet::Internal::Context::ReadMessage(int channel)
 	return nullptr;
 }
 
-void Unet::Internal::Context::SendTo_Impl(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel)
+void Unet::Internal::Context::SendTo_Impl(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel, size_t headroom)
 {
 	// Sending a message to yourself isn't very useful.
 	assert(member->UnetPeer != m_localPeer);
@@ -758,70 +1018,340 @@ void Unet::Internal::Context::SendTo_Impl(LobbyMember* member, uint8_t* data, si
 		auto serviceHost = GetService(idHost.Service);
 		assert(serviceHost != nullptr);
 
-		PrepareSendBuffer(size + 3);
+		size_t headerSize = m_currentLobby->GetRelayHeaderSize();
 
-		uint8_t* msg = m_sendBuffer.data();
-		msg[0] = (uint8_t)member->UnetPeer;
-		msg[1] = channel;
-		msg[2] = (uint8_t)type;
-		memcpy(msg + 3, data, size);
+		uint8_t* msg;
+		if (headroom >= headerSize) {
+			msg = data - headerSize;
+		} else {
+			PrepareSendBuffer(size + headerSize);
+			msg = m_sendBuffer.data();
+			memcpy(msg + headerSize, data, size);
+		}
 
-		serviceHost->SendPacket(idHost, msg, size + 3, type, 1);
+		m_currentLobby->WriteRelayPeer(msg, member->UnetPeer);
+		msg[headerSize - 2] = channel;
+		msg[headerSize - 1] = (uint8_t)type;
+
+		m_scheduler.Send(SendScheduler::ChannelClass(channel), serviceHost, idHost, msg, size + headerSize, type, 1);
 		return;
 	}
 
-	service->SendPacket(id, data, size, type, channel + 2);
+	m_scheduler.Send(SendScheduler::ChannelClass(channel), service, id, data, size, type, channel + 2);
 }
 
 void Unet::Internal::Context::SendTo(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel)
 {
-	auto id = member->GetDataServiceID();
+	if (!IsValidSendChannel(channel)) {
+		return;
+	}
 
-	auto service = GetService(id.Service);
-	if (service == nullptr) {
+	SendTo_Headroom(member, data, size, type, channel, 0);
+}
+
+void Unet::Internal::Context::SendTo(LobbyMember* member, const Slice* parts, int count, PacketType type, uint8_t channel)
+{
+	if (!IsValidSendChannel(channel)) {
 		return;
 	}
 
-	size_t sizeLimit = service->ReliablePacketLimit();
+	size_t size = 0;
+	for (int i = 0; i < count; i++) {
+		size += parts[i].Size;
+	}
 
-	if (type == PacketType::Reliable) {
-		if (sizeLimit == 0) {
-			SendTo_Impl(member, data, size, PacketType::Reliable, channel);
-			return;
-		}
+	// Not the buffer from AcquireSendBuffer, which may still hold a message that hasn't been committed to
+	// everyone yet
+	if (m_gatherBuffer.size() < SEND_HEADROOM + size) {
+		m_gatherBuffer.resize((size_t)((SEND_HEADROOM + size) * 1.5));
+	}
 
-		m_reassembly.SplitMessage(data, size, type, sizeLimit, [this, member, channel](uint8_t * data, size_t size) {
-			SendTo_Impl(member, data, size, PacketType::Reliable, channel);
-		});
+	uint8_t* data = m_gatherBuffer.data() + SEND_HEADROOM;
+	for (int i = 0; i < count; i++) {
+		memcpy(data, parts[i].Data, parts[i].Size);
+		data += parts[i].Size;
+	}
 
-	} else {
-		if (sizeLimit == 0) {
-			SendTo_Impl(member, data, size, type, channel);
-			return;
-		}
+	SendTo_Headroom(member, m_gatherBuffer.data() + SEND_HEADROOM, size, type, channel, SEND_HEADROOM);
+}
 
-		PrepareSendBuffer(size + 1);
-		m_sendBuffer[0] = 0;
-		memcpy(m_sendBuffer.data() + 1, data, size);
-		SendTo_Impl(member, m_sendBuffer.data(), size + 1, type, channel);
+uint8_t* Unet::Internal::Context::AcquireSendBuffer(size_t size)
+{
+	if (m_acquiredBuffer.size() < SEND_HEADROOM + size) {
+		m_acquiredBuffer.resize((size_t)((SEND_HEADROOM + size) * 1.5));
 	}
+	return m_acquiredBuffer.data() + SEND_HEADROOM;
 }
 
-void Unet::Internal::Context::SendToAll(uint8_t* data, size_t size, PacketType type, uint8_t channel)
+void Unet::Internal::Context::CommitSendBuffer(LobbyMember* member, size_t size, PacketType type, uint8_t channel)
 {
-	assert(m_currentLobby != nullptr);
-	if (m_currentLobby == nullptr) {
+	if (!IsValidSendChannel(channel)) {
 		return;
 	}
 
-	for (auto member : m_currentLobby->m_members) {
-		if (!member->Valid) {
-			continue;
-		}
+	assert(SEND_HEADROOM + size <= m_acquiredBuffer.size());
+	if (SEND_HEADROOM + size > m_acquiredBuffer.size()) {
+		return;
+	}
 
-		if (member->UnetPeer == m_localPeer) {
-			continue;
-		}
+	SendTo_Headroom(member, m_acquiredBuffer.data() + SEND_HEADROOM, size, type, channel, SEND_HEADROOM);
+}
+
+void Unet::Internal::Context::SendTo_Headroom(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel, size_t headroom)
+{
+	UNET_TRACE_ZONE("Context::SendTo");
+
+	auto id = member->GetDataServiceID();
+	bool relayed = (!id.IsValid() || GetService(id.Service) == nullptr);
+	if (relayed) {
+		// This will be relayed through the host
+		auto hostMember = m_currentLobby->GetHostMember();
+		if (hostMember != nullptr) {
+			id = hostMember->GetDataServiceID();
+		}
+	}
+
+	auto service = GetService(id.Service);
+	if (service == nullptr) {
+		return;
+	}
+
+	// Only relayed packets need room for the relay header
+	size_t relayHeaderSize = relayed ? m_currentLobby->GetRelayHeaderSize() : 0;
+
+	auto &memberStats = member->m_stats.GetChannel(2 + channel);
+	memberStats.PacketsSent.Add();
+	memberStats.BytesSent.Add((int64_t)size);
+
+	if (type == PacketType::UnreliableSequenced || type == PacketType::LatestOnly) {
+		SendSequenced(member, data, size, type, channel, headroom);
+		return;
+	}
+
+	size_t sizeLimit = service->ReliablePacketLimit();
+
+	if (type == PacketType::Reliable) {
+		if (sizeLimit == 0) {
+			SendTo_Impl(member, data, size, PacketType::Reliable, channel, headroom);
+			return;
+		}
+
+		m_reassembly.SplitMessage(data, size, type, ReservePacketLimit(sizeLimit, relayHeaderSize), !service->ReliablePacketsVerified(), m_currentLobby->SupportsFragmentStreams(), [this, member, channel](uint8_t * data, size_t size) {
+			SendTo_Impl(member, data, size, PacketType::Reliable, channel);
+		});
+
+	} else {
+		if (sizeLimit == 0) {
+			SendTo_Impl(member, data, size, type, channel, headroom);
+			return;
+		}
+
+		size_t unreliableLimit = ReservePacketLimit(service->UnreliablePacketLimit(), relayHeaderSize);
+		if (!Reassembly::FitsUnreliable(size, unreliableLimit) && UseFragmentStreams()) {
+			m_reassembly.SplitUnreliable(data, size, unreliableLimit, [this, member, type, channel](uint8_t* data, size_t size) {
+				SendTo_Impl(member, data, size, type, channel);
+			});
+			return;
+		}
+
+		// Unfragmented packets start with a 0 byte
+		if (headroom == 0) {
+			PrepareSendBuffer(SEND_HEADROOM + size);
+			memcpy(m_sendBuffer.data() + SEND_HEADROOM, data, size);
+			data = m_sendBuffer.data() + SEND_HEADROOM;
+			headroom = SEND_HEADROOM;
+		}
+
+		data[-1] = 0;
+		SendTo_Impl(member, data - 1, size + 1, type, channel, headroom - 1);
+	}
+}
+
+void Unet::Internal::Context::SendSequenced(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel, size_t headroom)
+{
+	if (member->UnetPeer == m_localPeer) {
+		return;
+	}
+
+	if (member->m_sendSequence.size() <= channel) {
+		member->m_sendSequence.resize(channel + 1, 0);
+	}
+	uint32_t sequence = member->m_sendSequence[channel]++;
+
+	auto id = member->GetDataServiceID();
+	auto service = GetService(id.Service);
+
+	if (!id.IsValid() || service == nullptr) {
+		// Relayed through the host, which keeps the packet type in the relay header, so we only add the sequence
+		auto hostMember = m_currentLobby->GetHostMember();
+		assert(hostMember != nullptr);
+
+		auto idHost = hostMember->GetDataServiceID();
+		auto serviceHost = GetService(idHost.Service);
+		if (!idHost.IsValid() || serviceHost == nullptr) {
+			return;
+		}
+
+		size_t headerSize = m_currentLobby->GetRelayHeaderSize();
+
+		uint8_t* msg;
+		if (headroom >= headerSize + 4) {
+			msg = data - headerSize - 4;
+		} else {
+			PrepareSendBuffer(size + headerSize + 4);
+			msg = m_sendBuffer.data();
+			memcpy(msg + headerSize + 4, data, size);
+		}
+
+		m_currentLobby->WriteRelayPeer(msg, member->UnetPeer);
+		msg[headerSize - 2] = channel;
+		msg[headerSize - 1] = (uint8_t)type;
+		memcpy(msg + headerSize, &sequence, 4);
+
+		m_scheduler.Send(SendScheduler::ChannelClass(channel), serviceHost, idHost, msg, size + headerSize + 4, type, 1);
+		return;
+	}
+
+	// Sent directly as a binary-only internal message (see InternalSendBinaryTo), so the sequencing is the
+	// same on all services. Services with a packet limit get the unsequenced fragment marker first.
+	size_t offset = (service->ReliablePacketLimit() > 0) ? 1 : 0;
+	size_t headerSize = offset + 4 + 7;
+
+	uint8_t* msg;
+	if (headroom >= headerSize) {
+		msg = data - headerSize;
+	} else {
+		PrepareSendBuffer(headerSize + size);
+		msg = m_sendBuffer.data();
+		memcpy(msg + headerSize, data, size);
+	}
+
+	memset(msg, 0, offset + 4);
+	msg[offset + 4] = (uint8_t)LobbyPacketType::SequencedMessage;
+	msg[offset + 5] = channel;
+	msg[offset + 6] = (uint8_t)type;
+	memcpy(msg + offset + 7, &sequence, 4);
+
+	m_scheduler.Send(SendScheduler::ChannelClass(channel), service, id, msg, headerSize + size, type, 0);
+}
+
+bool Unet::Internal::Context::TrySendRelayBroadcast(LobbyMember* exceptMember, uint8_t* data, size_t size, PacketType type, uint8_t channel)
+{
+	if (m_currentLobby->m_info.IsHosting || !m_currentLobby->SupportsRelayBroadcast()) {
+		return false;
+	}
+
+	// Sequence numbers are kept per recipient, so these can't be shared
+	if (type == PacketType::UnreliableSequenced || type == PacketType::LatestOnly) {
+		return false;
+	}
+
+	auto isRecipient = [this, exceptMember](LobbyMember* member) {
+		return member->Valid && member->UnetPeer != m_localPeer && member != exceptMember;
+	};
+
+	// Only worth it when we'd otherwise send more than one copy through the host
+	int numRelayed = 0;
+	for (auto member : m_currentLobby->m_members) {
+		if (!isRecipient(member)) {
+			continue;
+		}
+
+		auto id = member->GetDataServiceID();
+		if (!id.IsValid() || GetService(id.Service) == nullptr) {
+			numRelayed++;
+		}
+	}
+
+	if (numRelayed < 2) {
+		return false;
+	}
+
+	auto hostMember = m_currentLobby->GetHostMember();
+	if (hostMember == nullptr) {
+		return false;
+	}
+
+	auto idHost = hostMember->GetDataServiceID();
+	auto serviceHost = GetService(idHost.Service);
+	if (!idHost.IsValid() || serviceHost == nullptr) {
+		return false;
+	}
+
+	for (auto member : m_currentLobby->m_members) {
+		if (isRecipient(member)) {
+			auto &memberStats = member->m_stats.GetChannel(2 + channel);
+			memberStats.PacketsSent.Add();
+			memberStats.BytesSent.Add((int64_t)size);
+		}
+	}
+
+	int exceptPeer = (exceptMember != nullptr ? exceptMember->UnetPeer : UNET_RELAY_BROADCAST);
+
+	// Relay broadcasts have the skipped peer after the relay header
+	size_t relayHeaderSize = m_currentLobby->GetRelayBroadcastHeaderSize();
+	size_t sizeLimit = ReservePacketLimit(serviceHost->ReliablePacketLimit(), relayHeaderSize);
+	size_t unreliableLimit = ReservePacketLimit(serviceHost->UnreliablePacketLimit(), relayHeaderSize);
+
+	if (type == PacketType::Unreliable && sizeLimit > 0 && !Reassembly::FitsUnreliable(size, unreliableLimit) && m_currentLobby->SupportsFragmentStreams()) {
+		m_reassembly.SplitUnreliable(data, size, unreliableLimit, [this, serviceHost, &idHost, exceptPeer, type, channel](uint8_t* data, size_t size) {
+			SendRelayBroadcast_Impl(serviceHost, idHost, exceptPeer, data, size, false, type, channel);
+		});
+	} else if (type == PacketType::Reliable && sizeLimit > 0) {
+		m_reassembly.SplitMessage(data, size, type, sizeLimit, !serviceHost->ReliablePacketsVerified(), m_currentLobby->SupportsFragmentStreams(), [this, serviceHost, &idHost, exceptPeer, type, channel](uint8_t* data, size_t size) {
+			SendRelayBroadcast_Impl(serviceHost, idHost, exceptPeer, data, size, false, type, channel);
+		});
+	} else {
+		SendRelayBroadcast_Impl(serviceHost, idHost, exceptPeer, data, size, (type != PacketType::Reliable && sizeLimit > 0), type, channel);
+	}
+	return true;
+}
+
+void Unet::Internal::Context::SendRelayBroadcast_Impl(Service* serviceHost, const ServiceID &idHost, int exceptPeer, const uint8_t* data, size_t size, bool unsequencedMarker, PacketType type, uint8_t channel)
+{
+	size_t headerSize = m_currentLobby->GetRelayHeaderSize();
+	size_t offset = m_currentLobby->GetRelayBroadcastHeaderSize() + (unsequencedMarker ? 1 : 0);
+	PrepareSendBuffer(offset + size);
+
+	uint8_t* msg = m_sendBuffer.data();
+	m_currentLobby->WriteRelayPeer(msg, UNET_RELAY_BROADCAST);
+	msg[headerSize - 2] = channel;
+	msg[headerSize - 1] = (uint8_t)type;
+
+	uint16_t except16 = (uint16_t)exceptPeer;
+	memcpy(msg + headerSize, &except16, 2);
+
+	if (unsequencedMarker) {
+		msg[headerSize + 2] = 0;
+	}
+	memcpy(msg + offset, data, size);
+
+	m_scheduler.Send(SendScheduler::ChannelClass(channel), serviceHost, idHost, msg, offset + size, type, 1);
+}
+
+void Unet::Internal::Context::SendToAll(uint8_t* data, size_t size, PacketType type, uint8_t channel)
+{
+	assert(m_currentLobby != nullptr);
+	if (m_currentLobby == nullptr) {
+		return;
+	}
+
+	if (!IsValidSendChannel(channel)) {
+		return;
+	}
+
+	if (TrySendRelayBroadcast(nullptr, data, size, type, channel)) {
+		return;
+	}
+
+	for (auto member : m_currentLobby->m_members) {
+		if (!member->Valid) {
+			continue;
+		}
+
+		if (member->UnetPeer == m_localPeer) {
+			continue;
+		}
 
 		SendTo(member, data, size, type, channel);
 	}
@@ -834,6 +1364,14 @@ void Unet::Internal::Context::SendToAllExcept(LobbyMember* exceptMember, uint8_t
 		return;
 	}
 
+	if (!IsValidSendChannel(channel)) {
+		return;
+	}
+
+	if (TrySendRelayBroadcast(exceptMember, data, size, type, channel)) {
+		return;
+	}
+
 	for (auto member : m_currentLobby->m_members) {
 		if (!member->Valid) {
 			continue;
@@ -851,6 +1389,30 @@ void Unet::Internal::Context::SendToAllExcept(LobbyMember* exceptMember, uint8_t
 	}
 }
 
+void Unet::Internal::Context::SendToGroup(const char* group, uint8_t* data, size_t size, PacketType type, uint8_t channel)
+{
+	assert(m_currentLobby != nullptr);
+	if (m_currentLobby == nullptr) {
+		return;
+	}
+
+	if (!IsValidSendChannel(channel)) {
+		return;
+	}
+
+	for (auto member : m_currentLobby->GetGroupMembers(group)) {
+		if (!member->Valid) {
+			continue;
+		}
+
+		if (member->UnetPeer == m_localPeer) {
+			continue;
+		}
+
+		SendTo(member, data, size, type, channel);
+	}
+}
+
 void Unet::Internal::Context::SendToHost(uint8_t* data, size_t size, PacketType type, uint8_t channel)
 {
 	assert(m_currentLobby != nullptr);
@@ -858,6 +1420,10 @@ void Unet::Internal::Context::SendToHost(uint8_t* data, size_t size, PacketType
 		return;
 	}
 
+	if (!IsValidSendChannel(channel)) {
+		return;
+	}
+
 	auto hostMember = m_currentLobby->GetHostMember();
 	assert(hostMember != nullptr);
 	if (hostMember == nullptr) {
@@ -885,21 +1451,35 @@ Unet::Service* Unet::Internal::Context::GetService(ServiceType type)
 }
 
 void Unet::Internal::Context::InternalSendTo(LobbyMember* member, const json &js, uint8_t* binaryData, size_t binarySize)
+{
+	InternalSendPackedTo(member, JsonPack(js), binaryData, binarySize);
+}
+
+void Unet::Internal::Context::InternalSendPackedTo(LobbyMember* member, const std::vector<uint8_t> &msg, uint8_t* binaryData, size_t binarySize)
 {
 	// Sending a message to yourself isn't very useful.
 	assert(member->UnetPeer != m_localPeer);
 
 	auto id = member->GetDataServiceID();
-	assert(id.IsValid());
 	if (!id.IsValid()) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogWarn(strPrintF("Can't send internal message to peer %d without a direct connection", member->UnetPeer));
+		}
 		return;
 	}
 
-	InternalSendTo(id, js, binaryData, binarySize);
+	InternalSendTo_Impl(id, msg, binaryData, binarySize, -1);
 }
 
 void Unet::Internal::Context::InternalSendTo(const ServiceID &id, const json &js, uint8_t* binaryData, size_t binarySize)
 {
+	InternalSendTo_Impl(id, JsonPack(js), binaryData, binarySize, -1);
+}
+
+void Unet::Internal::Context::InternalSendTo_Impl(const ServiceID &id, const std::vector<uint8_t> &msg, uint8_t* binaryData, size_t binarySize, int sendClass)
+{
+	UNET_TRACE_ZONE("Context::InternalSendTo");
+
 	//TODO: Implement relaying through host if this is a client-to-client message where there's no compatible connection (eg. Steam to Galaxy communication)
 	//NOTE: The above is not important yet for internal messages, as all internal messages are sent between client & server, not client & client
 
@@ -909,8 +1489,6 @@ void Unet::Internal::Context::InternalSendTo(const ServiceID &id, const json &js
 		return;
 	}
 
-	auto msg = JsonPack(js);
-
 	size_t finalMsgSize = msg.size() + binarySize + 4;
 	PrepareSendBuffer(finalMsgSize);
 
@@ -921,15 +1499,31 @@ void Unet::Internal::Context::InternalSendTo(const ServiceID &id, const json &js
 		memcpy(m_sendBuffer.data() + 4 + msg.size(), binaryData, binarySize);
 	}
 
+	if (m_currentLobby != nullptr) {
+		auto member = m_currentLobby->GetMember(id);
+		if (member != nullptr) {
+			auto &memberStats = member->m_stats.GetChannel(0);
+			memberStats.PacketsSent.Add();
+			memberStats.BytesSent.Add((int64_t)finalMsgSize);
+		}
+	}
+
+	// Other internal messages are small and keep the lobby going, so only file data waits in the scheduler
+	auto send = [this, service, id, sendClass](uint8_t* data, size_t size) {
+		if (sendClass == -1) {
+			service->SendPacket(id, data, size, PacketType::Reliable, 0);
+		} else {
+			m_scheduler.Send(sendClass, service, id, data, size, PacketType::Reliable, 0);
+		}
+	};
+
 	size_t sizeLimit = service->ReliablePacketLimit();
 	if (sizeLimit == 0) {
-		service->SendPacket(id, m_sendBuffer.data(), finalMsgSize, PacketType::Reliable, 0);
+		send(m_sendBuffer.data(), finalMsgSize);
 		return;
 	}
 
-	m_reassembly.SplitMessage(m_sendBuffer.data(), finalMsgSize, PacketType::Reliable, sizeLimit, [service, id](uint8_t* data, size_t size) {
-		service->SendPacket(id, data, size, PacketType::Reliable, 0);
-	});
+	m_reassembly.SplitMessage(m_sendBuffer.data(), finalMsgSize, PacketType::Reliable, sizeLimit, !service->ReliablePacketsVerified(), UseFragmentStreams(), send);
 }
 
 void Unet::Internal::Context::InternalSendToAll(const json &js, uint8_t* binaryData, size_t binarySize)
@@ -939,9 +1533,12 @@ void Unet::Internal::Context::InternalSendToAll(const json &js, uint8_t* binaryD
 		return;
 	}
 
+	// Packed only once for all members
+	auto msg = JsonPack(js);
+
 	for (auto member : m_currentLobby->m_members) {
 		if (member->UnetPeer != m_localPeer) {
-			InternalSendTo(member, js, binaryData, binarySize);
+			InternalSendPackedTo(member, msg, binaryData, binarySize);
 		}
 	}
 }
@@ -953,10 +1550,35 @@ void Unet::Internal::Context::InternalSendToAllExcept(LobbyMember* exceptMember,
 		return;
 	}
 
+	auto msg = JsonPack(js);
+
 	for (auto member : m_currentLobby->m_members) {
 		if (member->UnetPeer != m_localPeer && member->UnetPeer != exceptMember->UnetPeer) {
-			InternalSendTo(member, js, binaryData, binarySize);
+			InternalSendPackedTo(member, msg, binaryData, binarySize);
+		}
+	}
+}
+
+void Unet::Internal::Context::InternalSendMemberUpdate(LobbyMember* member, const json &js, LobbyMember* exceptMember)
+{
+	assert(m_currentLobby != nullptr);
+	if (m_currentLobby == nullptr) {
+		return;
+	}
+
+	auto msg = JsonPack(js);
+
+	for (auto other : m_currentLobby->m_members) {
+		if (other->UnetPeer == m_localPeer || other == exceptMember) {
+			continue;
 		}
+
+		// Members always hear about themselves
+		if (!other->m_receivesMemberData && other != member) {
+			continue;
+		}
+
+		InternalSendPackedTo(other, msg);
 	}
 }
 
@@ -983,6 +1605,145 @@ void Unet::Internal::Context::InternalSendToHost(const json &js, uint8_t* binary
 	}
 }
 
+void Unet::Internal::Context::InternalSendFileData(LobbyMember* member, const json &js, uint8_t* binaryData, size_t binarySize)
+{
+	auto id = member->GetDataServiceID();
+	if (!id.IsValid()) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogWarn(strPrintF("Can't send file data to peer %d without a direct connection", member->UnetPeer));
+		}
+		return;
+	}
+
+	InternalSendTo_Impl(id, JsonPack(js), binaryData, binarySize, SendScheduler::FileClass);
+}
+
+void Unet::Internal::Context::InternalSendBinaryTo(LobbyMember* member, const uint8_t* data, size_t size, PacketType type)
+{
+	assert(member->UnetPeer != m_localPeer);
+
+	auto id = member->GetDataServiceID();
+	if (!id.IsValid()) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogWarn(strPrintF("Can't send internal message to peer %d without a direct connection", member->UnetPeer));
+		}
+		return;
+	}
+
+	InternalSendBinaryTo(id, data, size, type);
+}
+
+void Unet::Internal::Context::InternalSendBinaryTo(const ServiceID &id, const uint8_t* data, size_t size, PacketType type)
+{
+	UNET_TRACE_ZONE("Context::InternalSendBinaryTo");
+
+	auto service = GetService(id.Service);
+	assert(service != nullptr);
+	if (service == nullptr) {
+		return;
+	}
+
+	size_t sizeLimit = service->ReliablePacketLimit();
+
+	// Unreliable packets still go through reassembly on services with a packet limit, as a single unsequenced fragment
+	size_t offset = (sizeLimit > 0 && type == PacketType::Unreliable) ? 1 : 0;
+
+	size_t msgSize = size + 4;
+	PrepareSendBuffer(offset + msgSize);
+
+	// A json size of 0 marks the message as binary-only
+	uint8_t* msg = m_sendBuffer.data() + offset;
+	memset(msg, 0, 4);
+	memcpy(msg + 4, data, size);
+
+	if (m_currentLobby != nullptr) {
+		auto member = m_currentLobby->GetMember(id);
+		if (member != nullptr) {
+			auto &memberStats = member->m_stats.GetChannel(0);
+			memberStats.PacketsSent.Add();
+			memberStats.BytesSent.Add((int64_t)msgSize);
+		}
+	}
+
+	if (sizeLimit == 0 || type == PacketType::Unreliable) {
+		if (offset > 0) {
+			m_sendBuffer[0] = 0;
+		}
+		service->SendPacket(id, m_sendBuffer.data(), offset + msgSize, type, 0);
+		return;
+	}
+
+	m_reassembly.SplitMessage(msg, msgSize, PacketType::Reliable, sizeLimit, !service->ReliablePacketsVerified(), UseFragmentStreams(), [service, id](uint8_t* data, size_t size) {
+		service->SendPacket(id, data, size, PacketType::Reliable, 0);
+	});
+}
+
+void Unet::Internal::Context::HandleSequencedMessage(LobbyMember* sender, int channel, PacketType type, uint32_t sequence, uint8_t* data, size_t size)
+{
+	if (channel < 0 || channel >= m_numChannels || (type != PacketType::UnreliableSequenced && type != PacketType::LatestOnly)) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Invalid sequenced message from peer %d on channel %d", sender->UnetPeer, channel));
+		}
+		return;
+	}
+
+	// LatestOnly messages are keyed by their first 4 bytes
+	uint32_t key = 0;
+	if (type == PacketType::LatestOnly) {
+		memcpy(&key, data, std::min(size, (size_t)4));
+	}
+
+	uint64_t stateKey = (uint64_t)channel;
+	if (type == PacketType::LatestOnly) {
+		stateKey |= (1ULL << 40) | ((uint64_t)key << 8);
+	}
+
+	// Sequence numbers wrap around, so anything up to half the range ahead counts as newer
+	auto it = sender->m_receiveSequence.find(stateKey);
+	if (it != sender->m_receiveSequence.end() && (int32_t)(sequence - it->second) <= 0) {
+		m_stats.StaleMessagesDropped.Add();
+		return;
+	}
+	sender->m_receiveSequence[stateKey] = sequence;
+
+	if (type == PacketType::LatestOnly) {
+		uint64_t queueKey = ((uint64_t)(uint16_t)sender->UnetPeer << 48) | ((uint64_t)(uint8_t)channel << 32) | key;
+
+		auto queued = m_latestMessages.find(queueKey);
+		if (queued != m_latestMessages.end()) {
+			// The older message hasn't been read yet, so it takes the new data and keeps its place in the queue
+			auto msg = queued->second;
+			bool reserved = msg->Reserve(size);
+			assert(reserved);
+			if (!reserved) {
+				return;
+			}
+			memcpy(msg->m_data, data, size);
+			msg->m_size = size;
+
+			m_stats.StaleMessagesDropped.Add();
+			return;
+		}
+
+		auto newMessage = new NetworkMessage(data, size);
+		newMessage->m_channel = channel;
+		newMessage->m_peer = sender->GetPrimaryServiceID();
+		newMessage->m_latestOnly = true;
+		newMessage->m_latestKey = queueKey;
+		m_stats.MessagesAllocated.Add();
+
+		m_latestMessages.emplace(queueKey, newMessage);
+		QueueMessage(newMessage);
+		return;
+	}
+
+	auto newMessage = new NetworkMessage(data, size);
+	newMessage->m_channel = channel;
+	newMessage->m_peer = sender->GetPrimaryServiceID();
+	m_stats.MessagesAllocated.Add();
+	QueueMessage(newMessage);
+}
+
 void Unet::Internal::Context::OnLobbyCreated(const CreateLobbyResult &result)
 {
 	if (result.Code != Result::OK) {
@@ -999,17 +1760,18 @@ void Unet::Internal::Context::OnLobbyCreated(const CreateLobbyResult &result)
 		m_currentLobby->SetData("unet-guid", unetGuid.c_str());
 		m_currentLobby->SetData("unet-name", lobbyInfo.Name.c_str());
 		m_currentLobby->SetData("unet-privacy", strPrintF("%d", (int)lobbyInfo.Privacy));
+		m_currentLobby->SetData("unet-peer-bytes", strPrintF("%d", m_currentLobby->m_peerBytes));
+		m_currentLobby->SetData("unet-fragment-streams", m_currentLobby->m_fragmentStreams ? "1" : "0");
 
 		auto newMember = new LobbyMember(this);
 		newMember->UnetGuid = m_localGuid;
-		newMember->UnetPeer = 0;
+		newMember->UnetPeer = m_currentLobby->AllocatePeer();
 		newMember->UnetPrimaryService = m_primaryService;
 		newMember->Name = m_personaName;
 		for (auto service : m_services) {
 			newMember->IDs.emplace_back(service->GetUserID());
 		}
-		m_currentLobby->m_members.emplace_back(newMember);
-		m_currentLobby->m_info.NumPlayers++;
+		m_currentLobby->AddMember(newMember);
 
 		m_currentLobby->SetRichPresence();
 	}
@@ -1074,9 +1836,28 @@ void Unet::Internal::Context::OnLobbyJoined(const LobbyJoinResult &result)
 		m_currentLobby->SetRichPresence();
 	}
 
+	m_timers.Cancel(m_joinTimer);
+	m_joinTimer = m_timers.Schedule(std::chrono::milliseconds(JOIN_TIMEOUT_MS), [this]() {
+		m_joinTimer = 0;
+		OnJoinTimeout();
+	});
+
+	SendHello();
+	m_helloTime = std::chrono::steady_clock::now();
+}
+
+void Unet::Internal::Context::SendHello()
+{
 	json js;
 	js["t"] = (uint8_t)LobbyPacketType::Hello;
 	js["name"] = m_personaName;
+	if (!m_receiveMemberData) {
+		js["memberdata"] = false;
+	}
+	if (m_lobbyCache.Version > 0) {
+		js["lobby"] = m_lobbyCache.LobbyGuid.str();
+		js["version"] = m_lobbyCache.Version;
+	}
 	InternalSendToHost(js);
 
 	if (m_callbacks != nullptr) {
@@ -1089,17 +1870,20 @@ void Unet::Internal::Context::OnLobbyLeft(const LobbyLeftResult &result)
 	m_status = ContextStatus::Idle;
 	m_localPeer = -1;
 
-	for (auto &channel : m_queuedMessages) {
-		while (channel.size() > 0) {
-			delete channel.front();
-			channel.pop();
-		}
-	}
+	m_timers.Cancel(m_joinTimer);
+	m_joinTimer = 0;
+
+	ClearQueuedMessages();
+	m_scheduler.Clear();
 
 	if (m_callbacks != nullptr) {
 		m_callbacks->OnLobbyLeft(result);
 	}
 
+	if (m_shards != nullptr) {
+		m_shards->Clear();
+	}
+
 	if (m_currentLobby != nullptr) {
 		delete m_currentLobby;
 		m_currentLobby = nullptr;
@@ -1119,11 +1903,327 @@ void Unet::Internal::Context::OnLobbyPlayerLeft(LobbyMember* member)
 		InternalSendToAll(js);
 	}
 
+	for (auto &id : member->IDs) {
+		m_scheduler.RemovePeer(id);
+	}
+
 	if (m_callbacks != nullptr) {
 		m_callbacks->OnLobbyPlayerLeft(member);
 	}
 }
 
+template<typename TResult>
+void Unet::Internal::Context::BeginRequest(MultiCallback<TResult> &callback)
+{
+	callback.Begin();
+
+	uint64_t round = callback.GetRound();
+	m_timers.Schedule(std::chrono::milliseconds(REQUEST_TIMEOUT_MS), [this, &callback, round]() {
+		int numTimedOut = callback.TimeOut(round);
+		if (numTimedOut > 0 && m_callbacks != nullptr) {
+			m_callbacks->OnLogWarn(strPrintF("%d service request(s) timed out", numTimedOut));
+		}
+	});
+}
+
+void Unet::Internal::Context::OnJoinTimeout()
+{
+	if (m_status != ContextStatus::Connecting || m_currentLobby == nullptr) {
+		return;
+	}
+
+	if (m_callbacks != nullptr) {
+		m_callbacks->OnLogError("Timed out waiting for lobby info from the host");
+
+		LobbyJoinResult result;
+		result.Code = Result::Error;
+		result.JoinGuid = m_localGuid;
+		result.JoinedLobby = nullptr;
+		m_callbacks->OnLobbyJoined(result);
+	}
+
+	LeaveLobby(LeaveReason::Disconnected);
+}
+
+void Unet::Internal::Context::OnKickTimeout(LobbyMember* member)
+{
+	if (m_currentLobby == nullptr) {
+		return;
+	}
+
+	if (m_callbacks != nullptr) {
+		m_callbacks->OnLogWarn(strPrintF("Peer %d did not leave after being kicked, disconnecting them", member->UnetPeer));
+	}
+
+	for (auto &id : member->IDs) {
+		auto service = GetService(id.Service);
+		if (service != nullptr) {
+			service->DisconnectPeer(id);
+		}
+	}
+
+	m_currentLobby->RemoveMember(member);
+}
+
+void Unet::Internal::Context::OnExpireTimer()
+{
+	auto now = std::chrono::steady_clock::now();
+	auto before = now - std::chrono::milliseconds(REASSEMBLY_TIMEOUT_MS);
+	auto unreliableBefore = now - std::chrono::milliseconds(REASSEMBLY_UNRELIABLE_TIMEOUT_MS);
+
+	m_reassembly.Expire(before, unreliableBefore);
+	if (m_shards != nullptr) {
+		m_shards->Expire(before, unreliableBefore);
+	}
+
+	m_timers.Schedule(std::chrono::milliseconds(EXPIRE_INTERVAL_MS), [this]() {
+		OnExpireTimer();
+	});
+}
+
+bool Unet::Internal::Context::ForwardRelayPacket(Service* service)
+{
+	UNET_TRACE_ZONE("Context::ForwardRelayPacket");
+
+	uint8_t* msgData;
+	size_t packetSize;
+	ServiceID peer;
+	if (!service->PeekPacket(&msgData, &packetSize, &peer, 1)) {
+		return false;
+	}
+
+	size_t headerSize = m_currentLobby->GetRelayHeaderSize();
+	if (packetSize < headerSize) {
+		service->PopPacket(1);
+		return false;
+	}
+
+	int peerRecipient = m_currentLobby->ReadRelayPeer(msgData);
+	PacketType type = (PacketType)msgData[headerSize - 1];
+
+	if (peerRecipient == UNET_RELAY_BROADCAST && m_currentLobby->SupportsRelayBroadcast()) {
+		BroadcastRelayPacket(peer, msgData, packetSize);
+		service->PopPacket(1);
+		return true;
+	}
+
+	auto peerMember = m_currentLobby->GetMember(peer);
+	auto recipientMember = m_currentLobby->GetMember(peerRecipient);
+	if (peerMember == nullptr || recipientMember == nullptr) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Tried relaying packet of %d bytes to unknown peer %d!", (int)(packetSize - headerSize), peerRecipient));
+		}
+		service->PopPacket(1);
+		return false;
+	}
+
+	auto id = recipientMember->GetDataServiceID();
+	assert(id.IsValid());
+
+	auto recipientService = GetService(id.Service);
+	assert(recipientService != nullptr);
+	if (!id.IsValid() || recipientService == nullptr) {
+		service->PopPacket(1);
+		return false;
+	}
+
+	// The relayed packet has the same layout as the relay request, only the recipient is replaced by
+	// the sender, so it can be forwarded as-is
+	m_currentLobby->WriteRelayPeer(msgData, peerMember->UnetPeer);
+
+	m_stats.RelayedPackets.Add();
+	m_stats.RelayedBytes.Add((int64_t)packetSize);
+
+	if (recipientService == service) {
+		service->ForwardPacket(id, type, 1);
+	} else {
+		recipientService->SendPacket(id, msgData, packetSize, type, 1);
+		service->PopPacket(1);
+	}
+	return true;
+}
+
+void Unet::Internal::Context::BroadcastRelayPacket(const ServiceID &peer, uint8_t* data, size_t size)
+{
+	UNET_TRACE_ZONE("Context::BroadcastRelayPacket");
+
+	size_t headerSize = m_currentLobby->GetRelayHeaderSize();
+	if (size < m_currentLobby->GetRelayBroadcastHeaderSize()) {
+		return;
+	}
+
+	auto sender = m_currentLobby->GetMember(peer);
+	if (sender == nullptr) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Tried broadcasting relay packet of %d bytes from unknown %s ID 0x%016llX!", (int)size, GetServiceNameByType(peer.Service), peer.ID));
+		}
+		return;
+	}
+
+	uint8_t channel = data[headerSize - 2];
+	auto type = (PacketType)data[headerSize - 1];
+
+	uint16_t exceptPeer;
+	memcpy(&exceptPeer, data + headerSize, 2);
+
+	// Turn the broadcast header into a normal relay header from the sender, right in front of the payload,
+	// so the same buffer goes out to every recipient
+	uint8_t* out = data + 2;
+	size_t outSize = size - 2;
+	m_currentLobby->WriteRelayPeer(out, sender->UnetPeer);
+	out[headerSize - 2] = channel;
+	out[headerSize - 1] = (uint8_t)type;
+
+	for (auto member : m_currentLobby->m_members) {
+		if (!member->Valid || member == sender || member->UnetPeer == (int)exceptPeer) {
+			continue;
+		}
+
+		if (member->UnetPeer == m_localPeer) {
+			auto service = GetService(peer.Service);
+			if (service != nullptr && channel < (uint8_t)m_queuedMessages.size()) {
+				HandleRelayedMessage(sender, channel, type, out + headerSize, outSize - headerSize, service->ReliablePacketLimit());
+			}
+			continue;
+		}
+
+		auto id = member->GetDataServiceID();
+		auto service = GetService(id.Service);
+		if (!id.IsValid() || service == nullptr) {
+			continue;
+		}
+
+		service->SendPacket(id, out, outSize, type, 1);
+
+		m_stats.RelayedPackets.Add();
+		m_stats.RelayedBytes.Add((int64_t)outSize);
+	}
+}
+
+void Unet::Internal::Context::HandleRelayedMessage(LobbyMember* sender, uint8_t channel, PacketType type, uint8_t* data, size_t size, size_t packetSizeLimit)
+{
+	if (type == PacketType::UnreliableSequenced || type == PacketType::LatestOnly) {
+		// Sequenced messages are never fragmented, and only carry their sequence number
+		if (size >= 4) {
+			uint32_t sequence;
+			memcpy(&sequence, data, 4);
+			HandleSequencedMessage(sender, (int)channel, type, sequence, data + 4, size - 4);
+		}
+	} else if (packetSizeLimit > 0) {
+		m_reassembly.HandleMessage(sender->GetPrimaryServiceID(), (int)channel, data, size);
+	} else {
+		auto newMessage = new NetworkMessage(data, size);
+		newMessage->m_channel = (int)channel;
+		newMessage->m_peer = sender->GetPrimaryServiceID();
+		m_stats.MessagesAllocated.Add();
+		QueueMessage(newMessage);
+	}
+}
+
+void Unet::Internal::Context::ReadShardPacket(Service* service, size_t packetSize, uint8_t serviceChannel, int channel)
+{
+	auto msg = new NetworkMessage(packetSize);
+	m_stats.MessagesAllocated.Add();
+
+	ServiceID peer;
+	msg->m_size = service->ReadPacket(msg->m_data, packetSize, &peer, serviceChannel);
+
+	m_shards->Add(peer, channel, msg);
+}
+
+void Unet::Internal::Context::QueueMessage(NetworkMessage* msg)
+{
+	m_queuedMessages[msg->m_channel].push(msg);
+	m_stats.GetChannel(2 + msg->m_channel).MessagesQueued.Add();
+	m_messagesArrived = true;
+}
+
+void Unet::Internal::Context::ClearQueuedMessages()
+{
+	for (size_t i = 0; i < m_queuedMessages.size(); i++) {
+		auto &channel = m_queuedMessages[i];
+		while (channel.size() > 0) {
+			delete channel.front();
+			channel.pop();
+		}
+		m_stats.GetChannel(2 + (int)i).MessagesQueued.Set(0);
+	}
+	m_latestMessages.clear();
+}
+
+void Unet::Internal::Context::OnMessageRead(NetworkMessage* msg)
+{
+	if (m_currentLobby == nullptr) {
+		return;
+	}
+
+	auto member = m_currentLobby->GetMember(msg->m_peer);
+	if (member != nullptr) {
+		auto &stats = member->m_stats.GetChannel(2 + msg->m_channel);
+		stats.PacketsReceived.Add();
+		stats.BytesReceived.Add((int64_t)msg->m_size);
+	}
+}
+
+int Unet::Internal::Context::GetWaitTime(std::vector<System::SocketHandle> &sockets, int maxWait)
+{
+	int ret = maxWait;
+
+	for (auto service : m_services) {
+		int serviceWait = service->GetWaitSockets(sockets);
+		if (serviceWait >= 0) {
+			ret = std::min(ret, serviceWait);
+		}
+	}
+
+	// Messages that arrived since the last wait. Ones that were already queued before that don't count,
+	// otherwise an application that waits before reading would never sleep while its queue isn't empty.
+	if (m_messagesArrived) {
+		m_messagesArrived = false;
+		return 0;
+	}
+
+	if (m_callbackCreateLobby.Ready() || m_callbackLobbyList.Ready() || m_callbackLobbyJoin.Ready() || m_callbackLobbyLeft.Ready()) {
+		return 0;
+	}
+
+	if (m_currentLobby != nullptr && m_currentLobby->HasPendingJoins()) {
+		return 0;
+	}
+
+	if (m_scheduler.HasQueued()) {
+		ret = std::min(ret, SEND_QUEUE_WAIT_MS);
+	}
+
+	auto deadline = m_timers.GetNextDeadline();
+	if (deadline != TimerWheel::Clock::time_point::max()) {
+		auto now = TimerWheel::Clock::now();
+		if (deadline <= now) {
+			return 0;
+		}
+
+		// Round up, so we don't wake up right before the timer is due
+		auto untilDeadline = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now + std::chrono::microseconds(999));
+		ret = (int)std::min<int64_t>(ret, (int64_t)untilDeadline.count());
+	}
+
+	return ret;
+}
+
+bool Unet::Internal::Context::WaitForSockets(System::SocketWaiter &waiter, std::vector<System::SocketHandle> &sockets, int waitTime)
+{
+	if (waitTime <= 0) {
+		return true;
+	}
+
+	// Services can share a socket (like Enet services on a shared host)
+	std::sort(sockets.begin(), sockets.end());
+	sockets.erase(std::unique(sockets.begin(), sockets.end()), sockets.end());
+
+	waiter.SetSockets(sockets);
+	return waiter.Wait(waitTime);
+}
+
 void Unet::Internal::Context::PrepareReceiveBuffer(size_t size)
 {
 	if (m_receiveBuffer.size() < size) {
@@ -1137,3 +2237,19 @@ void Unet::Internal::Context::PrepareSendBuffer(size_t size)
 		m_sendBuffer.resize((size_t)(size * 1.5));
 	}
 }
+
+bool Unet::Internal::Context::IsValidSendChannel(uint8_t channel)
+{
+	if (channel >= m_numChannels) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Can't send on channel %d, there are only %d channels", (int)channel, m_numChannels));
+		}
+		return false;
+	}
+	return true;
+}
+
+bool Unet::Internal::Context::UseFragmentStreams()
+{
+	return m_currentLobby != nullptr && m_currentLobby->SupportsFragmentStreams();
+}
@@ -0,0 +1,319 @@
+#include <Unet_common.h>
+#include <Unet/HostShards.h>
+#include <Unet/Context.h>
+#include <Unet/Trace.h>
+
+// Below this many packets per tick, waking up the workers costs more than it saves
+#define SHARD_MIN_PARALLEL_PACKETS (64)
+
+#define SHARD_FORWARD_CAPACITY (1024)
+
+Unet::HostShards::Shard::Shard(size_t forwardCapacity)
+	: m_reassembly(nullptr), m_forwards(forwardCapacity)
+{
+}
+
+Unet::HostShards::HostShards(Internal::Context* ctx, int numShards)
+	: m_numBusy(0)
+{
+	m_ctx = ctx;
+
+	assert(numShards > 0);
+	for (int i = 0; i < numShards; i++) {
+		auto shard = new Shard(SHARD_FORWARD_CAPACITY);
+		shard->m_reassembly.SetStats(&ctx->m_stats);
+		m_shards.emplace_back(shard);
+		shard->m_thread = std::thread(&HostShards::WorkerThread, this, shard);
+	}
+}
+
+Unet::HostShards::~HostShards()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_cvWork.notify_all();
+
+	for (auto shard : m_shards) {
+		shard->m_thread.join();
+	}
+
+	Clear();
+
+	for (auto shard : m_shards) {
+		delete shard;
+	}
+}
+
+int Unet::HostShards::NumShards()
+{
+	return (int)m_shards.size();
+}
+
+void Unet::HostShards::Add(const ServiceID &peer, int channel, NetworkMessage* msg)
+{
+	uint64_t key = peer.ID ^ ((uint64_t)peer.Service << 56);
+	key ^= key >> 33;
+	key *= 0xFF51AFD7ED558CCDULL;
+	key ^= key >> 33;
+
+	Incoming in;
+	in.Peer = peer;
+	in.Channel = channel;
+	in.Message = msg;
+	m_shards[key % m_shards.size()]->m_input.emplace_back(in);
+	m_numInput++;
+}
+
+bool Unet::HostShards::Process()
+{
+	UNET_TRACE_ZONE("HostShards::Process");
+
+	if (m_numInput == 0) {
+		return false;
+	}
+
+	bool forwarded = false;
+
+	if (m_numInput < SHARD_MIN_PARALLEL_PACKETS || m_shards.size() == 1) {
+		// Not worth the thread wake-up, so just do everything on this thread
+		for (auto shard : m_shards) {
+			shard->m_sendInline = true;
+			ProcessShard(shard);
+			shard->m_sendInline = false;
+			forwarded |= shard->m_numForwarded > 0;
+		}
+
+	} else {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_numBusy = (int)m_shards.size();
+			m_generation++;
+		}
+		m_cvWork.notify_all();
+
+		// Send relayed packets while the workers are still busy
+		while (m_numBusy.load(std::memory_order_acquire) > 0) {
+			if (DrainForwards()) {
+				forwarded = true;
+			} else {
+				std::this_thread::yield();
+			}
+		}
+		forwarded |= DrainForwards();
+	}
+	m_numInput = 0;
+
+	auto callbacks = m_ctx->GetCallbacks();
+
+	for (auto shard : m_shards) {
+		if (callbacks != nullptr) {
+			std::string error;
+			while (shard->m_reassembly.PopError(error)) {
+				callbacks->OnLogError(error);
+			}
+			for (auto &err : shard->m_errors) {
+				callbacks->OnLogError(err);
+			}
+		}
+		shard->m_errors.clear();
+
+		for (auto msg : shard->m_ready) {
+			if (msg->m_channel == -1) {
+				// The lobby might have been left by an earlier message in this loop
+				if (m_ctx->m_currentLobby != nullptr) {
+					m_ctx->m_currentLobby->HandleMessage(msg->m_peer, msg->m_data, msg->m_size);
+				}
+				delete msg;
+			} else {
+				m_ctx->QueueMessage(msg);
+			}
+		}
+		shard->m_ready.clear();
+		shard->m_numForwarded = 0;
+	}
+
+	return forwarded;
+}
+
+void Unet::HostShards::Clear()
+{
+	for (auto shard : m_shards) {
+		for (auto &in : shard->m_input) {
+			delete in.Message;
+		}
+		shard->m_input.clear();
+
+		for (auto msg : shard->m_ready) {
+			delete msg;
+		}
+		shard->m_ready.clear();
+
+		shard->m_errors.clear();
+		shard->m_reassembly.Clear();
+	}
+	m_numInput = 0;
+}
+
+void Unet::HostShards::Expire(std::chrono::steady_clock::time_point before, std::chrono::steady_clock::time_point unreliableBefore)
+{
+	// Workers only run during Process, so the shards are all ours here
+	auto callbacks = m_ctx->GetCallbacks();
+
+	for (auto shard : m_shards) {
+		if (shard->m_reassembly.Expire(before, unreliableBefore) == 0) {
+			continue;
+		}
+
+		std::string error;
+		while (shard->m_reassembly.PopError(error)) {
+			if (callbacks != nullptr) {
+				callbacks->OnLogError(error);
+			}
+		}
+	}
+}
+
+void Unet::HostShards::WorkerThread(Shard* shard)
+{
+	uint64_t generation = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cvWork.wait(lock, [this, generation]() {
+				return m_stopping || m_generation != generation;
+			});
+
+			if (m_stopping) {
+				return;
+			}
+			generation = m_generation;
+		}
+
+		ProcessShard(shard);
+
+		m_numBusy.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+void Unet::HostShards::ProcessShard(Shard* shard)
+{
+	UNET_TRACE_ZONE("HostShards::ProcessShard");
+
+	for (auto &in : shard->m_input) {
+		if (in.Channel == -2) {
+			HandleRelay(shard, in);
+			continue;
+		}
+
+		shard->m_reassembly.HandleMessage(in.Peer, in.Channel, in.Message->m_data, in.Message->m_size);
+		delete in.Message;
+
+		while (auto msg = shard->m_reassembly.PopReady()) {
+			shard->m_ready.emplace_back(msg);
+		}
+	}
+	shard->m_input.clear();
+}
+
+void Unet::HostShards::HandleRelay(Shard* shard, const Incoming &in)
+{
+	// Note: the lobby and its members are only read here. The calling thread doesn't touch them until
+	// all workers are finished.
+	auto lobby = m_ctx->m_currentLobby;
+	auto msg = in.Message;
+
+	size_t headerSize = lobby->GetRelayHeaderSize();
+	if (msg->m_size < headerSize) {
+		shard->m_errors.emplace_back(strPrintF("Relay packet of %d bytes is too small!", (int)msg->m_size));
+		delete msg;
+		return;
+	}
+
+	int peerRecipient = lobby->ReadRelayPeer(msg->m_data);
+	PacketType type = (PacketType)msg->m_data[headerSize - 1];
+
+	if (peerRecipient == UNET_RELAY_BROADCAST && lobby->SupportsRelayBroadcast()) {
+		// Fanned out on the calling thread, which can also handle our own copy
+		Forward forward;
+		forward.Recipient = in.Peer;
+		forward.Type = type;
+		forward.Message = msg;
+		forward.Broadcast = true;
+		PushForward(shard, forward);
+		return;
+	}
+
+	auto peerMember = lobby->GetMember(in.Peer);
+	auto recipientMember = lobby->GetMember(peerRecipient);
+	if (peerMember == nullptr || recipientMember == nullptr) {
+		shard->m_errors.emplace_back(strPrintF("Tried relaying packet of %d bytes to unknown peer %d!", (int)(msg->m_size - headerSize), peerRecipient));
+		delete msg;
+		return;
+	}
+
+	auto id = recipientMember->GetDataServiceID();
+	assert(id.IsValid());
+	if (!id.IsValid()) {
+		delete msg;
+		return;
+	}
+
+	// The relayed packet only differs from the relay request by its peer ID
+	lobby->WriteRelayPeer(msg->m_data, peerMember->UnetPeer);
+
+	Forward forward;
+	forward.Recipient = id;
+	forward.Type = type;
+	forward.Message = msg;
+	PushForward(shard, forward);
+}
+
+void Unet::HostShards::PushForward(Shard* shard, const Forward &forward)
+{
+	if (shard->m_sendInline) {
+		shard->m_numForwarded++;
+		SendForward(forward);
+		return;
+	}
+
+	while (!shard->m_forwards.Push(forward)) {
+		std::this_thread::yield();
+	}
+}
+
+bool Unet::HostShards::DrainForwards()
+{
+	bool ret = false;
+
+	for (auto shard : m_shards) {
+		Forward forward;
+		while (shard->m_forwards.Pop(forward)) {
+			SendForward(forward);
+			ret = true;
+		}
+	}
+
+	return ret;
+}
+
+void Unet::HostShards::SendForward(const Forward &forward)
+{
+	if (forward.Broadcast) {
+		m_ctx->BroadcastRelayPacket(forward.Recipient, forward.Message->m_data, forward.Message->m_size);
+		delete forward.Message;
+		return;
+	}
+
+	auto service = m_ctx->GetService(forward.Recipient.Service);
+	assert(service != nullptr);
+	if (service != nullptr) {
+		service->SendPacket(forward.Recipient, forward.Message->m_data, forward.Message->m_size, forward.Type, 1);
+
+		m_ctx->m_stats.RelayedPackets.Add();
+		m_ctx->m_stats.RelayedBytes.Add((int64_t)forward.Message->m_size);
+	}
+	delete forward.Message;
+}
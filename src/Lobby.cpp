@@ -2,16 +2,25 @@
 #include <Unet/Lobby.h>
 #include <Unet/Context.h>
 #include <Unet/LobbyPacket.h>
+#include <Unet/Trace.h>
 
 Unet::Lobby::Lobby(Internal::Context* ctx, const LobbyInfo &lobbyInfo)
 {
 	m_ctx = ctx;
 	m_info = lobbyInfo;
 	m_info.EntryPoints.clear();
+
+	// Clients find out from the lobby info
+	if (m_info.IsHosting) {
+		m_peerBytes = UNET_PEER_BYTES;
+		m_fragmentStreams = true;
+	}
 }
 
 Unet::Lobby::~Lobby()
 {
+	m_ctx->m_stats.JoinsPending.Sub((int64_t)m_pendingJoins.size());
+
 	for (auto member : m_members) {
 		delete member;
 	}
@@ -48,32 +57,27 @@ const std::vector<Unet::LobbyMember*> &Unet::Lobby::GetMembers()
 
 Unet::LobbyMember* Unet::Lobby::GetMember(const xg::Guid &guid)
 {
-	for (auto member : m_members) {
-		if (member->UnetGuid == guid) {
-			return member;
-		}
+	auto it = m_membersByGuid.find(guid);
+	if (it != m_membersByGuid.end()) {
+		return it->second;
 	}
 	return nullptr;
 }
 
 Unet::LobbyMember* Unet::Lobby::GetMember(int peer)
 {
-	for (auto member : m_members) {
-		if (member->UnetPeer == peer) {
-			return member;
-		}
+	auto it = m_membersByPeer.find(peer);
+	if (it != m_membersByPeer.end()) {
+		return it->second;
 	}
 	return nullptr;
 }
 
 Unet::LobbyMember* Unet::Lobby::GetMember(const ServiceID &serviceId)
 {
-	for (auto member : m_members) {
-		for (auto &id : member->IDs) {
-			if (id == serviceId) {
-				return member;
-			}
-		}
+	auto it = m_membersByID.find(serviceId);
+	if (it != m_membersByID.end()) {
+		return it->second;
 	}
 	return nullptr;
 }
@@ -85,16 +89,36 @@ Unet::LobbyMember* Unet::Lobby::GetHostMember()
 
 void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t size)
 {
+	UNET_TRACE_ZONE("Lobby::HandleMessage");
+
 	m_ctx->GetCallbacks()->OnLogDebug(strPrintF("Handle lobby message of %d bytes", (int)size));
 
 	auto peerMember = GetMember(peer);
+	if (peerMember != nullptr) {
+		auto &stats = peerMember->m_stats.GetChannel(0);
+		stats.PacketsReceived.Add();
+		stats.BytesReceived.Add((int64_t)size);
+	}
+
+	if (size < 4) {
+		m_ctx->GetCallbacks()->OnLogError(strPrintF("[P2P] [%s] Message from 0x%016llX is too small!", GetServiceNameByType(peer.Service), peer.ID));
+		return;
+	}
 
 	uint32_t sizeJson = *(uint32_t*)data;
+	if (sizeJson == 0) {
+		HandleBinaryMessage(peer, data + 4, size - 4);
+		return;
+	}
 
 	uint8_t* binaryData = data + 4 + sizeJson;
 	size_t binarySize = size - 4 - sizeJson;
 
-	json js = JsonUnpack(data + 4, sizeJson);
+	json js;
+	{
+		UNET_TRACE_ZONE("Lobby::JsonUnpack");
+		js = JsonUnpack(data + 4, sizeJson);
+	}
 	if (!js.is_object() || !js.contains("t")) {
 		m_ctx->GetCallbacks()->OnLogError(strPrintF("[P2P] [%s] Message from 0x%016llX is not a valid data object!", GetServiceNameByType(peer.Service), peer.ID));
 		return;
@@ -113,7 +137,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 		xg::Guid guid(js["guid"].get<std::string>());
 		auto member = AddMemberService(guid, peer);
 
-		if (member->Valid) {
+		if (member != nullptr && member->Valid) {
 			js = json::object();
 			js["t"] = (uint8_t)LobbyPacketType::MemberNewService;
 			js["guid"] = guid.str();
@@ -138,40 +162,37 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 		// Update member
 		member->Name = js["name"].get<std::string>();
 		member->UnetPrimaryService = peer.Service;
-		member->Valid = true;
-
-		// Send LobbyInfo to new member
-		js = json::object();
-		js["t"] = (uint8_t)LobbyPacketType::LobbyInfo;
-		js["data"] = SerializeData();
-		js["members"] = json::array();
-		for (auto member : m_members) {
-			if (member->Valid) {
-				js["members"].emplace_back(member->Serialize());
-			}
+		member->m_snapshotDirty = true;
+		if (js.contains("memberdata")) {
+			member->m_receivesMemberData = js["memberdata"].get<bool>();
 		}
-		m_ctx->InternalSendTo(member, js);
 
-		// Send MemberInfo to existing members
-		js = member->Serialize();
-		js["t"] = (uint8_t)LobbyPacketType::MemberInfo;
-		m_ctx->InternalSendToAllExcept(member, js);
+		// Only send the changes if the member has seen this lobby before
+		uint32_t base = 0;
+		if (js.contains("lobby") && js.contains("version") && js["lobby"].get<std::string>() == m_info.UnetGuid.str()) {
+			base = js["version"].get<uint32_t>();
+		}
 
-		// Run callback
-		m_ctx->GetCallbacks()->OnLobbyPlayerJoined(member);
+		// A member that was already admitted asks again when it couldn't use the lobby info we sent
+		if (member->Valid) {
+			SendLobbyInfo(member, base);
+			return;
+		}
 
-	} else if (type == LobbyPacketType::Ping) {
-		js = json::object();
-		js["t"] = (uint8_t)LobbyPacketType::Pong;
-		m_ctx->InternalSendTo(peer, js);
+		// The member is admitted at the end of RunCallbacks, or later if too many members are joining
+		auto it = std::find_if(m_pendingJoins.begin(), m_pendingJoins.end(), [member](const PendingJoin &join) {
+			return join.Guid == member->UnetGuid;
+		});
 
-	} else if (type == LobbyPacketType::Pong) {
-		auto member = GetMember(peer);
-		if (member->UnetPeer != m_ctx->m_localPeer && member->LastPingRequest.time_since_epoch().count() > 0) {
-			auto now = std::chrono::high_resolution_clock::now();
-			auto dt = std::chrono::duration_cast<std::chrono::milliseconds>(now - member->LastPingRequest);
-			member->Ping = (int)dt.count();
-			member->LastPingRequest = std::chrono::high_resolution_clock::time_point();
+		if (it != m_pendingJoins.end()) {
+			it->SnapshotBase = base;
+		} else {
+			PendingJoin join;
+			join.Guid = member->UnetGuid;
+			join.SnapshotBase = base;
+			join.Received = std::chrono::steady_clock::now();
+			m_pendingJoins.emplace_back(join);
+			m_ctx->m_stats.JoinsPending.Add();
 		}
 
 	} else if (type == LobbyPacketType::LobbyInfo) {
@@ -179,25 +200,101 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 			return;
 		}
 
-		DeserializeData(js["data"]);
+		auto &cache = m_ctx->m_lobbyCache;
+
+		std::vector<json> members;
+		json data;
+
+		// Without a usable snapshot, we forget our cached one and ask the host for all of it. A full snapshot
+		// that's broken isn't asked for again once we're connected, since the host would only send the same.
+		auto requestFullInfo = [this, &cache](const std::string &error) {
+			m_ctx->GetCallbacks()->OnLogError(error);
+			cache = LobbySnapshotCache();
+			m_ctx->SendHello();
+		};
+
+		if (js.contains("base")) {
+			// Only the changes since the snapshot we told the host about
+			uint32_t base = js["base"].get<uint32_t>();
+			if (cache.Version != base) {
+				requestFullInfo(strPrintF("Lobby info is based on version %u, but we have version %u!", base, cache.Version));
+				return;
+			}
+
+			members = cache.Members;
+			data = js.contains("data") ? js["data"] : cache.Data;
+
+			for (auto &removed : js["removed"]) {
+				auto guid = removed.get<std::string>();
+				members.erase(std::remove_if(members.begin(), members.end(), [&guid](const json &member) {
+					return member["guid"].get<std::string>() == guid;
+				}), members.end());
+			}
+		} else {
+			data = js["data"];
+		}
+
+		std::vector<json> changed;
+		if (!LobbySnapshot::ReadMembers(binaryData, binarySize, changed)) {
+			if (js.contains("base") || m_ctx->m_status != ContextStatus::Connected) {
+				requestFullInfo("Lobby info contains invalid member data!");
+			} else {
+				m_ctx->GetCallbacks()->OnLogError("Lobby info contains invalid member data!");
+			}
+			return;
+		}
+
+		for (auto &member : changed) {
+			auto it = std::find_if(members.begin(), members.end(), [&member](const json &existing) {
+				return existing["guid"] == member["guid"];
+			});
+			if (it != members.end()) {
+				*it = std::move(member);
+			} else {
+				members.emplace_back(std::move(member));
+			}
+		}
+
+		DeserializeData(data);
 		m_info.Name = GetData("unet-name");
 		m_info.UnetGuid = xg::Guid(GetData("unet-guid"));
 
+		// Hosts that don't say anything only know 1 byte peer IDs
+		std::string strPeerBytes = GetData("unet-peer-bytes");
+		m_peerBytes = (strPeerBytes == "2") ? 2 : 1;
+		m_fragmentStreams = (GetData("unet-fragment-streams") == "1");
+
 		std::string strPrivacy = GetData("unet-privacy");
 		m_info.Privacy = (LobbyPrivacy)atoi(strPrivacy.c_str());
 
-		for (auto &member : js["members"]) {
+		for (auto &member : members) {
 			DeserializeMember(member);
 		}
 
+		cache.LobbyGuid = m_info.UnetGuid;
+		cache.Version = js["version"].get<uint32_t>();
+		cache.Data = std::move(data);
+		cache.Members = std::move(members);
+
 		for (auto member : m_members) {
 			if (member->UnetGuid == m_ctx->m_localGuid) {
 				m_ctx->m_localPeer = member->UnetPeer;
 			}
 		}
 
+		// Lobby info we asked for again after joining only brings us up to date
+		if (m_ctx->m_status == ContextStatus::Connected) {
+			return;
+		}
+
 		m_ctx->m_status = ContextStatus::Connected;
 
+		m_ctx->m_timers.Cancel(m_ctx->m_joinTimer);
+		m_ctx->m_joinTimer = 0;
+
+		auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_ctx->m_helloTime);
+		m_ctx->m_stats.JoinLatency.Add((int)latency.count());
+
 		LobbyJoinResult result;
 		result.Code = Result::OK;
 		result.JoinedLobby = this;
@@ -233,6 +330,27 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 
 		m_ctx->LeaveLobby(LeaveReason::Kicked);
 
+	} else if (type == LobbyPacketType::MemberConnect) {
+		if (m_info.IsHosting) {
+			return;
+		}
+
+		xg::Guid guid(js["guid"].get<std::string>());
+
+		auto member = GetMember(guid);
+		if (member == nullptr) {
+			return;
+		}
+
+		// Both sides get this message at roughly the same time, the lowest peer initiates
+		bool initiator = (m_ctx->m_localPeer < member->UnetPeer);
+		for (auto &id : member->IDs) {
+			auto service = m_ctx->GetService(id.Service);
+			if (service != nullptr) {
+				service->ConnectPeer(id, initiator);
+			}
+		}
+
 	} else if (type == LobbyPacketType::MemberNewService) {
 		if (m_info.IsHosting) {
 			return;
@@ -295,7 +413,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 			js["guid"] = peerMember->UnetGuid.str();
 			js["name"] = name;
 			js["value"] = value;
-			m_ctx->InternalSendToAll(js);
+			m_ctx->InternalSendMemberUpdate(peerMember, js);
 
 			m_ctx->GetCallbacks()->OnLobbyMemberDataChanged(peerMember, name);
 
@@ -322,7 +440,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 			js["t"] = (uint8_t)LobbyPacketType::LobbyMemberData;
 			js["guid"] = peerMember->UnetGuid.str();
 			js["name"] = name;
-			m_ctx->InternalSendToAll(js);
+			m_ctx->InternalSendMemberUpdate(peerMember, js);
 
 			m_ctx->GetCallbacks()->OnLobbyMemberDataChanged(peerMember, name);
 
@@ -345,6 +463,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 		if (m_info.IsHosting) {
 			std::string oldname = peerMember->Name;
 			peerMember->Name = name;
+			peerMember->m_snapshotDirty = true;
 
 			js = json::object();
 			js["t"] = (uint8_t)LobbyPacketType::LobbyMemberNameChanged;
@@ -365,6 +484,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 
 			std::string oldname = member->Name;
 			member->Name = name;
+			member->m_snapshotDirty = true;
 			m_ctx->GetCallbacks()->OnLobbyMemberNameChanged(member, oldname);
 		}
 
@@ -379,6 +499,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 
 		if (m_info.IsHosting) {
 			peerMember->Files.emplace_back(newFile);
+			peerMember->m_snapshotDirty = true;
 
 			js = json::object();
 			js["t"] = (uint8_t)LobbyPacketType::LobbyFileAdded;
@@ -386,7 +507,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 			js["filename"] = filename;
 			js["size"] = size;
 			js["hash"] = hash;
-			m_ctx->InternalSendToAllExcept(peerMember, js);
+			m_ctx->InternalSendMemberUpdate(peerMember, js, peerMember);
 
 			m_ctx->GetCallbacks()->OnLobbyFileAdded(peerMember, newFile);
 
@@ -401,6 +522,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 			}
 
 			member->Files.emplace_back(newFile);
+			member->m_snapshotDirty = true;
 			m_ctx->GetCallbacks()->OnLobbyFileAdded(member, newFile);
 		}
 
@@ -414,7 +536,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 			js["t"] = (uint8_t)LobbyPacketType::LobbyFileRemoved;
 			js["guid"] = peerMember->UnetGuid.str();
 			js["filename"] = filename;
-			m_ctx->InternalSendToAllExcept(peerMember, js);
+			m_ctx->InternalSendMemberUpdate(peerMember, js, peerMember);
 
 			m_ctx->GetCallbacks()->OnLobbyFileRemoved(peerMember, filename);
 
@@ -496,11 +618,132 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 			m_ctx->GetCallbacks()->OnLobbyChat(member, text.c_str());
 		}
 
+	} else if (type == LobbyPacketType::MemberGroupJoined || type == LobbyPacketType::MemberGroupLeft) {
+		auto group = js["group"].get<std::string>();
+		bool joined = (type == LobbyPacketType::MemberGroupJoined);
+
+		if (m_info.IsHosting) {
+			if (peerMember == nullptr) {
+				return;
+			}
+
+			if (joined) {
+				peerMember->JoinGroup(group);
+			} else {
+				peerMember->LeaveGroup(group);
+			}
+
+		} else {
+			xg::Guid guid(js["guid"].get<std::string>());
+
+			auto member = GetMember(guid);
+			if (member == nullptr) {
+				return;
+			}
+
+			if (joined) {
+				InternalJoinGroup(member, group);
+			} else {
+				InternalLeaveGroup(member, group);
+			}
+		}
+
+	} else if (type == LobbyPacketType::MemberOptions) {
+		if (!m_info.IsHosting || peerMember == nullptr) {
+			return;
+		}
+
+		if (js.contains("memberdata")) {
+			bool receive = js["memberdata"].get<bool>();
+
+			// Nothing was sent while it was off, so it gets everyone's current data and files
+			if (receive && !peerMember->m_receivesMemberData) {
+				SendLobbyInfo(peerMember, 0);
+			}
+			peerMember->m_receivesMemberData = receive;
+		}
+
 	} else {
 		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("P2P packet type was not recognized: %d", (int)type));
 	}
 }
 
+void Unet::Lobby::HandleBinaryMessage(const ServiceID &peer, uint8_t* data, size_t size)
+{
+	if (size < 1) {
+		return;
+	}
+
+	auto type = (LobbyPacketType)data[0];
+
+	if (type == LobbyPacketType::Ping) {
+		if (size < 9) {
+			return;
+		}
+
+		// Echo the timestamp back as-is, it only means something to the sender
+		uint8_t pong[9];
+		pong[0] = (uint8_t)LobbyPacketType::Pong;
+		memcpy(pong + 1, data + 1, 8);
+		m_ctx->InternalSendBinaryTo(peer, pong, sizeof(pong), PacketType::Unreliable);
+
+	} else if (type == LobbyPacketType::Pong) {
+		if (size < 9) {
+			return;
+		}
+
+		auto member = GetMember(peer);
+		if (member == nullptr || member->UnetPeer == m_ctx->m_localPeer) {
+			return;
+		}
+
+		uint64_t timestamp;
+		memcpy(&timestamp, data + 1, 8);
+		member->OnPong(timestamp);
+
+	} else if (type == LobbyPacketType::PathProbe) {
+		if (size < 3) {
+			return;
+		}
+
+		uint8_t ack[3];
+		ack[0] = (uint8_t)LobbyPacketType::PathProbeAck;
+		memcpy(ack + 1, data + 1, 2);
+		m_ctx->InternalSendBinaryTo(peer, ack, sizeof(ack), PacketType::Unreliable);
+
+	} else if (type == LobbyPacketType::PathProbeAck) {
+		if (size < 3) {
+			return;
+		}
+
+		auto member = GetMember(peer);
+		if (member == nullptr || member->UnetPeer == m_ctx->m_localPeer) {
+			return;
+		}
+
+		uint16_t probeSize;
+		memcpy(&probeSize, data + 1, 2);
+		member->OnProbeAck(probeSize);
+
+	} else if (type == LobbyPacketType::SequencedMessage) {
+		if (size < 7) {
+			return;
+		}
+
+		auto member = GetMember(peer);
+		if (member == nullptr || member->UnetPeer == m_ctx->m_localPeer) {
+			return;
+		}
+
+		uint32_t sequence;
+		memcpy(&sequence, data + 3, 4);
+		m_ctx->HandleSequencedMessage(member, data[1], (PacketType)data[2], sequence, data + 7, size - 7);
+
+	} else {
+		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Binary P2P packet type was not recognized: %d", (int)type));
+	}
+}
+
 Unet::LobbyMember* Unet::Lobby::DeserializeMember(const json &member)
 {
 	xg::Guid guid(member["guid"].get<std::string>());
@@ -515,8 +758,28 @@ Unet::LobbyMember* Unet::Lobby::DeserializeMember(const json &member)
 	auto lobbyMember = GetMember(guid);
 	assert(lobbyMember != nullptr); // If this fails, there's no service IDs given for this member
 
+	int oldPeer = lobbyMember->UnetPeer;
+
+	auto oldGroups = lobbyMember->Groups;
+	for (auto &group : oldGroups) {
+		InternalLeaveGroup(lobbyMember, group);
+	}
+
 	lobbyMember->Deserialize(member);
 
+	auto newGroups = std::move(lobbyMember->Groups);
+	lobbyMember->Groups.clear();
+	for (auto &group : newGroups) {
+		InternalJoinGroup(lobbyMember, group);
+	}
+
+	if (lobbyMember->UnetPeer != oldPeer) {
+		if (GetMember(oldPeer) == lobbyMember) {
+			m_membersByPeer.erase(oldPeer);
+		}
+		m_membersByPeer[lobbyMember->UnetPeer] = lobbyMember;
+	}
+
 	return lobbyMember;
 }
 
@@ -570,60 +833,56 @@ void Unet::Lobby::ServiceDisconnected(ServiceType service)
 
 Unet::LobbyMember* Unet::Lobby::AddMemberService(const xg::Guid &guid, const ServiceID &id)
 {
-	for (size_t i = 0; i < m_members.size(); i++) {
-		bool foundMember = false;
-		auto member = m_members[i];
+	auto existing = GetMember(id);
+	if (existing != nullptr && existing->UnetGuid != guid) {
+		auto strGuid = guid.str();
+		auto strExistingGuid = existing->UnetGuid.str();
 
-		if (member->UnetGuid == guid) {
-			continue;
-		}
+		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Tried adding %s ID 0x%016llX to member with guid %s, but another member with guid %s already has this ID! Assuming existing member is no longer connected, removing from member list.",
+			GetServiceNameByType(id.Service), id.ID,
+			strGuid.c_str(), strExistingGuid.c_str()
+		));
 
-		for (auto &memberId : member->IDs) {
-			if (memberId != id) {
-				continue;
-			}
+		auto it = std::find(m_members.begin(), m_members.end(), existing);
+		m_members.erase(it);
+		m_info.NumPlayers--;
 
-			auto strGuid = guid.str();
-			auto strExistingGuid = member->UnetGuid.str();
+		UnindexMember(existing);
+	}
 
-			m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Tried adding %s ID 0x%016llX to member with guid %s, but another member with guid %s already has this ID! Assuming existing member is no longer connected, removing from member list.",
-				GetServiceNameByType(id.Service), id.ID,
-				strGuid.c_str(), strExistingGuid.c_str()
+	auto member = GetMember(guid);
+	if (member != nullptr) {
+		auto existingId = member->GetServiceID(id.Service);
+		if (existingId.IsValid()) {
+			auto strGuid = guid.str();
+			m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Tried adding player service %s for guid %s, but it already exists!",
+				GetServiceNameByType(id.Service), strGuid.c_str()
 			));
-
-			m_members.erase(m_members.begin() + i);
-			m_info.NumPlayers--;
-			foundMember = true;
-			break;
-		}
-
-		if (foundMember) {
-			break;
+		} else {
+			member->IDs.emplace_back(id);
+			member->m_snapshotDirty = true;
+			m_membersByID[id] = member;
 		}
+		return member;
 	}
 
-	for (auto member : m_members) {
-		if (member->UnetGuid == guid) {
-			auto existingId = member->GetServiceID(id.Service);
-			if (existingId.IsValid()) {
-				auto strGuid = guid.str();
-				m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Tried adding player service %s for guid %s, but it already exists!",
-					GetServiceNameByType(id.Service), strGuid.c_str()
-				));
-			} else {
-				member->IDs.emplace_back(id);
-			}
-			return member;
+	// Only the host decides on peer IDs, clients get them from the member info
+	int peer = -1;
+	if (m_info.IsHosting) {
+		peer = AllocatePeer();
+		if (peer == -1) {
+			auto strGuid = guid.str();
+			m_ctx->GetCallbacks()->OnLogError(strPrintF("Can't add member with guid %s, there are no more peer IDs available!", strGuid.c_str()));
+			return nullptr;
 		}
 	}
 
 	auto newMember = new LobbyMember(m_ctx);
 	newMember->Valid = false;
 	newMember->UnetGuid = guid;
-	newMember->UnetPeer = GetNextAvailablePeer();
+	newMember->UnetPeer = peer;
 	newMember->IDs.emplace_back(id);
-	m_members.emplace_back(newMember);
-	m_info.NumPlayers++;
+	AddMember(newMember);
 
 	return newMember;
 }
@@ -642,12 +901,16 @@ void Unet::Lobby::RemoveMemberService(const ServiceID &id)
 	}
 
 	member->IDs.erase(it);
+	member->m_snapshotDirty = true;
+	m_membersByID.erase(id);
+
 	if (member->IDs.size() == 0) {
 		auto itMember = std::find(m_members.begin(), m_members.end(), member);
 		if (itMember != m_members.end()) {
 			m_members.erase(itMember);
 			m_info.NumPlayers--;
 		}
+		UnindexMember(member);
 
 		m_ctx->OnLobbyPlayerLeft(member);
 		delete member;
@@ -661,6 +924,7 @@ void Unet::Lobby::RemoveMember(LobbyMember* member)
 
 	m_members.erase(it);
 	m_info.NumPlayers--;
+	UnindexMember(member);
 
 	m_ctx->OnLobbyPlayerLeft(member);
 	delete member;
@@ -832,13 +1096,230 @@ void Unet::Lobby::RemoveData(const std::string &name)
 	}
 }
 
-int Unet::Lobby::GetNextAvailablePeer()
+void Unet::Lobby::AdmitPendingJoins(int budget)
 {
-	int i = 0;
-	while (GetMember(i) != nullptr) {
-		i++;
+	int admitted = 0;
+
+	while (m_pendingJoins.size() > 0 && (budget == 0 || admitted < budget)) {
+		auto join = m_pendingJoins.front();
+		m_pendingJoins.pop_front();
+		m_ctx->m_stats.JoinsPending.Sub();
+
+		// The member might have left while waiting
+		auto member = GetMember(join.Guid);
+		if (member == nullptr) {
+			continue;
+		}
+
+		auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - join.Received);
+		m_ctx->m_stats.JoinQueueTime.Add((int)waited.count());
+
+		AdmitMember(member, join.SnapshotBase);
+		admitted++;
+	}
+}
+
+bool Unet::Lobby::HasPendingJoins()
+{
+	return m_pendingJoins.size() > 0;
+}
+
+void Unet::Lobby::AdmitMember(LobbyMember* member, uint32_t snapshotBase)
+{
+	UNET_TRACE_ZONE("Lobby::AdmitMember");
+
+	member->Valid = true;
+
+	// Send LobbyInfo to new member
+	SendLobbyInfo(member, snapshotBase);
+
+	// Send MemberInfo to existing members
+	json js = member->Serialize();
+	js["t"] = (uint8_t)LobbyPacketType::MemberInfo;
+	m_ctx->InternalSendToAllExcept(member, js);
+
+	// Tell the new member and all other clients to connect directly to each other
+	for (auto other : m_members) {
+		if (other == member || !other->Valid || other->UnetPeer == m_ctx->m_localPeer) {
+			continue;
+		}
+
+		js = json::object();
+		js["t"] = (uint8_t)LobbyPacketType::MemberConnect;
+		js["guid"] = other->UnetGuid.str();
+		m_ctx->InternalSendTo(member, js);
+
+		js["guid"] = member->UnetGuid.str();
+		m_ctx->InternalSendTo(other, js);
+	}
+
+	// Run callback
+	m_ctx->GetCallbacks()->OnLobbyPlayerJoined(member);
+}
+
+void Unet::Lobby::SendLobbyInfo(LobbyMember* member, uint32_t snapshotBase)
+{
+	m_snapshot.Update(this);
+
+	std::vector<uint8_t> members;
+	json js;
+	js["t"] = (uint8_t)LobbyPacketType::LobbyInfo;
+	m_snapshot.Write(this, snapshotBase, js, members);
+	m_ctx->InternalSendTo(member, js, members.data(), members.size());
+}
+
+const std::vector<Unet::LobbyMember*> &Unet::Lobby::GetGroupMembers(const std::string &group)
+{
+	static std::vector<LobbyMember*> empty;
+
+	auto it = m_groups.find(group);
+	if (it == m_groups.end()) {
+		return empty;
+	}
+	return it->second;
+}
+
+bool Unet::Lobby::InternalJoinGroup(LobbyMember* member, const std::string &group)
+{
+	if (member->InGroup(group)) {
+		return false;
+	}
+
+	member->Groups.emplace_back(group);
+	member->m_snapshotDirty = true;
+	m_groups[group].emplace_back(member);
+	return true;
+}
+
+bool Unet::Lobby::InternalLeaveGroup(LobbyMember* member, const std::string &group)
+{
+	auto it = std::find(member->Groups.begin(), member->Groups.end(), group);
+	if (it == member->Groups.end()) {
+		return false;
+	}
+	member->Groups.erase(it);
+	member->m_snapshotDirty = true;
+
+	auto itGroup = m_groups.find(group);
+	if (itGroup != m_groups.end()) {
+		auto &members = itGroup->second;
+		members.erase(std::remove(members.begin(), members.end(), member), members.end());
+
+		if (members.size() == 0) {
+			m_groups.erase(itGroup);
+		}
+	}
+	return true;
+}
+
+size_t Unet::Lobby::GetRelayHeaderSize() const
+{
+	return (size_t)m_peerBytes + 2;
+}
+
+size_t Unet::Lobby::GetRelayBroadcastHeaderSize() const
+{
+	return GetRelayHeaderSize() + 2;
+}
+
+void Unet::Lobby::WriteRelayPeer(uint8_t* data, int peer) const
+{
+	if (m_peerBytes == 1) {
+		data[0] = (uint8_t)peer;
+	} else {
+		uint16_t peer16 = (uint16_t)peer;
+		memcpy(data, &peer16, 2);
+	}
+}
+
+int Unet::Lobby::ReadRelayPeer(const uint8_t* data) const
+{
+	if (m_peerBytes == 1) {
+		return (int)data[0];
+	}
+
+	uint16_t peer16;
+	memcpy(&peer16, data, 2);
+	return (int)peer16;
+}
+
+bool Unet::Lobby::SupportsRelayBroadcast() const
+{
+	return m_peerBytes >= 2;
+}
+
+bool Unet::Lobby::SupportsFragmentStreams() const
+{
+	return m_fragmentStreams;
+}
+
+int Unet::Lobby::AllocatePeer()
+{
+	// Peer IDs have to fit in relay headers, and the highest 2 byte ID is the relay broadcast
+	int maxPeers = 1 << (8 * m_peerBytes);
+	if (SupportsRelayBroadcast()) {
+		maxPeers = UNET_RELAY_BROADCAST;
+	}
+
+	if (m_nextPeer < maxPeers) {
+		return m_nextPeer++;
+	}
+
+	if (m_freePeers.size() > 0) {
+		int peer = m_freePeers.front();
+		m_freePeers.pop_front();
+		return peer;
+	}
+
+	return -1;
+}
+
+void Unet::Lobby::ReleasePeer(int peer)
+{
+	if (m_info.IsHosting && peer >= 0) {
+		m_freePeers.emplace_back(peer);
+	}
+}
+
+void Unet::Lobby::AddMember(LobbyMember* member)
+{
+	m_members.emplace_back(member);
+	m_info.NumPlayers++;
+	IndexMember(member);
+}
+
+void Unet::Lobby::IndexMember(LobbyMember* member)
+{
+	m_membersByGuid[member->UnetGuid] = member;
+	if (member->UnetPeer != -1) {
+		m_membersByPeer[member->UnetPeer] = member;
+	}
+	for (auto &id : member->IDs) {
+		m_membersByID[id] = member;
+	}
+}
+
+void Unet::Lobby::UnindexMember(LobbyMember* member)
+{
+	m_membersByGuid.erase(member->UnetGuid);
+
+	auto groups = member->Groups;
+	for (auto &group : groups) {
+		InternalLeaveGroup(member, group);
+	}
+
+	auto itPeer = m_membersByPeer.find(member->UnetPeer);
+	if (itPeer != m_membersByPeer.end() && itPeer->second == member) {
+		m_membersByPeer.erase(itPeer);
+		ReleasePeer(member->UnetPeer);
+	}
+
+	for (auto &id : member->IDs) {
+		auto itID = m_membersByID.find(id);
+		if (itID != m_membersByID.end() && itID->second == member) {
+			m_membersByID.erase(itID);
+		}
 	}
-	return i;
 }
 
 void Unet::Lobby::HandleOutgoingFileTransfers()
@@ -862,6 +1343,11 @@ void Unet::Lobby::HandleOutgoingFileTransfers()
 		const size_t blockSize = 1024 * 64;
 		const int maxBlocks = 3;
 
+		// Don't read ahead of the send rate, the file data would only pile up in the scheduler
+		if (m_ctx->m_scheduler.GetQueuedBytes(SendScheduler::FileClass) >= blockSize * maxBlocks) {
+			continue;
+		}
+
 		uint8_t* p = file->m_buffer + transfer.CurrentPos;
 		size_t bytesLeft = file->m_size - transfer.CurrentPos;
 		int numBlocks = 0;
@@ -873,7 +1359,7 @@ void Unet::Lobby::HandleOutgoingFileTransfers()
 		for (int i = 0; i < maxBlocks && bytesLeft > 0; i++) {
 			size_t sendSize = std::min(blockSize, bytesLeft);
 
-			m_ctx->InternalSendTo(member, js, p, sendSize);
+			m_ctx->InternalSendFileData(member, js, p, sendSize);
 
 			p += sendSize;
 			transfer.CurrentPos += sendSize;
@@ -43,6 +43,8 @@ json Unet::LobbyDataContainer::SerializeData() const
 
 void Unet::LobbyDataContainer::DeserializeData(const json &js)
 {
+	m_dataChanged = true;
+
 	for (auto &pair : js.items()) {
 		bool found = false;
 		for (auto &data : m_data) {
@@ -67,6 +69,7 @@ void Unet::LobbyDataContainer::InternalSetData(const std::string &name, const st
 				return;
 			}
 			data.Value = value;
+			m_dataChanged = true;
 			return;
 		}
 	}
@@ -75,6 +78,7 @@ void Unet::LobbyDataContainer::InternalSetData(const std::string &name, const st
 	newData.Name = name;
 	newData.Value = value;
 	m_data.emplace_back(newData);
+	m_dataChanged = true;
 }
 
 void Unet::LobbyDataContainer::InternalRemoveData(const std::string &name)
@@ -85,5 +89,6 @@ void Unet::LobbyDataContainer::InternalRemoveData(const std::string &name)
 
 	if (it != m_data.end()) {
 		m_data.erase(it);
+		m_dataChanged = true;
 	}
 }
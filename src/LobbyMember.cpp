@@ -3,15 +3,32 @@
 #include <Unet/Context.h>
 #include <Unet/LobbyPacket.h>
 
+// How many rounds of probes are sent to a member before giving up on finding out its limit
+#define UNET_PROBE_ROUNDS 4
+
+// How many rounds the biggest probe has to be lost in, while smaller ones come back, before the limit is lowered
+#define UNET_PROBE_FAILURES 2
+
+// How long until the path to a member is probed again, in case it changed
+#define UNET_PROBE_REPEAT_MS 60000
+
+// Payload sizes that are probed below the service's own limit, for paths with a smaller MTU (such as
+// tunnels and IPv6 minimum MTU links)
+static const size_t ProbeSizes[] = { 1280, 1200, 1024, 512 };
+
 Unet::LobbyMember::LobbyMember(Internal::Context* ctx)
+	: m_stats(ctx->m_numChannels + 2)
 {
 	m_ctx = ctx;
 
-	SetNextPingRequest();
+	SchedulePing();
 }
 
 Unet::LobbyMember::~LobbyMember()
 {
+	m_ctx->m_timers.Cancel(m_pingTimer);
+	m_ctx->m_timers.Cancel(m_kickTimer);
+
 	for (auto file : Files) {
 		delete file;
 	}
@@ -34,14 +51,17 @@ Unet::ServiceID Unet::LobbyMember::GetDataServiceID() const
 	// Prefer our primary service, if the client supports it
 	for (auto &id : IDs) {
 		if (id.Service == m_ctx->m_primaryService) {
-			return id;
+			if (IsReachable(id)) {
+				return id;
+			}
+			break;
 		}
 	}
 
 	// Prefer the client's primary service, if we support it
 	for (auto &id : IDs) {
 		if (id.Service == UnetPrimaryService) {
-			if (m_ctx->GetService(id.Service) != nullptr) {
+			if (IsReachable(id)) {
 				return id;
 			}
 			break;
@@ -50,12 +70,12 @@ Unet::ServiceID Unet::LobbyMember::GetDataServiceID() const
 
 	// As a fallback, just pick any ID that we support
 	for (auto &id : IDs) {
-		if (m_ctx->GetService(id.Service) != nullptr) {
+		if (IsReachable(id)) {
 			return id;
 		}
 	}
 
-	// We can't send messages to this member
+	// We can't send messages to this member directly
 	return ServiceID();
 }
 
@@ -84,27 +104,56 @@ json Unet::LobbyMember::Serialize() const
 		jsFile["hash"] = file->m_hash;
 		js["files"].emplace_back(jsFile);
 	}
+	if (Groups.size() > 0) {
+		js["groups"] = Groups;
+	}
 	return js;
 }
 
 void Unet::LobbyMember::Deserialize(const json &js)
 {
 	Valid = true;
+	m_snapshotDirty = true;
 
 	UnetPeer = js["peer"].get<int>();
 	UnetPrimaryService = (Unet::ServiceType)js["primary"].get<int>();
 	Name = js["name"].get<std::string>();
 
+	// The member info is complete, so anything it doesn't have was removed
+	m_data.clear();
 	DeserializeData(js["data"]);
 
+	Groups.clear();
+	if (js.contains("groups")) {
+		Groups = js["groups"].get<std::vector<std::string>>();
+	}
+
+	// Files we already know are kept, so their data doesn't have to be loaded again
+	std::vector<LobbyFile*> files;
 	for (auto &jsFile : js["files"]) {
-		auto newFile = new LobbyFile(jsFile["filename"].get<std::string>());
+		auto filename = jsFile["filename"].get<std::string>();
 		size_t size = jsFile["size"].get<size_t>();
 		uint64_t hash = jsFile["hash"].get<uint64_t>();
+
+		auto it = std::find_if(Files.begin(), Files.end(), [&filename, hash](LobbyFile* file) {
+			return file->m_filename == filename && file->m_hash == hash;
+		});
+		if (it != Files.end()) {
+			files.emplace_back(*it);
+			Files.erase(it);
+			continue;
+		}
+
+		auto newFile = new LobbyFile(filename);
 		newFile->Prepare(size, hash);
 		newFile->LoadFromCache();
-		Files.emplace_back(newFile);
+		files.emplace_back(newFile);
+	}
+
+	for (auto file : Files) {
+		delete file;
 	}
+	Files = std::move(files);
 }
 
 void Unet::LobbyMember::SetData(const std::string &name, const std::string &value)
@@ -119,7 +168,7 @@ void Unet::LobbyMember::SetData(const std::string &name, const std::string &valu
 		js["guid"] = UnetGuid.str();
 		js["name"] = name;
 		js["value"] = value;
-		m_ctx->InternalSendToAll(js);
+		m_ctx->InternalSendMemberUpdate(this, js);
 
 		m_ctx->GetCallbacks()->OnLobbyMemberDataChanged(this, name);
 
@@ -143,7 +192,7 @@ void Unet::LobbyMember::RemoveData(const std::string &name)
 		js["t"] = (uint8_t)LobbyPacketType::LobbyMemberDataRemoved;
 		js["guid"] = UnetGuid.str();
 		js["name"] = name;
-		m_ctx->InternalSendToAll(js);
+		m_ctx->InternalSendMemberUpdate(this, js);
 
 		m_ctx->GetCallbacks()->OnLobbyMemberDataChanged(this, name);
 
@@ -192,6 +241,7 @@ void Unet::LobbyMember::AddFile(const std::string &filename, uint8_t* buffer, si
 void Unet::LobbyMember::AddFile(LobbyFile* file)
 {
 	Files.emplace_back(file);
+	m_snapshotDirty = true;
 
 	auto currentLobby = m_ctx->CurrentLobby();
 	assert(currentLobby != nullptr);
@@ -205,7 +255,7 @@ void Unet::LobbyMember::AddFile(LobbyFile* file)
 
 		if (currentLobby->GetInfo().IsHosting) {
 			js["guid"] = UnetGuid.str();
-			m_ctx->InternalSendToAll(js);
+			m_ctx->InternalSendMemberUpdate(this, js);
 		} else if (UnetPeer == m_ctx->m_localPeer) {
 			m_ctx->InternalSendToHost(js);
 		}
@@ -226,7 +276,7 @@ void Unet::LobbyMember::RemoveFile(const std::string &filename)
 
 		if (currentLobby->GetInfo().IsHosting) {
 			js["guid"] = UnetGuid.str();
-			m_ctx->InternalSendToAll(js);
+			m_ctx->InternalSendMemberUpdate(this, js);
 		} else if (UnetPeer == m_ctx->m_localPeer) {
 			m_ctx->InternalSendToHost(js);
 		}
@@ -246,21 +296,328 @@ void Unet::LobbyMember::InternalRemoveFile(const std::string &filename)
 
 	delete *it;
 	Files.erase(it);
+	m_snapshotDirty = true;
+}
+
+bool Unet::LobbyMember::InGroup(const std::string &group) const
+{
+	return std::find(Groups.begin(), Groups.end(), group) != Groups.end();
+}
+
+void Unet::LobbyMember::JoinGroup(const std::string &group)
+{
+	auto currentLobby = m_ctx->CurrentLobby();
+	assert(currentLobby != nullptr);
+	if (currentLobby == nullptr) {
+		return;
+	}
+
+	if (currentLobby->GetInfo().IsHosting) {
+		if (!currentLobby->InternalJoinGroup(this, group)) {
+			return;
+		}
+
+		json js;
+		js["t"] = (uint8_t)LobbyPacketType::MemberGroupJoined;
+		js["guid"] = UnetGuid.str();
+		js["group"] = group;
+		m_ctx->InternalSendToAll(js);
+
+	} else if (UnetPeer == m_ctx->m_localPeer) {
+		json js;
+		js["t"] = (uint8_t)LobbyPacketType::MemberGroupJoined;
+		js["group"] = group;
+		m_ctx->InternalSendToHost(js);
+	}
+}
+
+void Unet::LobbyMember::LeaveGroup(const std::string &group)
+{
+	auto currentLobby = m_ctx->CurrentLobby();
+	assert(currentLobby != nullptr);
+	if (currentLobby == nullptr) {
+		return;
+	}
+
+	if (currentLobby->GetInfo().IsHosting) {
+		if (!currentLobby->InternalLeaveGroup(this, group)) {
+			return;
+		}
+
+		json js;
+		js["t"] = (uint8_t)LobbyPacketType::MemberGroupLeft;
+		js["guid"] = UnetGuid.str();
+		js["group"] = group;
+		m_ctx->InternalSendToAll(js);
+
+	} else if (UnetPeer == m_ctx->m_localPeer) {
+		json js;
+		js["t"] = (uint8_t)LobbyPacketType::MemberGroupLeft;
+		js["group"] = group;
+		m_ctx->InternalSendToHost(js);
+	}
+}
+
+double Unet::LobbyMember::GetRoundTrip() const
+{
+	return m_smoothedRtt;
+}
+
+double Unet::LobbyMember::GetRoundTripVariance() const
+{
+	if (m_smoothedRtt < 0.0) {
+		return -1.0;
+	}
+	return m_rttVariance;
+}
+
+double Unet::LobbyMember::GetMinRoundTrip() const
+{
+	if (m_numRttSamples == 0) {
+		return -1.0;
+	}
+
+	int count = std::min(m_numRttSamples, UNET_MIN_RTT_SAMPLES);
+	double ret = m_rttSamples[0];
+	for (int i = 1; i < count; i++) {
+		ret = std::min(ret, m_rttSamples[i]);
+	}
+	return ret;
+}
+
+double Unet::LobbyMember::GetLastRoundTrip() const
+{
+	return m_lastRtt;
 }
 
 void Unet::LobbyMember::SendPing()
 {
-	json js;
-	js["t"] = (uint8_t)LobbyPacketType::Ping;
-	m_ctx->InternalSendTo(this, js);
+	uint64_t timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	uint8_t ping[9];
+	ping[0] = (uint8_t)LobbyPacketType::Ping;
+	memcpy(ping + 1, &timestamp, 8);
+
+	// Unreliable, so that resends don't end up in the measurement
+	m_ctx->InternalSendBinaryTo(this, ping, sizeof(ping), PacketType::Unreliable);
 
 	m_ctx->GetCallbacks()->OnLogDebug(strPrintF("Sent ping to %d", UnetPeer));
+}
 
-	LastPingRequest = std::chrono::high_resolution_clock::now();
-	SetNextPingRequest();
+void Unet::LobbyMember::OnPong(uint64_t timestamp)
+{
+	uint64_t now = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	if (timestamp > now) {
+		return;
+	}
+
+	double rtt = (double)(now - timestamp) / 1000.0;
+
+	m_stats.RoundTrip.Add((int)(rtt + 0.5));
+	m_ctx->m_stats.RoundTrip.Add((int)(rtt + 0.5));
+
+	if (m_lastRtt >= 0.0) {
+		int jitter = (int)(std::abs(rtt - m_lastRtt) + 0.5);
+		m_stats.Jitter.Add(jitter);
+		m_ctx->m_stats.Jitter.Add(jitter);
+	}
+
+	if (m_smoothedRtt < 0.0) {
+		m_smoothedRtt = rtt;
+		m_rttVariance = rtt / 2.0;
+	} else {
+		m_rttVariance = 0.75 * m_rttVariance + 0.25 * std::abs(m_smoothedRtt - rtt);
+		m_smoothedRtt = 0.875 * m_smoothedRtt + 0.125 * rtt;
+	}
+
+	m_rttSamples[m_numRttSamples % UNET_MIN_RTT_SAMPLES] = rtt;
+	m_numRttSamples++;
+
+	m_lastRtt = rtt;
+	Ping = (int)(m_smoothedRtt + 0.5);
+}
+
+const Unet::NetworkStats &Unet::LobbyMember::GetStats() const
+{
+	return m_stats;
+}
+
+bool Unet::LobbyMember::IsReachable(const ServiceID &id) const
+{
+	auto service = m_ctx->GetService(id.Service);
+	if (service == nullptr) {
+		return false;
+	}
+	return service->IsPeerConnected(id);
+}
+
+size_t Unet::LobbyMember::GetPayloadLimit() const
+{
+	if (IDs.size() == 0) {
+		return 0;
+	}
+
+	auto id = GetDataServiceID();
+	auto service = m_ctx->GetService(id.Service);
+
+	if (id.IsValid() && service != nullptr) {
+		size_t limit = service->GetPeerPayloadLimit(id);
+		if (limit == 0) {
+			limit = service->UnreliablePacketLimit();
+		}
+		if (limit == 0) {
+			return 0;
+		}
+
+		// Services with a reliable packet limit put a marker in front of every packet (see Reassembly)
+		if (service->ReliablePacketLimit() > 0) {
+			limit--;
+		}
+		return limit;
+	}
+
+	// Relayed through the host
+	auto lobby = m_ctx->m_currentLobby;
+	if (lobby == nullptr) {
+		return 0;
+	}
+
+	auto hostMember = lobby->GetHostMember();
+	if (hostMember == nullptr || hostMember == this) {
+		return 0;
+	}
+
+	size_t limit = hostMember->GetPayloadLimit();
+	if (limit <= lobby->GetRelayHeaderSize()) {
+		return 0;
+	}
+	return limit - lobby->GetRelayHeaderSize();
+}
+
+void Unet::LobbyMember::OnProbeAck(size_t size)
+{
+	if (m_probeDone || size > m_probeStart) {
+		return;
+	}
+
+	m_probeLargest = std::max(m_probeLargest, size);
+}
+
+void Unet::LobbyMember::SchedulePing()
+{
+	// Spread out pings a bit so they don't all go out on the same frame
+	auto delay = std::chrono::milliseconds(800 + (rand() % 400));
+	m_pingTimer = m_ctx->m_timers.Schedule(delay, [this]() {
+		m_pingTimer = 0;
+		OnPingTimer();
+	});
+}
+
+void Unet::LobbyMember::OnPingTimer()
+{
+	// We don't ping ourselves
+	if (UnetPeer != -1 && UnetPeer == m_ctx->m_localPeer) {
+		return;
+	}
+
+	// Can't ping members we have no direct connection to (yet)
+	if (m_ctx->m_status == ContextStatus::Connected && IDs.size() > 0 && GetDataServiceID().IsValid()) {
+		SendPing();
+
+		if (m_probeDone && std::chrono::steady_clock::now() >= m_probeDoneTime + std::chrono::milliseconds(UNET_PROBE_REPEAT_MS)) {
+			m_probeDone = false;
+		}
+
+		if (!m_probeDone) {
+			UpdateProbing();
+		}
+	}
+
+	SchedulePing();
+}
+
+void Unet::LobbyMember::UpdateProbing()
+{
+	auto id = GetDataServiceID();
+	auto service = m_ctx->GetService(id.Service);
+	if (service == nullptr) {
+		return;
+	}
+
+	// Probes were sent on the last ping, so anything that's coming back is back by now
+	if (m_probeStart > 0) {
+		size_t start = m_probeStart;
+		size_t largest = m_probeLargest;
+		m_probeStart = 0;
+		m_probeLargest = 0;
+
+		if (largest == start) {
+			// The biggest size made it, so a limit that was lowered before goes back up
+			if (service->GetPeerPayloadLimit(id) < start) {
+				service->SetPeerPayloadLimit(id, start);
+				m_ctx->GetCallbacks()->OnLogDebug(strPrintF("Raised payload limit to peer %d to %d bytes", UnetPeer, (int)start));
+			}
+			FinishProbing();
+			return;
+		}
+
+		// A single lost packet isn't enough to go by, only lower the limit if the same thing happens again
+		if (largest > 0) {
+			m_probeAcked = (m_probeFailures == 0) ? largest : std::min(m_probeAcked, largest);
+			m_probeFailures++;
+
+			if (m_probeFailures >= UNET_PROBE_FAILURES) {
+				if (m_probeAcked != service->GetPeerPayloadLimit(id)) {
+					service->SetPeerPayloadLimit(id, m_probeAcked);
+					m_ctx->GetCallbacks()->OnLogDebug(strPrintF("Lowered payload limit to peer %d from %d to %d bytes", UnetPeer, (int)start, (int)m_probeAcked));
+				}
+				FinishProbing();
+				return;
+			}
+		}
+	}
+
+	if (m_probeLimit == 0) {
+		m_probeLimit = service->GetPeerPayloadLimit(id);
+	}
+
+	size_t limit = m_probeLimit;
+	if (limit == 0 || m_probeRounds == UNET_PROBE_ROUNDS) {
+		FinishProbing();
+		return;
+	}
+
+	m_probeRounds++;
+	m_probeStart = limit;
+
+	// Internal binary messages have a json size of 0 in front, and a marker on services with a reliable packet limit
+	size_t overhead = 4 + (service->ReliablePacketLimit() > 0 ? 1 : 0);
+
+	std::vector<uint8_t> probe(limit);
+	probe[0] = (uint8_t)LobbyPacketType::PathProbe;
+
+	auto sendProbe = [this, &probe, overhead](size_t size) {
+		uint16_t size16 = (uint16_t)size;
+		memcpy(probe.data() + 1, &size16, 2);
+		m_ctx->InternalSendBinaryTo(this, probe.data(), size - overhead, PacketType::Unreliable);
+	};
+
+	sendProbe(limit);
+	for (size_t size : ProbeSizes) {
+		if (size < limit) {
+			sendProbe(size);
+		}
+	}
 }
 
-void Unet::LobbyMember::SetNextPingRequest()
+void Unet::LobbyMember::FinishProbing()
 {
-	NextPingRequest = std::chrono::system_clock::now() + std::chrono::milliseconds(800 + (rand() % 400));
+	// Probed again after a while, from the limit we started at
+	m_probeDone = true;
+	m_probeDoneTime = std::chrono::steady_clock::now();
+	m_probeRounds = 0;
+	m_probeStart = 0;
+	m_probeLargest = 0;
+	m_probeFailures = 0;
+	m_probeAcked = 0;
 }
@@ -0,0 +1,201 @@
+#include <Unet_common.h>
+#include <Unet/LobbySnapshot.h>
+#include <Unet/Lobby.h>
+#include <Unet/Trace.h>
+
+#define XXH_STATIC_LINKING_ONLY
+#include <Unet/xxhash.h>
+
+static void HashString(XXH64_state_t* state, const std::string &str)
+{
+	uint32_t size = (uint32_t)str.size();
+	XXH64_update(state, &size, sizeof(size));
+	XXH64_update(state, str.data(), str.size());
+}
+
+template<typename T>
+static void HashValue(XXH64_state_t* state, T value)
+{
+	XXH64_update(state, &value, sizeof(T));
+}
+
+void Unet::LobbySnapshot::Update(Lobby* lobby)
+{
+	UNET_TRACE_ZONE("LobbySnapshot::Update");
+
+	if (m_dataVersion == 0 || lobby->m_dataChanged) {
+		// Setting a value back and forth doesn't count as a change
+		uint64_t dataHash = HashData(lobby->m_data);
+		if (m_dataVersion == 0 || dataHash != m_dataHash) {
+			m_dataHash = dataHash;
+			m_dataVersion = ++m_version;
+			m_data = lobby->SerializeData();
+		}
+		lobby->m_dataChanged = false;
+	}
+
+	bool changed = false;
+	std::unordered_map<xg::Guid, uint32_t> memberVersions;
+
+	for (auto member : lobby->GetMembers()) {
+		if (!member->Valid) {
+			continue;
+		}
+
+		if (member->m_snapshotVersion == 0 || member->m_snapshotDirty || member->m_dataChanged) {
+			uint64_t hash = HashMember(member);
+			if (member->m_snapshotVersion == 0 || hash != member->m_snapshotHash) {
+				member->m_snapshot = JsonPack(member->Serialize());
+				member->m_snapshotHash = hash;
+				member->m_snapshotVersion = ++m_version;
+				changed = true;
+			}
+			member->m_snapshotDirty = false;
+			member->m_dataChanged = false;
+		}
+
+		memberVersions[member->UnetGuid] = member->m_snapshotVersion;
+	}
+
+	for (auto &it : m_memberVersions) {
+		if (memberVersions.find(it.first) != memberVersions.end()) {
+			continue;
+		}
+
+		Removal removal;
+		removal.Guid = it.first;
+		removal.Version = ++m_version;
+		m_removals.emplace_back(removal);
+		changed = true;
+	}
+
+	while (m_removals.size() > UNET_SNAPSHOT_MAX_REMOVALS) {
+		m_deltaBase = m_removals.front().Version;
+		m_removals.pop_front();
+	}
+
+	m_memberVersions.swap(memberVersions);
+
+	if (changed) {
+		m_members.clear();
+		for (auto member : lobby->GetMembers()) {
+			if (member->Valid) {
+				AppendMember(m_members, member);
+			}
+		}
+	}
+}
+
+uint32_t Unet::LobbySnapshot::GetVersion() const
+{
+	return m_version;
+}
+
+void Unet::LobbySnapshot::Write(Lobby* lobby, uint32_t base, json &js, std::vector<uint8_t> &members)
+{
+	js["version"] = m_version;
+
+	if (base == 0 || base < m_deltaBase || base > m_version) {
+		js["data"] = m_data;
+		members = m_members;
+		return;
+	}
+
+	js["base"] = base;
+	if (m_dataVersion > base) {
+		js["data"] = m_data;
+	}
+
+	js["removed"] = json::array();
+	for (auto &removal : m_removals) {
+		if (removal.Version > base) {
+			js["removed"].emplace_back(removal.Guid.str());
+		}
+	}
+
+	members.clear();
+	for (auto member : lobby->GetMembers()) {
+		if (member->Valid && member->m_snapshotVersion > base) {
+			AppendMember(members, member);
+		}
+	}
+}
+
+bool Unet::LobbySnapshot::ReadMembers(const uint8_t* data, size_t size, std::vector<json> &members)
+{
+	size_t offset = 0;
+	while (offset < size) {
+		if (offset + 4 > size) {
+			return false;
+		}
+
+		uint32_t memberSize;
+		memcpy(&memberSize, data + offset, 4);
+		offset += 4;
+
+		if (offset + memberSize > size) {
+			return false;
+		}
+
+		auto member = JsonUnpack((uint8_t*)data + offset, memberSize);
+		if (!member.is_object() || !member.contains("guid")) {
+			return false;
+		}
+		members.emplace_back(std::move(member));
+		offset += memberSize;
+	}
+	return true;
+}
+
+uint64_t Unet::LobbySnapshot::HashData(const std::vector<LobbyData> &data)
+{
+	XXH64_state_t state;
+	XXH64_reset(&state, 0);
+
+	for (auto &entry : data) {
+		HashString(&state, entry.Name);
+		HashString(&state, entry.Value);
+	}
+
+	return XXH64_digest(&state);
+}
+
+uint64_t Unet::LobbySnapshot::HashMember(const LobbyMember* member)
+{
+	// Everything LobbyMember::Serialize writes
+	XXH64_state_t state;
+	XXH64_reset(&state, 0);
+
+	HashValue(&state, member->UnetPeer);
+	HashValue(&state, (int)member->UnetPrimaryService);
+	HashString(&state, member->Name);
+
+	for (auto &id : member->IDs) {
+		HashValue(&state, (int)id.Service);
+		HashValue(&state, id.ID);
+	}
+
+	HashValue(&state, HashData(member->m_data));
+
+	for (auto file : member->Files) {
+		HashString(&state, file->m_filename);
+		HashValue(&state, file->m_size);
+		HashValue(&state, file->m_hash);
+	}
+
+	for (auto &group : member->Groups) {
+		HashString(&state, group);
+	}
+
+	return XXH64_digest(&state);
+}
+
+void Unet::LobbySnapshot::AppendMember(std::vector<uint8_t> &buffer, const LobbyMember* member)
+{
+	uint32_t size = (uint32_t)member->m_snapshot.size();
+
+	size_t offset = buffer.size();
+	buffer.resize(offset + 4 + size);
+	memcpy(buffer.data() + offset, &size, 4);
+	memcpy(buffer.data() + offset + 4, member->m_snapshot.data(), size);
+}
@@ -1,9 +1,11 @@
 #include <Unet_common.h>
 #include <Unet/NetworkMessage.h>
+#include <Unet/xxhash.h>
 
 Unet::NetworkMessage::NetworkMessage(size_t size)
 {
 	m_size = size;
+	m_capacity = size;
 	m_data = (uint8_t*)malloc(size);
 }
 
@@ -20,17 +22,35 @@ Unet::NetworkMessage::~NetworkMessage()
 	if (m_data != nullptr) {
 		free(m_data);
 	}
+
+	if (m_sequenceHashState != nullptr) {
+		XXH32_freeState(m_sequenceHashState);
+	}
 }
 
-void Unet::NetworkMessage::Append(uint8_t* data, size_t size)
+bool Unet::NetworkMessage::Reserve(size_t capacity)
 {
-	uint8_t* newData = (uint8_t*)realloc(m_data, m_size + size);
-	assert(newData != nullptr);
+	if (capacity <= m_capacity) {
+		return true;
+	}
+
+	uint8_t* newData = (uint8_t*)realloc(m_data, capacity);
 	if (newData == nullptr) {
-		return;
+		return false;
 	}
 
 	m_data = newData;
+	m_capacity = capacity;
+	return true;
+}
+
+bool Unet::NetworkMessage::Append(const uint8_t* data, size_t size)
+{
+	if (m_size + size > m_capacity && !Reserve(std::max(m_size + size, m_capacity * 2))) {
+		return false;
+	}
+
 	memcpy(m_data + m_size, data, size);
 	m_size += size;
+	return true;
 }
@@ -0,0 +1,106 @@
+#include <Unet_common.h>
+#include <Unet/NetworkStats.h>
+
+void Unet::StatHistogram::Add(int ms)
+{
+	if (ms < 0) {
+		ms = 0;
+	}
+
+	int index = 0;
+	while (index < NumBuckets - 1 && ms >= (1 << index)) {
+		index++;
+	}
+
+	m_buckets[index].Add();
+	m_count.Add();
+	m_sum.Add(ms);
+}
+
+int64_t Unet::StatHistogram::GetBucket(int index) const
+{
+	if (index < 0 || index >= NumBuckets) {
+		return 0;
+	}
+	return m_buckets[index].Get();
+}
+
+int Unet::StatHistogram::GetBucketStart(int index)
+{
+	if (index <= 0) {
+		return 0;
+	}
+	return 1 << (index - 1);
+}
+
+int64_t Unet::StatHistogram::GetCount() const
+{
+	return m_count.Get();
+}
+
+double Unet::StatHistogram::GetMean() const
+{
+	int64_t count = m_count.Get();
+	if (count == 0) {
+		return 0.0;
+	}
+	return m_sum.Get() / (double)count;
+}
+
+int Unet::StatHistogram::GetPercentile(double percentile) const
+{
+	int64_t count = m_count.Get();
+	if (count == 0) {
+		return -1;
+	}
+
+	int64_t target = (int64_t)(count * percentile / 100.0);
+	int64_t total = 0;
+	for (int i = 0; i < NumBuckets - 1; i++) {
+		total += m_buckets[i].Get();
+		if (total > target) {
+			return GetBucketStart(i + 1) - 1;
+		}
+	}
+	return GetBucketStart(NumBuckets - 1);
+}
+
+Unet::NetworkStats::NetworkStats(int numChannels)
+	: m_numChannels(numChannels), m_channels(new ChannelStats[numChannels])
+{
+}
+
+int Unet::NetworkStats::NumChannels() const
+{
+	return m_numChannels;
+}
+
+Unet::ChannelStats &Unet::NetworkStats::GetChannel(int channel)
+{
+	assert(channel >= 0 && channel < m_numChannels);
+	return m_channels[channel];
+}
+
+const Unet::ChannelStats &Unet::NetworkStats::GetChannel(int channel) const
+{
+	assert(channel >= 0 && channel < m_numChannels);
+	return m_channels[channel];
+}
+
+int64_t Unet::NetworkStats::GetTotalBytesSent() const
+{
+	int64_t ret = 0;
+	for (int i = 0; i < m_numChannels; i++) {
+		ret += m_channels[i].BytesSent.Get();
+	}
+	return ret;
+}
+
+int64_t Unet::NetworkStats::GetTotalBytesReceived() const
+{
+	int64_t ret = 0;
+	for (int i = 0; i < m_numChannels; i++) {
+		ret += m_channels[i].BytesReceived.Get();
+	}
+	return ret;
+}
@@ -0,0 +1,208 @@
+#include <Unet_common.h>
+#include <Unet/PacketCapture.h>
+
+#define CAPTURE_VERSION 1
+
+static const uint8_t CaptureMagic[4] = { 'U', 'N', 'P', 'C' };
+
+Unet::PacketCaptureWriter::~PacketCaptureWriter()
+{
+	Close();
+}
+
+bool Unet::PacketCaptureWriter::Open(const char* filename)
+{
+	Close();
+
+	m_fh = fopen(filename, "wb");
+	if (m_fh == nullptr) {
+		return false;
+	}
+
+	fwrite(CaptureMagic, 1, 4, m_fh);
+	fputc(CAPTURE_VERSION, m_fh);
+
+	m_startTime = std::chrono::steady_clock::now();
+	m_lastTime = 0;
+	return true;
+}
+
+void Unet::PacketCaptureWriter::Close()
+{
+	if (m_fh != nullptr) {
+		fclose(m_fh);
+		m_fh = nullptr;
+	}
+}
+
+bool Unet::PacketCaptureWriter::IsOpen()
+{
+	return m_fh != nullptr;
+}
+
+void Unet::PacketCaptureWriter::WriteService(const ServiceID &userId, size_t reliablePacketLimit)
+{
+	if (m_fh == nullptr) {
+		return;
+	}
+
+	uint32_t limit = (uint32_t)reliablePacketLimit;
+
+	fputc((int)CaptureRecordType::Service, m_fh);
+	fputc((int)userId.Service, m_fh);
+	fwrite(&userId.ID, sizeof(uint64_t), 1, m_fh);
+	fwrite(&limit, sizeof(uint32_t), 1, m_fh);
+}
+
+void Unet::PacketCaptureWriter::WritePacket(CaptureRecordType type, const ServiceID &peer, uint8_t channel, const void* data, size_t size)
+{
+	if (m_fh == nullptr) {
+		return;
+	}
+
+	uint64_t time = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_startTime).count();
+
+	m_buffer.clear();
+	m_buffer.emplace_back((uint8_t)type);
+	WriteVarint(time - m_lastTime);
+	m_buffer.emplace_back((uint8_t)peer.Service);
+	WriteVarint(peer.ID);
+	m_buffer.emplace_back(channel);
+	WriteVarint(size);
+
+	fwrite(m_buffer.data(), 1, m_buffer.size(), m_fh);
+	fwrite(data, 1, size, m_fh);
+
+	m_lastTime = time;
+}
+
+void Unet::PacketCaptureWriter::WriteVarint(uint64_t value)
+{
+	while (value >= 0x80) {
+		m_buffer.emplace_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	m_buffer.emplace_back((uint8_t)value);
+}
+
+Unet::PacketCaptureReader::~PacketCaptureReader()
+{
+	Close();
+}
+
+bool Unet::PacketCaptureReader::Open(const char* filename)
+{
+	Close();
+
+	m_fh = fopen(filename, "rb");
+	if (m_fh == nullptr) {
+		return false;
+	}
+
+	if (fseek(m_fh, 0, SEEK_END) != 0) {
+		Close();
+		return false;
+	}
+	long fileSize = ftell(m_fh);
+	if (fileSize < 0 || fseek(m_fh, 0, SEEK_SET) != 0) {
+		Close();
+		return false;
+	}
+	m_fileSize = (uint64_t)fileSize;
+
+	uint8_t header[5];
+	if (fread(header, 1, 5, m_fh) != 5 || memcmp(header, CaptureMagic, 4) != 0 || header[4] != CAPTURE_VERSION) {
+		Close();
+		return false;
+	}
+
+	m_time = 0;
+	return true;
+}
+
+void Unet::PacketCaptureReader::Close()
+{
+	if (m_fh != nullptr) {
+		fclose(m_fh);
+		m_fh = nullptr;
+	}
+}
+
+bool Unet::PacketCaptureReader::Next(CaptureRecord &record)
+{
+	if (m_fh == nullptr) {
+		return false;
+	}
+
+	int type = fgetc(m_fh);
+	if (type == EOF) {
+		return false;
+	}
+	record.Type = (CaptureRecordType)type;
+
+	if (record.Type == CaptureRecordType::Service) {
+		int service = fgetc(m_fh);
+		uint64_t id;
+		uint32_t limit;
+		if (service == EOF || fread(&id, sizeof(uint64_t), 1, m_fh) != 1 || fread(&limit, sizeof(uint32_t), 1, m_fh) != 1) {
+			return false;
+		}
+
+		record.Time = m_time;
+		record.Peer = ServiceID((ServiceType)service, id);
+		record.Channel = 0;
+		record.ReliablePacketLimit = limit;
+		record.Data.clear();
+		return true;
+	}
+
+	if (record.Type != CaptureRecordType::Sent && record.Type != CaptureRecordType::Received) {
+		return false;
+	}
+
+	uint64_t delta, id, size;
+	if (!ReadVarint(delta)) {
+		return false;
+	}
+	int service = fgetc(m_fh);
+	if (service == EOF || !ReadVarint(id)) {
+		return false;
+	}
+	int channel = fgetc(m_fh);
+	if (channel == EOF || !ReadVarint(size)) {
+		return false;
+	}
+
+	long position = ftell(m_fh);
+	if (position < 0 || size > m_fileSize - (uint64_t)position) {
+		return false;
+	}
+
+	record.Data.resize((size_t)size);
+	if (size > 0 && fread(record.Data.data(), 1, (size_t)size, m_fh) != size) {
+		return false;
+	}
+
+	m_time += delta;
+	record.Time = m_time;
+	record.Peer = ServiceID((ServiceType)service, id);
+	record.Channel = (uint8_t)channel;
+	record.ReliablePacketLimit = 0;
+	return true;
+}
+
+bool Unet::PacketCaptureReader::ReadVarint(uint64_t &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = fgetc(m_fh);
+		if (c == EOF) {
+			return false;
+		}
+		value |= (uint64_t)(c & 0x7F) << shift;
+		if ((c & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
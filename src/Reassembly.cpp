@@ -1,11 +1,48 @@
 #include <Unet_common.h>
 #include <Unet/Reassembly.h>
 #include <Unet/Context.h>
+#include <Unet/Trace.h>
 #include <Unet/xxhash.h>
 
 #define RELIABLE_MASK (0x80)
 #define SEQUENCE_MASK (0x7F)
 
+#define WHOLE_MARKER (0x00)
+#define STREAM_MARKER (0x01)
+#define UNRELIABLE_MARKER (0x02)
+
+// Marker, message ID and offset, followed by the size and hash in the first fragment
+#define STREAM_HEADER_SIZE (1 + 2 + 4)
+#define STREAM_FIRST_HEADER_SIZE (STREAM_HEADER_SIZE + 4 + 4)
+
+// Marker, message ID, fragment index and count, and the full size
+#define UNRELIABLE_HEADER_SIZE (1 + 2 + 1 + 1 + 4)
+#define UNRELIABLE_MAX_FRAGMENTS (255)
+
+// Incomplete unreliable messages are dropped once a message this much newer arrives from the same sender
+#define UNRELIABLE_WINDOW (32)
+
+// A hash of 0 means the sender didn't hash the message, so real hashes of 0 are sent as 1
+static uint32_t FragmentHash(uint32_t hash)
+{
+	return (hash == 0) ? 1 : hash;
+}
+
+// Reliable messages grow as their fragments arrive instead of being allocated at the size the sender claims,
+// so a peer can't make us allocate more than it actually sends. Growth is capped at the full size, so a
+// message that completes has no slack.
+static bool AppendFragment(Unet::NetworkMessage* msg, const uint8_t* data, size_t size)
+{
+	size_t needed = msg->m_size + size;
+	if (needed > msg->m_capacity) {
+		size_t capacity = std::min((size_t)msg->m_sequenceSize, std::max(needed, msg->m_capacity * 2));
+		if (!msg->Reserve(capacity)) {
+			return false;
+		}
+	}
+	return msg->Append(data, size);
+}
+
 Unet::Reassembly::Reassembly(Internal::Context* ctx)
 {
 	m_ctx = ctx;
@@ -16,70 +53,30 @@ Unet::Reassembly::~Reassembly()
 	Clear();
 }
 
-void Unet::Reassembly::HandleMessage(ServiceID peer, int channel, uint8_t* msgData, size_t packetSize)
+void Unet::Reassembly::SetStats(NetworkStats* stats)
 {
-	uint8_t sequenceId = *(msgData++);
-	packetSize--;
-
-	if ((sequenceId & RELIABLE_MASK) == 0) {
-		// If this is actually an unreliable packet, just handle it as a single message
-		auto newMessage = new NetworkMessage(msgData, packetSize);
-		newMessage->m_channel = channel;
-		newMessage->m_peer = peer;
-		m_ready.push(newMessage);
-		return;
-	}
-	sequenceId &= SEQUENCE_MASK;
-
-	auto existingMsg = std::find_if(m_staging.begin(), m_staging.end(), [sequenceId](NetworkMessage * msg) {
-		return msg->m_sequenceId == sequenceId;
-	});
-
-	if (existingMsg != m_staging.end()) {
-		auto msg = *existingMsg;
-		assert(msg->m_sequenceSize > 0);
-
-		msg->Append(msgData, packetSize);
+	m_stats = stats;
+}
 
-		assert(msg->m_size <= msg->m_sequenceSize);
-		if (msg->m_size == msg->m_sequenceSize) {
-			uint32_t finalHash = XXH32(msg->m_data, msg->m_size, 0);
-			if (finalHash != msg->m_sequenceHash) {
-				m_ctx->GetCallbacks()->OnLogError(strPrintF("Sequence hash for fragmented packet does not match! Packet size: %d", (int)msg->m_size));
-			}
+void Unet::Reassembly::HandleMessage(ServiceID peer, int channel, uint8_t* msgData, size_t packetSize)
+{
+	UNET_TRACE_ZONE("Reassembly::HandleMessage");
 
-			m_staging.erase(existingMsg);
-			m_ready.push(msg);
-		}
+	if (packetSize == 0) {
 		return;
 	}
 
-	uint32_t sequenceSize = *(uint32_t*)msgData;
-	msgData += 4;
-	packetSize -= 4;
-
-	if (sequenceSize == packetSize) {
-		// We have the full packet size already, we're not expecting any more packets
-		auto newMessage = new NetworkMessage(msgData, packetSize);
-		newMessage->m_channel = channel;
-		newMessage->m_peer = peer;
-		m_ready.push(newMessage);
+	uint8_t marker = msgData[0];
 
+	if (marker == STREAM_MARKER) {
+		HandleStreamFragment(peer, channel, msgData, packetSize);
+	} else if (marker == UNRELIABLE_MARKER) {
+		HandleUnreliableFragment(peer, channel, msgData, packetSize);
+	} else if ((marker & RELIABLE_MASK) != 0) {
+		HandleLegacyFragment(peer, channel, msgData, packetSize);
 	} else {
-		uint32_t packetHash = *(uint32_t*)msgData;
-		msgData += 4;
-		packetSize -= 4;
-
-		// We're expecting multiple packets, so at this point the sequence size must be bigger than the data we have left
-		assert(sequenceSize > packetSize);
-
-		auto newMessage = new NetworkMessage(msgData, packetSize);
-		newMessage->m_sequenceId = sequenceId;
-		newMessage->m_sequenceSize = sequenceSize;
-		newMessage->m_sequenceHash = packetHash;
-		newMessage->m_channel = channel;
-		newMessage->m_peer = peer;
-		m_staging.emplace_back(newMessage);
+		// If this is actually an unreliable packet, just handle it as a single message
+		PushReady(peer, channel, msgData + 1, packetSize - 1);
 	}
 }
 
@@ -94,9 +91,54 @@ Unet::NetworkMessage* Unet::Reassembly::PopReady()
 	return ret;
 }
 
+bool Unet::Reassembly::PopError(std::string &error)
+{
+	if (m_errors.size() == 0) {
+		return false;
+	}
+
+	error = m_errors.front();
+	m_errors.pop();
+	return true;
+}
+
+int Unet::Reassembly::Expire(std::chrono::steady_clock::time_point before, std::chrono::steady_clock::time_point unreliableBefore)
+{
+	int numExpired = 0;
+
+	for (size_t i = 0; i < m_staging.size(); ) {
+		auto msg = m_staging[i];
+		if (msg->m_sequenceStart >= (msg->m_sequenceUnreliable ? unreliableBefore : before)) {
+			i++;
+			continue;
+		}
+
+		// Losing unreliable messages is nothing unusual
+		if (!msg->m_sequenceUnreliable) {
+			LogError(strPrintF("Dropped incomplete fragmented message from %s ID 0x%016llX (%d of %d bytes)",
+				GetServiceNameByType(msg->m_peer.Service), msg->m_peer.ID, (int)msg->m_sequenceReceived, (int)msg->m_sequenceSize
+			));
+		}
+
+		if (m_stats != nullptr) {
+			m_stats->ReassemblyBytes.Sub((int64_t)msg->m_sequenceReceived);
+			m_stats->ReassemblyExpired.Add();
+		}
+		delete msg;
+
+		m_staging.erase(m_staging.begin() + i);
+		numExpired++;
+	}
+
+	return numExpired;
+}
+
 void Unet::Reassembly::Clear()
 {
 	for (auto msg : m_staging) {
+		if (m_stats != nullptr) {
+			m_stats->ReassemblyBytes.Sub((int64_t)msg->m_sequenceReceived);
+		}
 		delete msg;
 	}
 	m_staging.clear();
@@ -107,30 +149,35 @@ void Unet::Reassembly::Clear()
 	}
 }
 
-void Unet::Reassembly::SplitMessage(uint8_t* data, size_t size, PacketType type, size_t sizeLimit, const std::function<void(uint8_t*, size_t)> &callback)
+void Unet::Reassembly::SplitMessage(uint8_t* data, size_t size, PacketType type, size_t sizeLimit, bool hash, bool streams, const std::function<void(uint8_t*, size_t)> &callback)
 {
-	m_sequenceId++;
-	m_sequenceId &= SEQUENCE_MASK;
+	UNET_TRACE_ZONE("Reassembly::SplitMessage");
 
 	if (type == PacketType::Unreliable) {
 		m_tempBuffer.resize(size + 1);
-		m_tempBuffer[0] = m_sequenceId;
-		m_tempBuffer[1] = 0;
+		m_tempBuffer[0] = WHOLE_MARKER;
 		memcpy(m_tempBuffer.data() + 1, data, size);
 		callback(m_tempBuffer.data(), m_tempBuffer.size());
 		return;
 	}
 
-	// Subtract 3 to ensure that, in the case of these being relay packets, we can still send them
-	sizeLimit -= 3; //TODO: Do this selectively, only if relay is actually required?
-
 	assert(size <= 0xFFFFFFFF); // Size is sent as a 32 bit unsigned integer, so you can't send packets bigger than 4GB
 
+	if (streams) {
+		SplitStreams(data, size, sizeLimit, hash, callback);
+		return;
+	}
+
+	m_sequenceId++;
+	m_sequenceId &= SEQUENCE_MASK;
+
 	bool shouldSplit = (size > sizeLimit - 5);
 
+	// The older format is for lobbies that may have peers which don't know that a hash of 0 means the
+	// message wasn't hashed, so it's always hashed
 	XXH32_hash_t hashData = 0;
 	if (shouldSplit) {
-		hashData = XXH32(data, size, 0);
+		hashData = FragmentHash(XXH32(data, size, 0));
 	}
 
 	bool firstPacket = true;
@@ -179,5 +226,461 @@ void Unet::Reassembly::SplitMessage(uint8_t* data, size_t size, PacketType type,
 		}
 
 		ptr += dataSize;
+
+		if (shouldSplit && m_stats != nullptr) {
+			m_stats->FragmentsSent.Add();
+		}
+	}
+}
+
+bool Unet::Reassembly::FitsUnreliable(size_t size, size_t sizeLimit)
+{
+	return sizeLimit == 0 || 1 + size <= sizeLimit;
+}
+
+void Unet::Reassembly::SplitUnreliable(uint8_t* data, size_t size, size_t sizeLimit, const std::function<void(uint8_t*, size_t)> &callback)
+{
+	UNET_TRACE_ZONE("Reassembly::SplitUnreliable");
+
+	size_t maxDataSize = sizeLimit - UNRELIABLE_HEADER_SIZE;
+	size_t count = (size + maxDataSize - 1) / maxDataSize;
+	if (count > UNRELIABLE_MAX_FRAGMENTS) {
+		LogError(strPrintF("Unreliable message of %d bytes is too big to be fragmented!", (int)size));
+		return;
+	}
+
+	// Same size fragments, so the receiver can tell where each one goes from just the size and count
+	size_t fragmentSize = (size + count - 1) / count;
+
+	uint16_t id = m_unreliableId++;
+	uint32_t size32 = (uint32_t)size;
+
+	for (size_t i = 0; i < count; i++) {
+		size_t offset = i * fragmentSize;
+		size_t dataSize = std::min(fragmentSize, size - offset);
+
+		m_tempBuffer.resize(UNRELIABLE_HEADER_SIZE + dataSize);
+		uint8_t* ptr = m_tempBuffer.data();
+
+		ptr[0] = UNRELIABLE_MARKER;
+		memcpy(ptr + 1, &id, 2);
+		ptr[3] = (uint8_t)i;
+		ptr[4] = (uint8_t)count;
+		memcpy(ptr + 5, &size32, 4);
+		memcpy(ptr + UNRELIABLE_HEADER_SIZE, data + offset, dataSize);
+
+		callback(ptr, m_tempBuffer.size());
+
+		if (m_stats != nullptr) {
+			m_stats->FragmentsSent.Add();
+		}
+	}
+}
+
+void Unet::Reassembly::HandleLegacyFragment(const ServiceID &peer, int channel, uint8_t* msgData, size_t packetSize)
+{
+	uint8_t sequenceId = *(msgData++) & SEQUENCE_MASK;
+	packetSize--;
+
+	auto existingMsg = std::find_if(m_staging.begin(), m_staging.end(), [sequenceId, &peer](NetworkMessage* msg) {
+		return !msg->m_sequenceStream && !msg->m_sequenceUnreliable && msg->m_sequenceId == sequenceId && msg->m_peer == peer;
+	});
+
+	if (existingMsg != m_staging.end()) {
+		auto msg = *existingMsg;
+		assert(msg->m_sequenceSize > 0);
+
+		if (msg->m_sequenceReceived + packetSize > msg->m_sequenceSize) {
+			Drop(existingMsg, strPrintF("Fragment overflows fragmented packet! Packet size: %d", (int)msg->m_sequenceSize));
+			return;
+		}
+
+		if (!AppendFragment(msg, msgData, packetSize)) {
+			Drop(existingMsg, strPrintF("Unable to allocate %d bytes for fragmented packet!", (int)(msg->m_sequenceReceived + packetSize)));
+			return;
+		}
+		msg->m_sequenceReceived += (uint32_t)packetSize;
+
+		// Hash the fragment while it's still in cache, rather than the whole message at the end
+		if (msg->m_sequenceHashState != nullptr) {
+			XXH32_update(msg->m_sequenceHashState, msgData, packetSize);
+		}
+
+		if (m_stats != nullptr) {
+			m_stats->FragmentsReceived.Add();
+			m_stats->ReassemblyBytes.Add((int64_t)packetSize);
+		}
+
+		if (msg->m_sequenceReceived == msg->m_sequenceSize) {
+			Complete(existingMsg);
+		}
+		return;
+	}
+
+	if (packetSize < 4) {
+		LogError("Fragmented packet is too small!");
+		return;
+	}
+
+	uint32_t sequenceSize = *(uint32_t*)msgData;
+	msgData += 4;
+	packetSize -= 4;
+
+	if (sequenceSize == packetSize) {
+		// We have the full packet size already, we're not expecting any more packets
+		PushReady(peer, channel, msgData, packetSize);
+		return;
+	}
+
+	if (packetSize < 4) {
+		LogError("Fragmented packet is too small!");
+		return;
+	}
+
+	uint32_t packetHash = *(uint32_t*)msgData;
+	msgData += 4;
+	packetSize -= 4;
+
+	// We're expecting multiple packets, so at this point the sequence size must be bigger than the data we have left
+	if (sequenceSize <= packetSize) {
+		LogError(strPrintF("Fragmented packet is bigger than its size! Packet size: %d", (int)sequenceSize));
+		return;
+	}
+
+	auto newMessage = new NetworkMessage(msgData, packetSize);
+	if (newMessage->m_data == nullptr && packetSize > 0) {
+		LogError(strPrintF("Unable to allocate %d bytes for fragmented packet!", (int)packetSize));
+		delete newMessage;
+		return;
+	}
+	newMessage->m_sequenceId = sequenceId;
+	newMessage->m_sequenceSize = sequenceSize;
+	newMessage->m_sequenceHash = packetHash;
+	newMessage->m_sequenceReceived = (uint32_t)packetSize;
+	newMessage->m_sequenceStart = std::chrono::steady_clock::now();
+	newMessage->m_channel = channel;
+	newMessage->m_peer = peer;
+	if (packetHash != 0) {
+		newMessage->m_sequenceHashState = XXH32_createState();
+		XXH32_reset(newMessage->m_sequenceHashState, 0);
+		XXH32_update(newMessage->m_sequenceHashState, msgData, packetSize);
+	}
+	m_staging.emplace_back(newMessage);
+
+	if (m_stats != nullptr) {
+		m_stats->MessagesAllocated.Add();
+		m_stats->FragmentsReceived.Add();
+		m_stats->ReassemblyBytes.Add((int64_t)packetSize);
+	}
+}
+
+void Unet::Reassembly::HandleStreamFragment(const ServiceID &peer, int channel, uint8_t* msgData, size_t packetSize)
+{
+	if (packetSize < STREAM_HEADER_SIZE) {
+		LogError("Fragment is too small for its header!");
+		return;
+	}
+
+	uint16_t id;
+	uint32_t offset;
+	memcpy(&id, msgData + 1, 2);
+	memcpy(&offset, msgData + 3, 4);
+
+	if (offset == 0) {
+		if (packetSize < STREAM_FIRST_HEADER_SIZE) {
+			LogError("Fragment is too small for its header!");
+			return;
+		}
+
+		uint32_t size;
+		uint32_t hash;
+		memcpy(&size, msgData + 7, 4);
+		memcpy(&hash, msgData + 11, 4);
+
+		uint8_t* data = msgData + STREAM_FIRST_HEADER_SIZE;
+		size_t dataSize = packetSize - STREAM_FIRST_HEADER_SIZE;
+
+		if (dataSize >= size) {
+			LogError(strPrintF("First fragment holds the whole message! Packet size: %d", (int)size));
+			return;
+		}
+
+		auto newMessage = new NetworkMessage(data, dataSize);
+		if (newMessage->m_data == nullptr && dataSize > 0) {
+			LogError(strPrintF("Unable to allocate %d bytes for fragmented packet!", (int)dataSize));
+			delete newMessage;
+			return;
+		}
+		newMessage->m_sequenceId = id;
+		newMessage->m_sequenceSize = size;
+		newMessage->m_sequenceHash = hash;
+		newMessage->m_sequenceReceived = (uint32_t)dataSize;
+		newMessage->m_sequenceStream = true;
+		newMessage->m_sequenceStart = std::chrono::steady_clock::now();
+		newMessage->m_channel = channel;
+		newMessage->m_peer = peer;
+		if (hash != 0) {
+			newMessage->m_sequenceHashState = XXH32_createState();
+			XXH32_reset(newMessage->m_sequenceHashState, 0);
+			XXH32_update(newMessage->m_sequenceHashState, data, dataSize);
+		}
+		m_staging.emplace_back(newMessage);
+
+		if (m_stats != nullptr) {
+			m_stats->MessagesAllocated.Add();
+			m_stats->FragmentsReceived.Add();
+			m_stats->ReassemblyBytes.Add((int64_t)dataSize);
+		}
+		return;
+	}
+
+	auto existingMsg = std::find_if(m_staging.begin(), m_staging.end(), [id, channel, &peer](NetworkMessage* msg) {
+		return msg->m_sequenceStream && msg->m_sequenceId == id && msg->m_channel == channel && msg->m_peer == peer;
+	});
+
+	if (existingMsg == m_staging.end()) {
+		// The first fragment might have been dropped by Expire
+		return;
+	}
+
+	auto msg = *existingMsg;
+
+	uint8_t* data = msgData + STREAM_HEADER_SIZE;
+	size_t dataSize = packetSize - STREAM_HEADER_SIZE;
+
+	// Fragments are reliable, so they can only arrive in order
+	if (offset != msg->m_sequenceReceived || offset + dataSize > msg->m_sequenceSize) {
+		Drop(existingMsg, strPrintF("Fragment at offset %d does not fit fragmented packet! Packet size: %d", (int)offset, (int)msg->m_sequenceSize));
+		return;
+	}
+
+	if (!AppendFragment(msg, data, dataSize)) {
+		Drop(existingMsg, strPrintF("Unable to allocate %d bytes for fragmented packet!", (int)(offset + dataSize)));
+		return;
+	}
+	msg->m_sequenceReceived += (uint32_t)dataSize;
+
+	if (msg->m_sequenceHashState != nullptr) {
+		XXH32_update(msg->m_sequenceHashState, data, dataSize);
+	}
+
+	if (m_stats != nullptr) {
+		m_stats->FragmentsReceived.Add();
+		m_stats->ReassemblyBytes.Add((int64_t)dataSize);
+	}
+
+	if (msg->m_sequenceReceived == msg->m_sequenceSize) {
+		Complete(existingMsg);
+	}
+}
+
+void Unet::Reassembly::HandleUnreliableFragment(const ServiceID &peer, int channel, uint8_t* msgData, size_t packetSize)
+{
+	if (packetSize < UNRELIABLE_HEADER_SIZE) {
+		return;
+	}
+
+	uint16_t id;
+	uint32_t size;
+	memcpy(&id, msgData + 1, 2);
+	uint8_t index = msgData[3];
+	uint8_t count = msgData[4];
+	memcpy(&size, msgData + 5, 4);
+
+	uint8_t* data = msgData + UNRELIABLE_HEADER_SIZE;
+	size_t dataSize = packetSize - UNRELIABLE_HEADER_SIZE;
+
+	if (count < 2 || index >= count || size < count) {
+		return;
+	}
+
+	size_t fragmentSize = ((size_t)size + count - 1) / count;
+	size_t offset = (size_t)index * fragmentSize;
+	if (offset >= size || dataSize != std::min(fragmentSize, size - offset)) {
+		return;
+	}
+
+	auto sameSender = [&peer, channel](NetworkMessage* msg) {
+		return msg->m_sequenceUnreliable && msg->m_channel == channel && msg->m_peer == peer;
+	};
+
+	// Fragments of a message that's much older than one we're already reassembling are stale
+	for (auto msg : m_staging) {
+		if (sameSender(msg) && (int16_t)(msg->m_sequenceId - id) > UNRELIABLE_WINDOW) {
+			return;
+		}
+	}
+
+	// And the other way around, incomplete messages that are much older than this one won't be completed anymore
+	for (size_t i = 0; i < m_staging.size(); ) {
+		auto msg = m_staging[i];
+		if (!sameSender(msg) || (int16_t)(id - msg->m_sequenceId) <= UNRELIABLE_WINDOW) {
+			i++;
+			continue;
+		}
+
+		if (m_stats != nullptr) {
+			m_stats->ReassemblyBytes.Sub((int64_t)msg->m_sequenceReceived);
+			m_stats->ReassemblyExpired.Add();
+		}
+		delete msg;
+
+		m_staging.erase(m_staging.begin() + i);
+	}
+
+	auto existingMsg = std::find_if(m_staging.begin(), m_staging.end(), [id, &sameSender](NetworkMessage* msg) {
+		return sameSender(msg) && msg->m_sequenceId == id;
+	});
+
+	NetworkMessage* msg;
+	if (existingMsg != m_staging.end()) {
+		msg = *existingMsg;
+		if (msg->m_sequenceSize != size || msg->m_sequenceCount != count) {
+			return;
+		}
+
+	} else {
+		// Unlike reliable messages, these are allocated in full, since fragments go in at any offset. The size
+		// is bounded by the checks above, at the fragment count times the size of this packet.
+		msg = new NetworkMessage(size);
+		if (msg->m_data == nullptr) {
+			delete msg;
+			return;
+		}
+		msg->m_sequenceId = id;
+		msg->m_sequenceSize = size;
+		msg->m_sequenceCount = count;
+		msg->m_sequenceUnreliable = true;
+		msg->m_sequenceStart = std::chrono::steady_clock::now();
+		msg->m_channel = channel;
+		msg->m_peer = peer;
+		m_staging.emplace_back(msg);
+		existingMsg = m_staging.end() - 1;
+
+		if (m_stats != nullptr) {
+			m_stats->MessagesAllocated.Add();
+		}
+	}
+
+	// Duplicates can happen on unreliable connections
+	uint64_t &bits = msg->m_sequenceFragments[index / 64];
+	uint64_t bit = 1ULL << (index % 64);
+	if ((bits & bit) != 0) {
+		return;
+	}
+	bits |= bit;
+
+	memcpy(msg->m_data + offset, data, dataSize);
+	msg->m_sequenceReceived += (uint32_t)dataSize;
+
+	if (m_stats != nullptr) {
+		m_stats->FragmentsReceived.Add();
+		m_stats->ReassemblyBytes.Add((int64_t)dataSize);
+	}
+
+	if (msg->m_sequenceReceived == msg->m_sequenceSize) {
+		Complete(existingMsg);
+	}
+}
+
+void Unet::Reassembly::PushReady(const ServiceID &peer, int channel, uint8_t* data, size_t size)
+{
+	auto newMessage = new NetworkMessage(data, size);
+	newMessage->m_channel = channel;
+	newMessage->m_peer = peer;
+	m_ready.push(newMessage);
+
+	if (m_stats != nullptr) {
+		m_stats->MessagesAllocated.Add();
+	}
+}
+
+void Unet::Reassembly::Complete(std::vector<NetworkMessage*>::iterator it)
+{
+	auto msg = *it;
+
+	if (msg->m_sequenceHashState != nullptr) {
+		if (FragmentHash(XXH32_digest(msg->m_sequenceHashState)) != msg->m_sequenceHash) {
+			LogError(strPrintF("Sequence hash for fragmented packet does not match! Packet size: %d", (int)msg->m_size));
+		}
+
+		XXH32_freeState(msg->m_sequenceHashState);
+		msg->m_sequenceHashState = nullptr;
+	}
+
+	m_staging.erase(it);
+	m_ready.push(msg);
+
+	if (m_stats != nullptr) {
+		m_stats->ReassemblyBytes.Sub((int64_t)msg->m_sequenceReceived);
+	}
+}
+
+void Unet::Reassembly::Drop(std::vector<NetworkMessage*>::iterator it, const std::string &error)
+{
+	auto msg = *it;
+	LogError(error);
+
+	if (m_stats != nullptr) {
+		m_stats->ReassemblyBytes.Sub((int64_t)msg->m_sequenceReceived);
+	}
+
+	m_staging.erase(it);
+	delete msg;
+}
+
+void Unet::Reassembly::LogError(const std::string &error)
+{
+	if (m_ctx != nullptr) {
+		m_ctx->GetCallbacks()->OnLogError(error);
+	} else {
+		m_errors.push(error);
+	}
+}
+
+void Unet::Reassembly::SplitStreams(uint8_t* data, size_t size, size_t sizeLimit, bool hash, const std::function<void(uint8_t*, size_t)> &callback)
+{
+	if (size + 1 <= sizeLimit) {
+		m_tempBuffer.resize(size + 1);
+		m_tempBuffer[0] = WHOLE_MARKER;
+		memcpy(m_tempBuffer.data() + 1, data, size);
+		callback(m_tempBuffer.data(), m_tempBuffer.size());
+		return;
+	}
+
+	uint16_t id = m_streamId++;
+
+	uint32_t hashData = 0;
+	if (hash) {
+		hashData = FragmentHash(XXH32(data, size, 0));
+	}
+
+	size_t offset = 0;
+	while (offset < size) {
+		size_t headerSize = (offset == 0 ? STREAM_FIRST_HEADER_SIZE : STREAM_HEADER_SIZE);
+		size_t dataSize = std::min(size - offset, sizeLimit - headerSize);
+
+		m_tempBuffer.resize(headerSize + dataSize);
+		uint8_t* ptr = m_tempBuffer.data();
+
+		uint32_t offset32 = (uint32_t)offset;
+		ptr[0] = STREAM_MARKER;
+		memcpy(ptr + 1, &id, 2);
+		memcpy(ptr + 3, &offset32, 4);
+
+		if (offset == 0) {
+			uint32_t size32 = (uint32_t)size;
+			memcpy(ptr + 7, &size32, 4);
+			memcpy(ptr + 11, &hashData, 4);
+		}
+
+		memcpy(ptr + headerSize, data + offset, dataSize);
+		callback(ptr, m_tempBuffer.size());
+
+		offset += dataSize;
+
+		if (m_stats != nullptr) {
+			m_stats->FragmentsSent.Add();
+		}
 	}
 }
@@ -0,0 +1,237 @@
+#include <Unet_common.h>
+#include <Unet/SendScheduler.h>
+#include <Unet/Trace.h>
+
+// Bytes a class gets per round for every unit of its weight
+#define UNET_SCHEDULER_QUANTUM 1200
+
+// How much unused send rate can be saved up while there's nothing to send
+#define UNET_SCHEDULER_BURST_MS 50
+
+Unet::SendScheduler::SendScheduler(int numChannels)
+{
+	m_classes.resize(numChannels + 1);
+	m_lastRefill = std::chrono::steady_clock::now();
+
+	// File transfers shouldn't get in the way of anything by default
+	m_classes[FileClass].Priority = -1;
+
+	UpdateOrder();
+}
+
+Unet::SendScheduler::~SendScheduler()
+{
+	Clear();
+}
+
+void Unet::SendScheduler::SetStats(NetworkStats* stats)
+{
+	m_stats = stats;
+}
+
+void Unet::SendScheduler::SetPriority(int cls, int priority, int weight)
+{
+	if (cls < 0 || cls >= (int)m_classes.size()) {
+		assert(false);
+		return;
+	}
+
+	auto &c = m_classes[cls];
+	c.Priority = priority;
+	c.Weight = std::max(1, weight);
+
+	UpdateOrder();
+}
+
+void Unet::SendScheduler::SetRate(int bytesPerSecond)
+{
+	m_rate = std::max(0, bytesPerSecond);
+	m_budget = 0;
+
+	// Without a rate, nothing may stay behind in the queues
+	if (m_rate == 0) {
+		Flush();
+	}
+}
+
+int Unet::SendScheduler::GetRate()
+{
+	return m_rate;
+}
+
+void Unet::SendScheduler::Send(int cls, Service* service, const ServiceID &peer, const uint8_t* data, size_t size, PacketType type, uint8_t serviceChannel)
+{
+	if (m_rate == 0) {
+		service->SendPacket(peer, data, size, type, serviceChannel);
+		return;
+	}
+
+	if (cls < 0 || cls >= (int)m_classes.size()) {
+		assert(false);
+		return;
+	}
+
+	auto &c = m_classes[cls];
+
+	QueuedPacket packet;
+	packet.Target = service;
+	packet.Peer = peer;
+	packet.Type = type;
+	packet.ServiceChannel = serviceChannel;
+	packet.Data.assign(data, data + size);
+	c.Queue.push(std::move(packet));
+
+	c.QueuedBytes += size;
+	if (m_stats != nullptr) {
+		m_stats->SendQueueBytes.Add((int64_t)size);
+	}
+}
+
+size_t Unet::SendScheduler::GetQueuedBytes(int cls)
+{
+	if (cls < 0 || cls >= (int)m_classes.size()) {
+		return 0;
+	}
+	return m_classes[cls].QueuedBytes;
+}
+
+bool Unet::SendScheduler::HasQueued()
+{
+	for (auto &c : m_classes) {
+		if (c.Queue.size() > 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Unet::SendScheduler::Flush()
+{
+	UNET_TRACE_ZONE("SendScheduler::Flush");
+
+	auto now = std::chrono::steady_clock::now();
+	if (m_rate > 0) {
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - m_lastRefill).count();
+		m_budget += (int64_t)elapsed * m_rate / 1000000;
+		m_budget = std::min(m_budget, (int64_t)m_rate * UNET_SCHEDULER_BURST_MS / 1000);
+	}
+	m_lastRefill = now;
+
+	for (size_t g = 0; g < m_order.size(); g++) {
+		auto &group = m_order[g];
+
+		// Deficit round-robin between the classes of this priority
+		bool waiting = true;
+		while (waiting && (m_rate == 0 || m_budget > 0)) {
+			waiting = false;
+
+			for (size_t n = 0; n < group.size() && (m_rate == 0 || m_budget > 0); n++) {
+				auto &c = m_classes[group[m_nextInGroup[g]]];
+				m_nextInGroup[g] = (m_nextInGroup[g] + 1) % group.size();
+
+				if (c.Queue.size() == 0) {
+					c.Deficit = 0;
+					continue;
+				}
+
+				c.Deficit += (int64_t)c.Weight * UNET_SCHEDULER_QUANTUM;
+
+				while (c.Queue.size() > 0 && (int64_t)c.Queue.front().Data.size() <= c.Deficit && (m_rate == 0 || m_budget > 0)) {
+					int64_t size = (int64_t)c.Queue.front().Data.size();
+					c.Deficit -= size;
+					m_budget -= size;
+					SendFront(c);
+				}
+
+				if (c.Queue.size() == 0) {
+					c.Deficit = 0;
+				} else {
+					waiting = true;
+				}
+			}
+		}
+
+		// Lower priorities only get to send once the higher ones are done
+		if (waiting) {
+			break;
+		}
+	}
+
+	if (m_rate == 0) {
+		m_budget = 0;
+	}
+}
+
+void Unet::SendScheduler::RemovePeer(const ServiceID &peer)
+{
+	for (auto &c : m_classes) {
+		std::queue<QueuedPacket> remaining;
+
+		while (c.Queue.size() > 0) {
+			auto &packet = c.Queue.front();
+			if (packet.Peer == peer) {
+				c.QueuedBytes -= packet.Data.size();
+				if (m_stats != nullptr) {
+					m_stats->SendQueueBytes.Sub((int64_t)packet.Data.size());
+				}
+			} else {
+				remaining.push(std::move(packet));
+			}
+			c.Queue.pop();
+		}
+
+		c.Queue.swap(remaining);
+	}
+}
+
+void Unet::SendScheduler::Clear()
+{
+	for (auto &c : m_classes) {
+		while (c.Queue.size() > 0) {
+			c.Queue.pop();
+		}
+
+		if (m_stats != nullptr) {
+			m_stats->SendQueueBytes.Sub((int64_t)c.QueuedBytes);
+		}
+		c.QueuedBytes = 0;
+		c.Deficit = 0;
+	}
+}
+
+void Unet::SendScheduler::UpdateOrder()
+{
+	std::vector<int> indices;
+	for (int i = 0; i < (int)m_classes.size(); i++) {
+		indices.emplace_back(i);
+	}
+
+	std::stable_sort(indices.begin(), indices.end(), [this](int a, int b) {
+		return m_classes[a].Priority > m_classes[b].Priority;
+	});
+
+	m_order.clear();
+	for (size_t i = 0; i < indices.size(); i++) {
+		if (i == 0 || m_classes[indices[i]].Priority != m_classes[indices[i - 1]].Priority) {
+			m_order.emplace_back();
+		}
+		m_order.back().emplace_back(indices[i]);
+	}
+
+	m_nextInGroup.assign(m_order.size(), 0);
+}
+
+void Unet::SendScheduler::SendFront(TrafficClass &c)
+{
+	auto &packet = c.Queue.front();
+	size_t size = packet.Data.size();
+
+	packet.Target->SendPacket(packet.Peer, packet.Data.data(), size, packet.Type, packet.ServiceChannel);
+
+	c.QueuedBytes -= size;
+	if (m_stats != nullptr) {
+		m_stats->SendQueueBytes.Sub((int64_t)size);
+	}
+
+	c.Queue.pop();
+}
@@ -0,0 +1,87 @@
+#include <Unet_common.h>
+
+#if defined(UNET_MODULE_ENET)
+#include <Unet/Server.h>
+#include <Unet/Services/ServiceEnet.h>
+
+Unet::Internal::Server::Server(uint16_t port, int maxPeers, int numChannels)
+{
+	m_numChannels = numChannels;
+	m_host = new EnetSharedHost(port, (size_t)maxPeers, (size_t)numChannels + 2);
+}
+
+Unet::Internal::Server::~Server()
+{
+	for (auto ctx : m_contexts) {
+		delete ctx;
+	}
+
+	delete m_host;
+}
+
+Unet::IContext* Unet::Internal::Server::CreateContext()
+{
+	auto ctx = new Context(m_numChannels);
+	ctx->EnableService(ServiceType::Enet);
+
+	auto service = (ServiceEnet*)ctx->GetService(ServiceType::Enet);
+	assert(service != nullptr);
+	if (service != nullptr) {
+		service->SetSharedHost(m_host);
+	}
+
+	m_contexts.emplace_back(ctx);
+	return ctx;
+}
+
+void Unet::Internal::Server::DestroyContext(IContext* ctx)
+{
+	auto it = std::find(m_contexts.begin(), m_contexts.end(), ctx);
+	assert(it != m_contexts.end());
+	if (it == m_contexts.end()) {
+		return;
+	}
+
+	m_contexts.erase(it);
+	delete ctx;
+}
+
+int Unet::Internal::Server::ContextCount()
+{
+	return (int)m_contexts.size();
+}
+
+Unet::IContext* Unet::Internal::Server::GetContext(int index)
+{
+	if (index < 0 || index >= (int)m_contexts.size()) {
+		return nullptr;
+	}
+	return m_contexts[index];
+}
+
+void Unet::Internal::Server::RunCallbacks()
+{
+	m_host->Service();
+
+	for (auto ctx : m_contexts) {
+		ctx->RunCallbacks();
+	}
+}
+
+bool Unet::Internal::Server::WaitForEvents(int timeoutMs)
+{
+	m_waitSockets.clear();
+
+	auto host = m_host->GetHost();
+	if (host != nullptr) {
+		m_waitSockets.emplace_back((System::SocketHandle)host->socket);
+	}
+
+	int waitTime = timeoutMs;
+	for (auto ctx : m_contexts) {
+		waitTime = ctx->GetWaitTime(m_waitSockets, waitTime);
+	}
+
+	return Context::WaitForSockets(m_waiter, m_waitSockets, waitTime);
+}
+#endif
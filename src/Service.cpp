@@ -1,8 +1,74 @@
 #include <Unet_common.h>
 #include <Unet/Service.h>
+#include <Unet/Context.h>
 
 Unet::Service::Service(Internal::Context* ctx, int numChannels)
 {
 	m_ctx = ctx;
 	m_numChannels = numChannels;
 }
+
+bool Unet::Service::PeekPacket(uint8_t** outData, size_t* outSize, ServiceID* peerId, uint8_t channel)
+{
+	if (m_peekChannel != (int)channel) {
+		// Only one packet can be peeked at a time
+		assert(m_peekChannel == -1);
+
+		size_t packetSize;
+		if (!IsPacketAvailable(&packetSize, channel)) {
+			return false;
+		}
+
+		if (m_peekBuffer.size() < packetSize) {
+			m_peekBuffer.resize(packetSize);
+		}
+		m_peekBuffer.resize(ReadPacket(m_peekBuffer.data(), packetSize, &m_peekPeer, channel));
+		m_peekChannel = (int)channel;
+	}
+
+	*outData = m_peekBuffer.data();
+	*outSize = m_peekBuffer.size();
+	if (peerId != nullptr) {
+		*peerId = m_peekPeer;
+	}
+	return true;
+}
+
+void Unet::Service::ForwardPacket(const ServiceID &peerId, PacketType type, uint8_t channel)
+{
+	assert(m_peekChannel == (int)channel);
+	if (m_peekChannel != (int)channel) {
+		return;
+	}
+
+	SendPacket(peerId, m_peekBuffer.data(), m_peekBuffer.size(), type, channel);
+	m_peekChannel = -1;
+}
+
+void Unet::Service::PopPacket(uint8_t channel)
+{
+	assert(m_peekChannel == (int)channel);
+	m_peekChannel = -1;
+}
+
+void Unet::Service::OnPacketSent(const ServiceID &peerId, uint8_t channel, const void* data, size_t size)
+{
+	auto &stats = m_ctx->m_stats.GetChannel(channel);
+	stats.PacketsSent.Add();
+	stats.BytesSent.Add((int64_t)size);
+
+	if (m_ctx->m_capture != nullptr) {
+		m_ctx->m_capture->WritePacket(CaptureRecordType::Sent, peerId, channel, data, size);
+	}
+}
+
+void Unet::Service::OnPacketReceived(const ServiceID &peerId, uint8_t channel, const void* data, size_t size)
+{
+	auto &stats = m_ctx->m_stats.GetChannel(channel);
+	stats.PacketsReceived.Add();
+	stats.BytesReceived.Add((int64_t)size);
+
+	if (m_ctx->m_capture != nullptr) {
+		m_ctx->m_capture->WritePacket(CaptureRecordType::Received, peerId, channel, data, size);
+	}
+}
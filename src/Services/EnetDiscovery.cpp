@@ -0,0 +1,326 @@
+#include <Unet_common.h>
+#include <Unet/Services/EnetDiscovery.h>
+#include <Unet/Services/ServiceEnet.h>
+
+#define UNET_DISCOVERY_PORT 4451
+#define UNET_DISCOVERY_VERSION 1
+#define UNET_DISCOVERY_MAX_SIZE 1200
+
+// How often hosts broadcast their beacon, and how long a beacon stays in the cache after that
+#define UNET_DISCOVERY_ANNOUNCE_MS 1000
+#define UNET_DISCOVERY_EXPIRE_MS 3500
+
+// How long to wait for answers on our initial query before we consider the cache warm
+#define UNET_DISCOVERY_WARMUP_MS 300
+
+static const uint8_t DiscoveryMagic[4] = { 'U', 'N', 'L', 'B' };
+
+enum class DiscoveryType : uint8_t
+{
+	Query,
+	Beacon,
+};
+
+template<typename T>
+static void Write(std::vector<uint8_t> &buffer, T value)
+{
+	size_t offset = buffer.size();
+	buffer.resize(offset + sizeof(T));
+	memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+template<typename T>
+static bool Read(const uint8_t* &data, const uint8_t* end, T &value)
+{
+	if (data + sizeof(T) > end) {
+		return false;
+	}
+	memcpy(&value, data, sizeof(T));
+	data += sizeof(T);
+	return true;
+}
+
+std::string Unet::EnetLobbyBeacon::GetData(const std::string &name) const
+{
+	for (auto &data : Data) {
+		if (data.Name == name) {
+			return data.Value;
+		}
+	}
+	return "";
+}
+
+Unet::EnetDiscovery::EnetDiscovery(Internal::Context* ctx)
+{
+	m_ctx = ctx;
+}
+
+Unet::EnetDiscovery::~EnetDiscovery()
+{
+	Close();
+}
+
+bool Unet::EnetDiscovery::Open()
+{
+	if (m_socket != ENET_SOCKET_NULL) {
+		return true;
+	}
+
+	m_socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+	if (m_socket == ENET_SOCKET_NULL) {
+		m_ctx->GetCallbacks()->OnLogError("[Enet] Unable to create LAN discovery socket");
+		return false;
+	}
+
+	// Multiple processes on the same machine must be able to listen for beacons
+	enet_socket_set_option(m_socket, ENET_SOCKOPT_NONBLOCK, 1);
+	enet_socket_set_option(m_socket, ENET_SOCKOPT_BROADCAST, 1);
+	enet_socket_set_option(m_socket, ENET_SOCKOPT_REUSEADDR, 1);
+
+	ENetAddress addr;
+	addr.host = ENET_HOST_ANY;
+	addr.port = UNET_DISCOVERY_PORT;
+	if (enet_socket_bind(m_socket, &addr) < 0) {
+		m_ctx->GetCallbacks()->OnLogError(strPrintF("[Enet] Unable to bind LAN discovery socket to port %d", UNET_DISCOVERY_PORT));
+		enet_socket_destroy(m_socket);
+		m_socket = ENET_SOCKET_NULL;
+		return false;
+	}
+
+	m_openTime = std::chrono::steady_clock::now();
+	m_nextAnnounce = m_openTime;
+
+	Query();
+	return true;
+}
+
+void Unet::EnetDiscovery::Close()
+{
+	if (m_socket != ENET_SOCKET_NULL) {
+		enet_socket_destroy(m_socket);
+		m_socket = ENET_SOCKET_NULL;
+	}
+	m_lobbies.clear();
+}
+
+bool Unet::EnetDiscovery::IsOpen()
+{
+	return m_socket != ENET_SOCKET_NULL;
+}
+
+ENetSocket Unet::EnetDiscovery::GetSocket()
+{
+	return m_socket;
+}
+
+bool Unet::EnetDiscovery::IsWarm()
+{
+	if (m_socket == ENET_SOCKET_NULL) {
+		return false;
+	}
+	return std::chrono::steady_clock::now() >= m_openTime + std::chrono::milliseconds(UNET_DISCOVERY_WARMUP_MS);
+}
+
+void Unet::EnetDiscovery::Query(const ENetAddress* addr)
+{
+	if (m_socket == ENET_SOCKET_NULL) {
+		return;
+	}
+
+	m_buffer.clear();
+	m_buffer.insert(m_buffer.end(), DiscoveryMagic, DiscoveryMagic + 4);
+	Write<uint8_t>(m_buffer, UNET_DISCOVERY_VERSION);
+	Write<uint8_t>(m_buffer, (uint8_t)DiscoveryType::Query);
+
+	ENetAddress target;
+	if (addr != nullptr) {
+		target.host = addr->host;
+	} else {
+		target.host = ENET_HOST_BROADCAST;
+	}
+	target.port = UNET_DISCOVERY_PORT;
+
+	ENetBuffer buffer;
+	buffer.data = m_buffer.data();
+	buffer.dataLength = m_buffer.size();
+	enet_socket_send(m_socket, &target, &buffer, 1);
+}
+
+void Unet::EnetDiscovery::Update(const EnetLobbyBeacon* announce)
+{
+	if (m_socket == ENET_SOCKET_NULL) {
+		return;
+	}
+
+	uint8_t data[UNET_DISCOVERY_MAX_SIZE];
+
+	while (true) {
+		ENetAddress from;
+		ENetBuffer buffer;
+		buffer.data = data;
+		buffer.dataLength = sizeof(data);
+
+		int received = enet_socket_receive(m_socket, &from, &buffer, 1);
+		if (received <= 0) {
+			break;
+		}
+
+		HandleDatagram(from, data, (size_t)received, announce);
+	}
+
+	auto now = std::chrono::steady_clock::now();
+
+	for (int i = (int)m_lobbies.size() - 1; i >= 0; i--) {
+		if (now >= m_lobbies[i].LastSeen + std::chrono::milliseconds(UNET_DISCOVERY_EXPIRE_MS)) {
+			m_lobbies.erase(m_lobbies.begin() + i);
+		}
+	}
+
+	if (announce != nullptr && now >= m_nextAnnounce) {
+		ENetAddress addr;
+		addr.host = ENET_HOST_BROADCAST;
+		addr.port = UNET_DISCOVERY_PORT;
+		Send(addr, *announce);
+
+		m_nextAnnounce = now + std::chrono::milliseconds(UNET_DISCOVERY_ANNOUNCE_MS);
+	}
+}
+
+const std::vector<Unet::EnetLobbyBeacon> &Unet::EnetDiscovery::GetLobbies()
+{
+	return m_lobbies;
+}
+
+const Unet::EnetLobbyBeacon* Unet::EnetDiscovery::GetLobby(const ServiceID &id)
+{
+	for (auto &lobby : m_lobbies) {
+		if (lobby.ID == id) {
+			return &lobby;
+		}
+	}
+	return nullptr;
+}
+
+void Unet::EnetDiscovery::Send(const ENetAddress &addr, const EnetLobbyBeacon &beacon)
+{
+	// Entry point IDs hold the Enet address (host, then port) and the lobby key in the upper 16 bits
+	uint16_t port = (uint16_t)(beacon.ID.ID >> 32);
+	uint16_t key = (uint16_t)(beacon.ID.ID >> 48);
+
+	m_buffer.clear();
+	m_buffer.insert(m_buffer.end(), DiscoveryMagic, DiscoveryMagic + 4);
+	Write<uint8_t>(m_buffer, UNET_DISCOVERY_VERSION);
+	Write<uint8_t>(m_buffer, (uint8_t)DiscoveryType::Beacon);
+
+	auto &guid = beacon.UnetGuid.bytes();
+	m_buffer.insert(m_buffer.end(), guid.begin(), guid.end());
+
+	Write<uint16_t>(m_buffer, port);
+	Write<uint16_t>(m_buffer, key);
+	Write<uint16_t>(m_buffer, (uint16_t)beacon.NumPlayers);
+	Write<uint16_t>(m_buffer, (uint16_t)beacon.MaxPlayers);
+
+	size_t countOffset = m_buffer.size();
+	Write<uint8_t>(m_buffer, 0);
+
+	// Data that doesn't fit in a single datagram is left out
+	uint8_t numData = 0;
+	for (auto &data : beacon.Data) {
+		if (data.Name == "unet-guid" || data.Name.size() > 0xFF || data.Value.size() > 0xFFFF) {
+			continue;
+		}
+
+		if (m_buffer.size() + 3 + data.Name.size() + data.Value.size() > UNET_DISCOVERY_MAX_SIZE || numData == 0xFF) {
+			continue;
+		}
+
+		Write<uint8_t>(m_buffer, (uint8_t)data.Name.size());
+		m_buffer.insert(m_buffer.end(), data.Name.begin(), data.Name.end());
+		Write<uint16_t>(m_buffer, (uint16_t)data.Value.size());
+		m_buffer.insert(m_buffer.end(), data.Value.begin(), data.Value.end());
+		numData++;
+	}
+	m_buffer[countOffset] = numData;
+
+	ENetBuffer buffer;
+	buffer.data = m_buffer.data();
+	buffer.dataLength = m_buffer.size();
+	enet_socket_send(m_socket, &addr, &buffer, 1);
+}
+
+void Unet::EnetDiscovery::HandleDatagram(const ENetAddress &from, const uint8_t* data, size_t size, const EnetLobbyBeacon* announce)
+{
+	const uint8_t* end = data + size;
+
+	if (size < 6 || memcmp(data, DiscoveryMagic, 4) != 0 || data[4] != UNET_DISCOVERY_VERSION) {
+		return;
+	}
+
+	auto type = (DiscoveryType)data[5];
+	data += 6;
+
+	if (type == DiscoveryType::Query) {
+		if (announce != nullptr) {
+			Send(from, *announce);
+		}
+		return;
+	}
+
+	if (type != DiscoveryType::Beacon) {
+		return;
+	}
+
+	EnetLobbyBeacon beacon;
+
+	std::array<unsigned char, 16> guid;
+	if (data + guid.size() > end) {
+		return;
+	}
+	memcpy(guid.data(), data, guid.size());
+	data += guid.size();
+	beacon.UnetGuid = xg::Guid(guid);
+
+	uint16_t port, key, numPlayers, maxPlayers;
+	uint8_t numData;
+	if (!Read(data, end, port) || !Read(data, end, key) || !Read(data, end, numPlayers) || !Read(data, end, maxPlayers) || !Read(data, end, numData)) {
+		return;
+	}
+
+	for (uint8_t i = 0; i < numData; i++) {
+		uint8_t nameLength;
+		if (!Read(data, end, nameLength) || data + nameLength > end) {
+			return;
+		}
+		std::string name((const char*)data, nameLength);
+		data += nameLength;
+
+		uint16_t valueLength;
+		if (!Read(data, end, valueLength) || data + valueLength > end) {
+			return;
+		}
+		std::string value((const char*)data, valueLength);
+		data += valueLength;
+
+		beacon.Data.emplace_back(LobbyData(name, value));
+	}
+
+	beacon.Data.emplace_back(LobbyData("unet-guid", beacon.UnetGuid.str()));
+
+	ENetAddress addr;
+	addr.host = from.host;
+	addr.port = port;
+
+	beacon.ID = ServiceEnet::AddressToID(addr, key);
+	beacon.NumPlayers = (int)numPlayers;
+	beacon.MaxPlayers = (int)maxPlayers;
+	beacon.LastSeen = std::chrono::steady_clock::now();
+
+	// The same lobby can be heard on multiple interfaces, so the cache is keyed by guid
+	for (auto &lobby : m_lobbies) {
+		if (lobby.UnetGuid == beacon.UnetGuid) {
+			lobby = beacon;
+			return;
+		}
+	}
+	m_lobbies.emplace_back(beacon);
+}
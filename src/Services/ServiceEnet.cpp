@@ -1,6 +1,7 @@
 #include <Unet_common.h>
 #include <Unet/Services/ServiceEnet.h>
 #include <Unet/LobbyPacket.h>
+#include <Unet/Trace.h>
 
 // I seriously hate Windows.h
 #if defined(min)
@@ -9,6 +10,21 @@
 
 #define UNET_PORT 4450
 #define UNET_ID_MASK 0x0000FFFFFFFFFFFF
+#define UNET_KEY_SHIFT 48
+
+// How often and for how long we send hole punching packets to a client we're connecting to directly
+#define UNET_PUNCH_INTERVAL_MS 200
+#define UNET_PUNCH_TIMEOUT_MS 10000
+
+// How long FetchLobbyInfo waits for a lobby's beacon
+#define UNET_FETCH_TIMEOUT_MS 2000
+
+// Enet does its resends and keepalive pings from enet_host_service, so it can't go without it for
+// long while it has peers
+#define UNET_SERVICE_INTERVAL_MS 20
+
+// The protocol header and send command Enet puts in front of a packet it doesn't split up
+#define UNET_ENET_PACKET_OVERHEAD (4 + 8)
 
 static uint64_t AddressToInt(const ENetAddress &addr)
 {
@@ -17,28 +33,169 @@ static uint64_t AddressToInt(const ENetAddress &addr)
 
 namespace Unet
 {
-	Unet::ServiceID ServiceEnet::AddressToID(const ENetAddress &addr)
+	Unet::ServiceID ServiceEnet::AddressToID(const ENetAddress &addr, uint16_t lobbyKey)
 	{
-		return Unet::ServiceID(Unet::ServiceType::Enet, AddressToInt(addr));
+		return Unet::ServiceID(Unet::ServiceType::Enet, AddressToInt(addr) | ((uint64_t)lobbyKey << UNET_KEY_SHIFT));
 	}
 }
 
 static ENetAddress IDToAddress(const Unet::ServiceID &id)
 {
-	return *(ENetAddress*)&id.ID;
+	uint64_t addr = id.ID & UNET_ID_MASK;
+	return *(ENetAddress*)&addr;
+}
+
+static uint16_t IDToLobbyKey(const Unet::ServiceID &id)
+{
+	return (uint16_t)(id.ID >> UNET_KEY_SHIFT);
+}
+
+static enet_uint32 GetPacketFlags(Unet::PacketType type)
+{
+	switch (type) {
+	case Unet::PacketType::Reliable: return ENET_PACKET_FLAG_RELIABLE;
+	// Without this, Enet sends unreliable packets bigger than MTU reliably
+	case Unet::PacketType::Unreliable: return ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT;
+	case Unet::PacketType::UnreliableSequenced: return ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT;
+	case Unet::PacketType::LatestOnly: return ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT;
+	}
+	return ENET_PACKET_FLAG_RELIABLE;
+}
+
+Unet::EnetSharedHost::EnetSharedHost(uint16_t port, size_t maxPeers, size_t maxChannels)
+{
+	ENetAddress addr;
+	addr.host = ENET_HOST_ANY;
+	addr.port = port;
+
+	m_host = enet_host_create(&addr, maxPeers, maxChannels, 0, 0);
+	m_port = port;
+}
+
+Unet::EnetSharedHost::~EnetSharedHost()
+{
+	for (auto service : m_services) {
+		service->m_sharedHost = nullptr;
+		service->m_host = nullptr;
+	}
+
+	if (m_host != nullptr) {
+		enet_host_destroy(m_host);
+	}
+}
+
+ENetHost* Unet::EnetSharedHost::GetHost()
+{
+	return m_host;
+}
+
+uint16_t Unet::EnetSharedHost::GetPort()
+{
+	return m_port;
+}
+
+uint16_t Unet::EnetSharedHost::Register(ServiceEnet* service)
+{
+	// Key 0 is reserved for connections that don't specify a lobby
+	uint16_t key;
+	do {
+		key = m_nextKey++;
+	} while (key == 0 || GetService(key) != nullptr);
+
+	m_services.emplace_back(service);
+	return key;
+}
+
+void Unet::EnetSharedHost::Unregister(ServiceEnet* service)
+{
+	auto it = std::find(m_services.begin(), m_services.end(), service);
+	if (it != m_services.end()) {
+		m_services.erase(it);
+	}
+
+	if (m_host == nullptr) {
+		return;
+	}
+
+	for (size_t i = 0; i < m_host->peerCount; i++) {
+		auto &peer = m_host->peers[i];
+		if (peer.data == service) {
+			peer.data = nullptr;
+		}
+	}
+}
+
+void Unet::EnetSharedHost::Service()
+{
+	UNET_TRACE_ZONE("EnetSharedHost::Service");
+
+	ENetEvent ev;
+	while (m_host != nullptr && enet_host_service(m_host, &ev, 0) > 0) {
+		ServiceEnet* service = nullptr;
+
+		if (ev.type == ENET_EVENT_TYPE_CONNECT) {
+			service = GetService((uint16_t)ev.data);
+			if (service == nullptr) {
+				// Nobody is hosting the lobby this peer wants to join
+				enet_peer_disconnect_now(ev.peer, 0);
+				continue;
+			}
+			ev.peer->data = service;
+
+		} else {
+			service = (ServiceEnet*)ev.peer->data;
+		}
+
+		if (service == nullptr) {
+			if (ev.type == ENET_EVENT_TYPE_RECEIVE) {
+				enet_packet_destroy(ev.packet);
+			}
+			continue;
+		}
+
+		if (ev.type == ENET_EVENT_TYPE_DISCONNECT) {
+			ev.peer->data = nullptr;
+		}
+
+		service->HandleEvent(ev);
+	}
+}
+
+Unet::ServiceEnet* Unet::EnetSharedHost::GetService(uint16_t key)
+{
+	for (auto service : m_services) {
+		if (service->m_lobbyKey == key) {
+			return service;
+		}
+	}
+	return nullptr;
 }
 
 Unet::ServiceEnet::ServiceEnet(Internal::Context* ctx, int numChannels) :
-	Service(ctx, numChannels)
+	Service(ctx, numChannels),
+	m_discovery(ctx)
 {
 }
 
 Unet::ServiceEnet::~ServiceEnet()
 {
+	if (m_sharedHost != nullptr) {
+		m_sharedHost->Unregister(this);
+	}
+}
+
+void Unet::ServiceEnet::SetSharedHost(EnetSharedHost* host)
+{
+	m_sharedHost = host;
 }
 
 void Unet::ServiceEnet::SimulateOutage()
 {
+	if (m_sharedHost != nullptr) {
+		DisconnectShared();
+		return;
+	}
+
 	for (auto peer : m_peers) {
 		enet_peer_disconnect_now(peer, 0);
 	}
@@ -54,110 +211,128 @@ void Unet::ServiceEnet::SimulateOutage()
 
 void Unet::ServiceEnet::RunCallbacks()
 {
-	if (m_host != nullptr && m_waitingForPeers) {
-		if (m_ctx->GetStatus() == ContextStatus::Connected) {
-			m_waitingForPeers = false;
+	UNET_TRACE_ZONE("ServiceEnet::RunCallbacks");
 
-			auto &members = m_ctx->CurrentLobby()->GetMembers();
-			for (auto member : members) {
-				if (member->UnetPeer == m_ctx->GetLocalPeer()) {
-					continue;
-				}
+	if (m_punches.size() > 0) {
+		UpdatePunches();
+	}
 
-				auto id = member->GetServiceID(ServiceType::Enet);
-				if (!id.IsValid()) {
-					continue;
-				}
+	UpdateDiscovery();
 
-				if (GetPeer(id) != nullptr) {
-					continue;
-				}
+	// A shared host is serviced by its owner, which passes events on to us
+	if (m_sharedHost != nullptr) {
+		return;
+	}
 
-				//TODO: Can we do NAT punching via the host?
+	ENetEvent ev;
+	while (m_host != nullptr && enet_host_service(m_host, &ev, 0) > 0) {
+		HandleEvent(ev);
+	}
+}
 
-				m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Connecting to client 0x%016llX", id.ID));
+int Unet::ServiceEnet::GetWaitSockets(std::vector<System::SocketHandle> &sockets)
+{
+	ENetHost* host = (m_sharedHost != nullptr ? m_sharedHost->GetHost() : m_host);
+	if (host != nullptr) {
+		sockets.emplace_back((System::SocketHandle)host->socket);
+	}
 
-				auto addr = IDToAddress(id);
-				m_peers.emplace_back(enet_host_connect(m_host, &addr, m_channels.size(), 0));
-			}
-		}
+	if (m_discovery.IsOpen()) {
+		sockets.emplace_back((System::SocketHandle)m_discovery.GetSocket());
 	}
 
-	ENetEvent ev;
-	while (m_host != nullptr && enet_host_service(m_host, &ev, 0)) {
-		if (ev.type == ENET_EVENT_TYPE_CONNECT) {
-			if (m_requestLobbyJoin != nullptr && m_requestLobbyJoin->Code != Result::OK) {
-				m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Connection to host established: 0x%016llX", AddressToInt(ev.peer->address)));
+	// Discovery announces, lobby info fetches and hole punching are all timed
+	if (m_peerHost != nullptr || m_peers.size() > 0 || m_discovery.IsOpen() || m_fetches.size() > 0 || m_punches.size() > 0) {
+		return UNET_SERVICE_INTERVAL_MS;
+	}
+	return -1;
+}
 
-				m_requestLobbyJoin->Code = Result::OK;
-				m_requestLobbyJoin->Data->JoinedLobby->AddEntryPoint(AddressToID(ev.peer->address));
+void Unet::ServiceEnet::HandleEvent(const ENetEvent &ev)
+{
+	UNET_TRACE_ZONE("ServiceEnet::HandleEvent");
 
-				json js;
-				js["t"] = (uint8_t)LobbyPacketType::Handshake;
-				js["guid"] = m_requestLobbyJoin->Data->JoinGuid.str();
-				m_ctx->InternalSendTo(AddressToID(m_peerHost->address), js);
+	if (ev.type == ENET_EVENT_TYPE_CONNECT) {
+		if (m_requestLobbyJoin != nullptr && m_requestLobbyJoin->Code != Result::OK) {
+			m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Connection to host established: 0x%016llX", AddressToInt(ev.peer->address)));
 
-			} else {
-				m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Client connected: 0x%016llX", AddressToInt(ev.peer->address)));
+			m_requestLobbyJoin->Code = Result::OK;
+			m_requestLobbyJoin->Data->JoinedLobby->AddEntryPoint(AddressToID(ev.peer->address, m_lobbyKey));
 
-				auto it = std::find(m_peers.begin(), m_peers.end(), ev.peer);
-				if (it == m_peers.end()) {
-					m_peers.emplace_back(ev.peer);
-				}
-			}
+			json js;
+			js["t"] = (uint8_t)LobbyPacketType::Handshake;
+			js["guid"] = m_requestLobbyJoin->Data->JoinGuid.str();
+			m_ctx->InternalSendTo(AddressToID(m_peerHost->address), js);
 
-		} else if (ev.type == ENET_EVENT_TYPE_DISCONNECT) {
-			if (m_requestLobbyLeft != nullptr && m_requestLobbyLeft->Code != Result::OK) {
-				enet_host_destroy(m_host);
-				m_host = nullptr;
-				m_peerHost = nullptr;
+		} else {
+			m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Client connected: 0x%016llX", AddressToInt(ev.peer->address)));
 
-				m_requestLobbyLeft->Code = Result::OK;
-				m_requestLobbyLeft = nullptr;
+			if (m_sharedHost != nullptr && m_maxPlayers > 0 && (int)m_peers.size() + 1 >= m_maxPlayers) {
+				m_ctx->GetCallbacks()->OnLogWarn(strPrintF("[Enet] Rejecting client 0x%016llX, lobby is full", AddressToInt(ev.peer->address)));
+				ev.peer->data = nullptr;
+				enet_peer_disconnect_now(ev.peer, 0);
+				return;
+			}
 
-			} else {
-				m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Client disconnected: 0x%016llX", AddressToInt(ev.peer->address)));
+			auto it = std::find(m_peers.begin(), m_peers.end(), ev.peer);
+			if (it == m_peers.end()) {
+				m_peers.emplace_back(ev.peer);
+			}
+		}
 
-				auto it = std::find(m_peers.begin(), m_peers.end(), ev.peer);
-				if (it == m_peers.end()) {
-					m_ctx->GetCallbacks()->OnLogWarn("[Enet] Couldn't find peer in list of connected peers!");
-				} else {
-					m_peers.erase(it);
-				}
+	} else if (ev.type == ENET_EVENT_TYPE_DISCONNECT) {
+		if (m_requestLobbyLeft != nullptr && m_requestLobbyLeft->Code != Result::OK) {
+			enet_host_destroy(m_host);
+			m_host = nullptr;
+			m_peerHost = nullptr;
 
-				auto currentLobby = m_ctx->CurrentLobby();
+			m_requestLobbyLeft->Code = Result::OK;
+			m_requestLobbyLeft = nullptr;
 
-				if (currentLobby != nullptr) {
-					currentLobby->RemoveMemberService(AddressToID(ev.peer->address));
-				}
+		} else {
+			m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Client disconnected: 0x%016llX", AddressToInt(ev.peer->address)));
 
-				if (ev.peer == m_peerHost) {
-					m_ctx->GetCallbacks()->OnLogDebug("[Enet] Disconnected from host!");
+			auto it = std::find(m_peers.begin(), m_peers.end(), ev.peer);
+			if (it == m_peers.end()) {
+				m_ctx->GetCallbacks()->OnLogWarn("[Enet] Couldn't find peer in list of connected peers!");
+			} else {
+				m_peers.erase(it);
+			}
 
-					for (auto peer : m_peers) {
-						enet_peer_disconnect_now(peer, 0);
-					}
-					m_peers.clear();
+			auto currentLobby = m_ctx->CurrentLobby();
 
-					enet_host_destroy(m_host);
-					m_host = nullptr;
-					m_peerHost = nullptr;
+			// Losing a direct connection to another client is not a reason to remove them, we'll just relay
+			// through the host again
+			if (currentLobby != nullptr && (ev.peer == m_peerHost || currentLobby->GetInfo().IsHosting)) {
+				currentLobby->RemoveMemberService(AddressToID(ev.peer->address));
+			}
+
+			if (ev.peer == m_peerHost) {
+				m_ctx->GetCallbacks()->OnLogDebug("[Enet] Disconnected from host!");
 
-					if (currentLobby != nullptr) {
-						currentLobby->ServiceDisconnected(ServiceType::Enet);
-					}
+				for (auto peer : m_peers) {
+					enet_peer_disconnect_now(peer, 0);
 				}
-			}
+				m_peers.clear();
 
-		} else if (ev.type == ENET_EVENT_TYPE_RECEIVE) {
-			if (ev.channelID >= m_channels.size()) {
-				m_ctx->GetCallbacks()->OnLogWarn(strPrintF("[Enet] Ignoring packet with %d bytes received in out-of-range channel ID %d", (int)ev.packet->dataLength, (int)ev.channelID));
-				enet_packet_destroy(ev.packet);
-				continue;
+				enet_host_destroy(m_host);
+				m_host = nullptr;
+				m_peerHost = nullptr;
+
+				if (currentLobby != nullptr) {
+					currentLobby->ServiceDisconnected(ServiceType::Enet);
+				}
 			}
+		}
 
-			m_channels[ev.channelID].push({ ev.packet, ev.peer });
+	} else if (ev.type == ENET_EVENT_TYPE_RECEIVE) {
+		if (ev.channelID >= m_channels.size()) {
+			m_ctx->GetCallbacks()->OnLogWarn(strPrintF("[Enet] Ignoring packet with %d bytes received in out-of-range channel ID %d", (int)ev.packet->dataLength, (int)ev.channelID));
+			enet_packet_destroy(ev.packet);
+			return;
 		}
+
+		m_channels[ev.channelID].push({ ev.packet, ev.peer });
 	}
 }
 
@@ -192,37 +367,73 @@ void Unet::ServiceEnet::CreateLobby(LobbyPrivacy privacy, int maxPlayers)
 
 	Clear(maxChannels);
 
-	m_host = enet_host_create(&addr, maxPlayers, maxChannels, 0, 0);
+	if (m_sharedHost != nullptr) {
+		addr.port = m_sharedHost->GetPort();
+
+		m_host = m_sharedHost->GetHost();
+		m_lobbyKey = m_sharedHost->Register(this);
+	} else {
+		m_host = enet_host_create(&addr, maxPlayers, maxChannels, 0, 0);
+		m_lobbyKey = 0;
+	}
+	m_hostPort = addr.port;
+	m_maxPlayers = maxPlayers;
 	m_peerHost = nullptr;
 	m_peers.clear();
 
-	m_waitingForPeers = false;
+	m_privacy = privacy;
+	m_joinable = true;
+	m_lobbyData.clear();
+
+	// Public lobbies are announced on the LAN
+	m_discovery.Open();
 
 	auto req = m_ctx->m_callbackCreateLobby.AddServiceRequest(this);
-	req->Data->CreatedLobby->AddEntryPoint(AddressToID(addr));
+	req->Data->CreatedLobby->AddEntryPoint(AddressToID(addr, m_lobbyKey));
 	req->Code = Result::OK;
 }
 
 void Unet::ServiceEnet::SetLobbyPrivacy(const ServiceID &lobbyId, LobbyPrivacy privacy)
 {
+	m_privacy = privacy;
 }
 
 void Unet::ServiceEnet::SetLobbyJoinable(const ServiceID &lobbyId, bool joinable)
 {
+	m_joinable = joinable;
 }
 
 void Unet::ServiceEnet::GetLobbyList()
 {
-	//TODO: Broadcast to LAN
+	m_requestLobbyList = m_ctx->m_callbackLobbyList.AddServiceRequest(this);
 
-	auto req = m_ctx->m_callbackLobbyList.AddServiceRequest(this);
-	req->Code = Result::OK;
+	if (!m_discovery.Open()) {
+		m_requestLobbyList->Code = Result::OK;
+		m_requestLobbyList = nullptr;
+		return;
+	}
+
+	// Once discovery has been running for a bit, we can answer straight from the cache
+	if (m_discovery.IsWarm()) {
+		UpdateDiscovery();
+	}
 }
 
 bool Unet::ServiceEnet::FetchLobbyInfo(const ServiceID &id)
 {
-	//TODO: Maybe this is possible somehow
-	return false;
+	if (!m_discovery.Open()) {
+		return false;
+	}
+
+	if (m_discovery.GetLobby(id) == nullptr) {
+		// Ask the host directly, in case it's not reachable by broadcast
+		auto addr = IDToAddress(id);
+		m_discovery.Query(&addr);
+	}
+
+	auto timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(UNET_FETCH_TIMEOUT_MS);
+	m_fetches.emplace_back(std::make_pair(id, timeout));
+	return true;
 }
 
 void Unet::ServiceEnet::JoinLobby(const ServiceID &id)
@@ -237,20 +448,33 @@ void Unet::ServiceEnet::JoinLobby(const ServiceID &id)
 
 	Clear(maxChannels);
 
+	// The lobby key tells a shared host which of its lobbies we want to join
+	m_lobbyKey = IDToLobbyKey(id);
+
 	m_host = enet_host_create(nullptr, maxPeers, maxChannels, 0, 0);
-	m_peerHost = enet_host_connect(m_host, &addr, maxChannels, 0);
+	m_peerHost = enet_host_connect(m_host, &addr, maxChannels, m_lobbyKey);
 
 	m_peers.clear();
 	m_peers.emplace_back(m_peerHost);
 
-	m_waitingForPeers = true;
 }
 
 void Unet::ServiceEnet::LeaveLobby()
 {
 	m_requestLobbyLeft = m_ctx->m_callbackLobbyLeft.AddServiceRequest(this);
 
-	if (m_peerHost != nullptr) {
+	if (m_sharedHost != nullptr) {
+		m_requestLobbyLeft->Code = Result::OK;
+		m_requestLobbyLeft = nullptr;
+
+		DisconnectShared();
+
+		auto currentLobby = m_ctx->CurrentLobby();
+		if (currentLobby != nullptr) {
+			currentLobby->ServiceDisconnected(ServiceType::Enet);
+		}
+
+	} else if (m_peerHost != nullptr) {
 		enet_peer_disconnect(m_peerHost, 0);
 
 	} else {
@@ -269,34 +493,76 @@ void Unet::ServiceEnet::LeaveLobby()
 
 int Unet::ServiceEnet::GetLobbyPlayerCount(const ServiceID &lobbyId)
 {
-	//TODO
+	auto beacon = m_discovery.GetLobby(lobbyId);
+	if (beacon != nullptr) {
+		return beacon->NumPlayers;
+	}
+
+	if (m_host == nullptr) {
+		return 0;
+	}
+
+	if (m_sharedHost != nullptr) {
+		return (int)m_peers.size() + 1;
+	}
 	return m_host->connectedPeers;
 }
 
 void Unet::ServiceEnet::SetLobbyMaxPlayers(const ServiceID &lobbyId, int amount)
 {
-	//TODO
+	m_maxPlayers = amount;
 }
 
 int Unet::ServiceEnet::GetLobbyMaxPlayers(const ServiceID &lobbyId)
 {
-	//TODO
+	auto beacon = m_discovery.GetLobby(lobbyId);
+	if (beacon != nullptr) {
+		return beacon->MaxPlayers;
+	}
+
+	if (m_host == nullptr) {
+		return 0;
+	}
+
+	if (m_sharedHost != nullptr) {
+		return m_maxPlayers;
+	}
 	return (int)m_host->peerCount;
 }
 
 std::string Unet::ServiceEnet::GetLobbyData(const ServiceID &lobbyId, const char* name)
 {
+	auto beacon = m_discovery.GetLobby(lobbyId);
+	if (beacon != nullptr) {
+		return beacon->GetData(name);
+	}
+
+	for (auto &data : m_lobbyData) {
+		if (data.Name == name) {
+			return data.Value;
+		}
+	}
 	return "";
 }
 
 int Unet::ServiceEnet::GetLobbyDataCount(const ServiceID &lobbyId)
 {
-	return 0;
+	auto beacon = m_discovery.GetLobby(lobbyId);
+	if (beacon != nullptr) {
+		return (int)beacon->Data.size();
+	}
+	return (int)m_lobbyData.size();
 }
 
 Unet::LobbyData Unet::ServiceEnet::GetLobbyData(const ServiceID &lobbyId, int index)
 {
-	return LobbyData();
+	auto beacon = m_discovery.GetLobby(lobbyId);
+	auto &lobbyData = (beacon != nullptr ? beacon->Data : m_lobbyData);
+
+	if (index < 0 || index >= (int)lobbyData.size()) {
+		return LobbyData();
+	}
+	return lobbyData[index];
 }
 
 Unet::ServiceID Unet::ServiceEnet::GetLobbyHost(const ServiceID &lobbyId)
@@ -306,10 +572,24 @@ Unet::ServiceID Unet::ServiceEnet::GetLobbyHost(const ServiceID &lobbyId)
 
 void Unet::ServiceEnet::SetLobbyData(const ServiceID &lobbyId, const char* name, const char* value)
 {
+	// Only kept to put in our LAN beacon
+	for (auto &data : m_lobbyData) {
+		if (data.Name == name) {
+			data.Value = value;
+			return;
+		}
+	}
+	m_lobbyData.emplace_back(LobbyData(name, value));
 }
 
 void Unet::ServiceEnet::RemoveLobbyData(const ServiceID &lobbyId, const char* name)
 {
+	auto it = std::find_if(m_lobbyData.begin(), m_lobbyData.end(), [name](const LobbyData & data) {
+		return data.Name == name;
+	});
+	if (it != m_lobbyData.end()) {
+		m_lobbyData.erase(it);
+	}
 }
 
 size_t Unet::ServiceEnet::ReliablePacketLimit()
@@ -317,22 +597,45 @@ size_t Unet::ServiceEnet::ReliablePacketLimit()
 	return 0;
 }
 
-void Unet::ServiceEnet::SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel)
+size_t Unet::ServiceEnet::GetPeerPayloadLimit(const ServiceID &peerId)
+{
+	auto peer = GetPeer(peerId);
+	if (peer == nullptr || peer->mtu <= UNET_ENET_PACKET_OVERHEAD) {
+		return 0;
+	}
+
+	// The MTU both hosts agreed on when connecting, which doesn't have to be what the path allows
+	return (size_t)peer->mtu - UNET_ENET_PACKET_OVERHEAD;
+}
+
+void Unet::ServiceEnet::SetPeerPayloadLimit(const ServiceID &peerId, size_t limit)
 {
 	auto peer = GetPeer(peerId);
 	if (peer == nullptr) {
-		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("[Enet] Tried sending packet of %d bytes to unidentified peer 0x%016llX on channel %d", (int)size, peerId.ID, (int)channel));
 		return;
 	}
 
-	enet_uint32 flags = ENET_PACKET_FLAG_RELIABLE;
-	switch (type) {
-	case PacketType::Reliable: flags = ENET_PACKET_FLAG_RELIABLE; break;
-	case PacketType::Unreliable: flags = 0; break;
+	// Enet splits packets by the peer's MTU when they're sent, so this applies right away. It can be raised
+	// again, but never past what our host allows.
+	size_t mtu = std::max((size_t)ENET_PROTOCOL_MINIMUM_MTU, limit + UNET_ENET_PACKET_OVERHEAD);
+	mtu = std::min(mtu, (size_t)peer->host->mtu);
+	peer->mtu = (enet_uint32)mtu;
+}
+
+void Unet::ServiceEnet::SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel)
+{
+	UNET_TRACE_ZONE("ServiceEnet::SendPacket");
+
+	auto peer = GetPeer(peerId);
+	if (peer == nullptr) {
+		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("[Enet] Tried sending packet of %d bytes to unidentified peer 0x%016llX on channel %d", (int)size, peerId.ID, (int)channel));
+		return;
 	}
 
-	auto packet = enet_packet_create(data, size, flags);
+	auto packet = enet_packet_create(data, size, GetPacketFlags(type));
 	enet_peer_send(peer, channel, packet);
+
+	OnPacketSent(peerId, channel, data, size);
 }
 
 size_t Unet::ServiceEnet::ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel)
@@ -348,14 +651,13 @@ size_t Unet::ServiceEnet::ReadPacket(void* data, size_t maxSize, ServiceID* peer
 	size_t actualSize = std::min(packet.Packet->dataLength, maxSize);
 	memcpy(data, packet.Packet->data, actualSize);
 
+	auto id = GetPeerID(packet.Peer);
 	if (peerId != nullptr) {
-		if (packet.Peer == m_peerHost) {
-			*peerId = ServiceID(ServiceType::Enet, 0);
-		} else {
-			*peerId = AddressToID(packet.Peer->address);
-		}
+		*peerId = id;
 	}
 
+	OnPacketReceived(id, channel, packet.Packet->data, packet.Packet->dataLength);
+
 	enet_packet_destroy(packet.Packet);
 	queue.pop();
 
@@ -386,6 +688,278 @@ bool Unet::ServiceEnet::IsPacketAvailable(size_t* outPacketSize, uint8_t channel
 	return true;
 }
 
+bool Unet::ServiceEnet::PeekPacket(uint8_t** outData, size_t* outSize, ServiceID* peerId, uint8_t channel)
+{
+	if (!IsPacketAvailable(nullptr, channel)) {
+		return false;
+	}
+
+	auto &packet = m_channels[channel].front();
+	auto id = GetPeerID(packet.Peer);
+
+	// The packet may be modified after peeking, so it's counted as received right away
+	if (packet.Packet != m_peekedPacket) {
+		m_peekedPacket = packet.Packet;
+		OnPacketReceived(id, channel, packet.Packet->data, packet.Packet->dataLength);
+	}
+
+	*outData = packet.Packet->data;
+	*outSize = packet.Packet->dataLength;
+	if (peerId != nullptr) {
+		*peerId = id;
+	}
+	return true;
+}
+
+void Unet::ServiceEnet::ForwardPacket(const ServiceID &peerId, PacketType type, uint8_t channel)
+{
+	if (channel >= m_channels.size() || m_channels[channel].size() == 0) {
+		assert(false);
+		return;
+	}
+
+	auto &queue = m_channels[channel];
+	auto packet = queue.front().Packet;
+	queue.pop();
+	m_peekedPacket = nullptr;
+
+	auto peer = GetPeer(peerId);
+	if (peer == nullptr) {
+		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("[Enet] Tried forwarding packet of %d bytes to unidentified peer 0x%016llX on channel %d", (int)packet->dataLength, peerId.ID, (int)channel));
+		enet_packet_destroy(packet);
+		return;
+	}
+
+	// Hand the received packet straight back to Enet, which takes ownership once it's queued
+	packet->flags = GetPacketFlags(type);
+	OnPacketSent(peerId, channel, packet->data, packet->dataLength);
+
+	if (enet_peer_send(peer, channel, packet) < 0) {
+		enet_packet_destroy(packet);
+	}
+}
+
+void Unet::ServiceEnet::PopPacket(uint8_t channel)
+{
+	if (channel >= m_channels.size() || m_channels[channel].size() == 0) {
+		assert(false);
+		return;
+	}
+
+	auto &queue = m_channels[channel];
+	enet_packet_destroy(queue.front().Packet);
+	queue.pop();
+	m_peekedPacket = nullptr;
+}
+
+void Unet::ServiceEnet::FlushPackets()
+{
+	UNET_TRACE_ZONE("ServiceEnet::FlushPackets");
+
+	if (m_host != nullptr) {
+		enet_host_flush(m_host);
+	}
+}
+
+void Unet::ServiceEnet::DisconnectShared()
+{
+	// The host itself belongs to the shared host, so we only drop our own peers
+	for (auto peer : m_peers) {
+		peer->data = nullptr;
+		enet_peer_disconnect_now(peer, 0);
+	}
+	m_peers.clear();
+
+	if (m_sharedHost != nullptr && m_host != nullptr) {
+		m_sharedHost->Unregister(this);
+	}
+	m_host = nullptr;
+	m_lobbyKey = 0;
+}
+
+bool Unet::ServiceEnet::IsPeerConnected(const ServiceID &peerId)
+{
+	auto peer = GetPeer(peerId);
+	return peer != nullptr && peer->state == ENET_PEER_STATE_CONNECTED;
+}
+
+void Unet::ServiceEnet::DisconnectPeer(const ServiceID &peerId)
+{
+	auto peer = GetPeer(peerId);
+	if (peer == nullptr || peer == m_peerHost) {
+		return;
+	}
+
+	m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Disconnecting client 0x%016llX", peerId.ID));
+
+	auto it = std::find(m_peers.begin(), m_peers.end(), peer);
+	if (it != m_peers.end()) {
+		m_peers.erase(it);
+	}
+
+	// This doesn't raise a disconnect event, the lobby removes the member itself
+	peer->data = nullptr;
+	enet_peer_disconnect_now(peer, 0);
+}
+
+void Unet::ServiceEnet::ConnectPeer(const ServiceID &peerId, bool initiator)
+{
+	if (m_host == nullptr || GetPeer(peerId) != nullptr) {
+		return;
+	}
+
+	auto it = std::find_if(m_punches.begin(), m_punches.end(), [&peerId](const EnetPunch & punch) {
+		return punch.ID == peerId;
+	});
+	if (it != m_punches.end()) {
+		return;
+	}
+
+	m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Connecting directly to client 0x%016llX%s", peerId.ID, initiator ? "" : " (waiting for them)"));
+
+	auto now = std::chrono::steady_clock::now();
+
+	EnetPunch punch;
+	punch.ID = peerId;
+	punch.Initiator = initiator;
+	punch.NextPunch = now;
+	punch.Timeout = now + std::chrono::milliseconds(UNET_PUNCH_TIMEOUT_MS);
+	m_punches.emplace_back(punch);
+
+	if (initiator) {
+		// Enet keeps resending the connect until it times out, which also punches our own NAT
+		auto addr = IDToAddress(peerId);
+		auto peer = enet_host_connect(m_host, &addr, m_channels.size(), 0);
+		if (peer != nullptr) {
+			m_peers.emplace_back(peer);
+		}
+	}
+}
+
+void Unet::ServiceEnet::UpdatePunches()
+{
+	auto now = std::chrono::steady_clock::now();
+
+	for (int i = (int)m_punches.size() - 1; i >= 0; i--) {
+		auto &punch = m_punches[i];
+
+		if (m_host == nullptr) {
+			m_punches.erase(m_punches.begin() + i);
+			continue;
+		}
+
+		if (IsPeerConnected(punch.ID)) {
+			m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Direct connection to client 0x%016llX established", punch.ID.ID));
+			m_punches.erase(m_punches.begin() + i);
+			continue;
+		}
+
+		if (now >= punch.Timeout) {
+			m_ctx->GetCallbacks()->OnLogWarn(strPrintF("[Enet] Unable to connect directly to client 0x%016llX, packets will be relayed through the host", punch.ID.ID));
+
+			auto peer = GetPeer(punch.ID);
+			if (peer != nullptr) {
+				m_peers.erase(std::find(m_peers.begin(), m_peers.end(), peer));
+				enet_peer_reset(peer);
+			}
+
+			m_punches.erase(m_punches.begin() + i);
+			continue;
+		}
+
+		if (!punch.Initiator && now >= punch.NextPunch) {
+			// A single byte is too small to be an Enet packet, so the other side ignores it. All it does is
+			// open up our NAT for the initiator's connection attempt.
+			uint8_t punchData = 0;
+
+			ENetBuffer buffer;
+			buffer.data = &punchData;
+			buffer.dataLength = 1;
+
+			auto addr = IDToAddress(punch.ID);
+			enet_socket_send(m_host->socket, &addr, &buffer, 1);
+
+			punch.NextPunch = now + std::chrono::milliseconds(UNET_PUNCH_INTERVAL_MS);
+		}
+	}
+}
+
+void Unet::ServiceEnet::UpdateDiscovery()
+{
+	UNET_TRACE_ZONE("ServiceEnet::UpdateDiscovery");
+
+	if (!m_discovery.IsOpen()) {
+		return;
+	}
+
+	EnetLobbyBeacon announce;
+	bool announcing = false;
+
+	auto currentLobby = m_ctx->CurrentLobby();
+	if (m_host != nullptr && m_peerHost == nullptr && currentLobby != nullptr && m_privacy == LobbyPrivacy::Public && m_joinable) {
+		auto &lobbyInfo = currentLobby->GetInfo();
+
+		ENetAddress addr;
+		addr.host = ENET_HOST_ANY;
+		addr.port = m_hostPort;
+
+		announce.ID = AddressToID(addr, m_lobbyKey);
+		announce.UnetGuid = lobbyInfo.UnetGuid;
+		announce.NumPlayers = lobbyInfo.NumPlayers;
+		announce.MaxPlayers = m_maxPlayers;
+		announce.Data = m_lobbyData;
+		announcing = true;
+	}
+
+	m_discovery.Update(announcing ? &announce : nullptr);
+
+	if (m_requestLobbyList != nullptr && m_discovery.IsWarm()) {
+		for (auto &lobby : m_discovery.GetLobbies()) {
+			m_requestLobbyList->Data->AddEntryPoint(lobby.UnetGuid, lobby.ID);
+		}
+
+		m_requestLobbyList->Code = Result::OK;
+		m_requestLobbyList = nullptr;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	for (int i = (int)m_fetches.size() - 1; i >= 0; i--) {
+		auto &fetch = m_fetches[i];
+
+		LobbyInfoFetchResult res;
+		res.ID = fetch.first;
+
+		auto beacon = m_discovery.GetLobby(fetch.first);
+		if (beacon != nullptr) {
+			res.Info.Privacy = LobbyPrivacy::Public;
+			res.Info.NumPlayers = beacon->NumPlayers;
+			res.Info.MaxPlayers = beacon->MaxPlayers;
+			res.Info.UnetGuid = beacon->UnetGuid;
+			res.Info.Name = beacon->GetData("unet-name");
+			res.Info.EntryPoints.emplace_back(beacon->ID);
+			res.Code = Result::OK;
+
+		} else if (now >= fetch.second) {
+			m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] No beacon received from lobby 0x%016llX", fetch.first.ID));
+			res.Code = Result::Error;
+
+		} else {
+			continue;
+		}
+
+		m_fetches.erase(m_fetches.begin() + i);
+		m_ctx->GetCallbacks()->OnLobbyInfoFetched(res);
+	}
+}
+
+Unet::ServiceID Unet::ServiceEnet::GetPeerID(ENetPeer* peer)
+{
+	if (peer == m_peerHost) {
+		return ServiceID(ServiceType::Enet, 0);
+	}
+	return AddressToID(peer->address);
+}
+
 ENetPeer* Unet::ServiceEnet::GetPeer(const ServiceID &id)
 {
 	if (id.IsValid() && id.ID == 0) {
@@ -410,8 +984,11 @@ void Unet::ServiceEnet::Clear(size_t numChannels)
 		}
 	}
 	m_channels.clear();
+	m_peekedPacket = nullptr;
 
 	for (int i = 0; i < (int)numChannels; i++) {
 		m_channels.emplace_back(std::queue<EnetPacket>());
 	}
+
+	m_punches.clear();
 }
@@ -1,6 +1,7 @@
 #include <Unet_common.h>
 #include <Unet/Services/ServiceGalaxy.h>
 #include <Unet/LobbyPacket.h>
+#include <Unet/Trace.h>
 
 void Unet::LobbyListListener::OnLobbyList(uint32_t lobbyCount, galaxy::api::LobbyListResult result)
 {
@@ -319,25 +320,36 @@ size_t Unet::ServiceGalaxy::ReliablePacketLimit()
 
 void Unet::ServiceGalaxy::SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel)
 {
+	UNET_TRACE_ZONE("ServiceGalaxy::SendPacket");
+
 	assert(peerId.Service == ServiceType::Galaxy);
 
 	galaxy::api::P2PSendType sendType = galaxy::api::P2P_SEND_UNRELIABLE;
 	switch (type) {
 	case PacketType::Unreliable: sendType = galaxy::api::P2P_SEND_UNRELIABLE; break;
+	case PacketType::UnreliableSequenced: sendType = galaxy::api::P2P_SEND_UNRELIABLE; break;
+	case PacketType::LatestOnly: sendType = galaxy::api::P2P_SEND_UNRELIABLE; break;
 	case PacketType::Reliable: sendType = galaxy::api::P2P_SEND_RELIABLE; break;
 	}
 	galaxy::api::Networking()->SendP2PPacket(peerId.ID, data, (uint32_t)size, sendType, channel);
+
+	OnPacketSent(peerId, channel, data, size);
 }
 
 size_t Unet::ServiceGalaxy::ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel)
 {
+	UNET_TRACE_ZONE("ServiceGalaxy::ReadPacket");
+
 	uint32_t readSize;
 	galaxy::api::GalaxyID peer;
 	galaxy::api::Networking()->ReadP2PPacket(data, (uint32_t)maxSize, &readSize, peer, channel);
 
+	auto id = ServiceID(ServiceType::Galaxy, peer.ToUint64());
 	if (peerId != nullptr) {
-		*peerId = ServiceID(ServiceType::Galaxy, peer.ToUint64());
+		*peerId = id;
 	}
+
+	OnPacketReceived(id, channel, data, (size_t)readSize);
 	return (size_t)readSize;
 }
 
@@ -0,0 +1,285 @@
+#include <Unet_common.h>
+#include <Unet/Services/ServiceReplay.h>
+
+Unet::ServiceReplay::ServiceReplay(Internal::Context* ctx, int numChannels, float speed) :
+	Service(ctx, numChannels)
+{
+	m_speed = speed;
+	m_channels.assign(numChannels + 2, std::queue<ReplayPacket>());
+}
+
+Unet::ServiceReplay::~ServiceReplay()
+{
+}
+
+bool Unet::ServiceReplay::Open(const char* filename)
+{
+	if (!m_reader.Open(filename)) {
+		return false;
+	}
+
+	// Service records are written when the capture starts, before any packets
+	CaptureRecord record;
+	while (m_reader.Next(record) && record.Type == CaptureRecordType::Service) {
+		if (!m_userId.IsValid()) {
+			m_userId = record.Peer;
+			m_reliablePacketLimit = record.ReliablePacketLimit;
+		}
+	}
+
+	if (!m_userId.IsValid()) {
+		m_reader.Close();
+		return false;
+	}
+
+	m_next = record;
+	m_hasNext = (record.Type != CaptureRecordType::Service);
+	return true;
+}
+
+bool Unet::ServiceReplay::IsFinished()
+{
+	return m_playing && !m_hasNext;
+}
+
+void Unet::ServiceReplay::SimulateOutage()
+{
+	m_playing = false;
+}
+
+void Unet::ServiceReplay::RunCallbacks()
+{
+	if (!m_playing || !m_hasNext) {
+		return;
+	}
+
+	uint64_t elapsed = (uint64_t)-1;
+	if (m_speed > 0.0f) {
+		auto dt = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_startTime);
+		elapsed = (uint64_t)(dt.count() * (double)m_speed);
+	}
+
+	while (m_hasNext && m_next.Time - m_firstTime <= elapsed) {
+		if (m_next.Type == CaptureRecordType::Received && m_next.Peer.Service == m_userId.Service && m_next.Channel < m_channels.size()) {
+			ReplayPacket packet;
+			packet.Peer = m_next.Peer;
+			packet.Data.swap(m_next.Data);
+			m_channels[m_next.Channel].push(std::move(packet));
+		}
+		ReadNext();
+	}
+
+	if (!m_hasNext) {
+		m_ctx->GetCallbacks()->OnLogDebug("[Replay] Reached the end of the capture");
+	}
+}
+
+Unet::ServiceType Unet::ServiceReplay::GetType()
+{
+	return m_userId.Service;
+}
+
+Unet::ServiceID Unet::ServiceReplay::GetUserID()
+{
+	return m_userId;
+}
+
+std::string Unet::ServiceReplay::GetUserName()
+{
+	return "";
+}
+
+void Unet::ServiceReplay::SetRichPresence(const char* key, const char* value)
+{
+}
+
+void Unet::ServiceReplay::CreateLobby(LobbyPrivacy privacy, int maxPlayers)
+{
+	m_maxPlayers = maxPlayers;
+	m_lobbyData.clear();
+
+	auto req = m_ctx->m_callbackCreateLobby.AddServiceRequest(this);
+	req->Data->CreatedLobby->AddEntryPoint(ServiceID(m_userId.Service, 0));
+	req->Code = Result::OK;
+
+	Start();
+}
+
+void Unet::ServiceReplay::SetLobbyPrivacy(const ServiceID &lobbyId, LobbyPrivacy privacy)
+{
+}
+
+void Unet::ServiceReplay::SetLobbyJoinable(const ServiceID &lobbyId, bool joinable)
+{
+}
+
+void Unet::ServiceReplay::GetLobbyList()
+{
+	auto req = m_ctx->m_callbackLobbyList.AddServiceRequest(this);
+	req->Code = Result::OK;
+}
+
+bool Unet::ServiceReplay::FetchLobbyInfo(const ServiceID &id)
+{
+	return false;
+}
+
+void Unet::ServiceReplay::JoinLobby(const ServiceID &id)
+{
+	auto req = m_ctx->m_callbackLobbyJoin.AddServiceRequest(this);
+	req->Data->JoinedLobby->AddEntryPoint(id);
+	req->Code = Result::OK;
+
+	Start();
+}
+
+void Unet::ServiceReplay::LeaveLobby()
+{
+	m_playing = false;
+
+	for (auto &queue : m_channels) {
+		while (queue.size() > 0) {
+			queue.pop();
+		}
+	}
+
+	auto req = m_ctx->m_callbackLobbyLeft.AddServiceRequest(this);
+	req->Code = Result::OK;
+
+	auto currentLobby = m_ctx->CurrentLobby();
+	if (currentLobby != nullptr) {
+		currentLobby->ServiceDisconnected(m_userId.Service);
+	}
+}
+
+int Unet::ServiceReplay::GetLobbyPlayerCount(const ServiceID &lobbyId)
+{
+	return 0;
+}
+
+void Unet::ServiceReplay::SetLobbyMaxPlayers(const ServiceID &lobbyId, int amount)
+{
+	m_maxPlayers = amount;
+}
+
+int Unet::ServiceReplay::GetLobbyMaxPlayers(const ServiceID &lobbyId)
+{
+	return m_maxPlayers;
+}
+
+std::string Unet::ServiceReplay::GetLobbyData(const ServiceID &lobbyId, const char* name)
+{
+	for (auto &data : m_lobbyData) {
+		if (data.Name == name) {
+			return data.Value;
+		}
+	}
+	return "";
+}
+
+int Unet::ServiceReplay::GetLobbyDataCount(const ServiceID &lobbyId)
+{
+	return (int)m_lobbyData.size();
+}
+
+Unet::LobbyData Unet::ServiceReplay::GetLobbyData(const ServiceID &lobbyId, int index)
+{
+	if (index < 0 || index >= (int)m_lobbyData.size()) {
+		return LobbyData();
+	}
+	return m_lobbyData[index];
+}
+
+Unet::ServiceID Unet::ServiceReplay::GetLobbyHost(const ServiceID &lobbyId)
+{
+	// Nothing we send goes anywhere, so any ID on the service will do
+	return ServiceID(m_userId.Service, 0);
+}
+
+void Unet::ServiceReplay::SetLobbyData(const ServiceID &lobbyId, const char* name, const char* value)
+{
+	for (auto &data : m_lobbyData) {
+		if (data.Name == name) {
+			data.Value = value;
+			return;
+		}
+	}
+	m_lobbyData.emplace_back(LobbyData(name, value));
+}
+
+void Unet::ServiceReplay::RemoveLobbyData(const ServiceID &lobbyId, const char* name)
+{
+	auto it = std::find_if(m_lobbyData.begin(), m_lobbyData.end(), [name](const LobbyData & data) {
+		return data.Name == name;
+	});
+
+	if (it != m_lobbyData.end()) {
+		m_lobbyData.erase(it);
+	}
+}
+
+size_t Unet::ServiceReplay::ReliablePacketLimit()
+{
+	return m_reliablePacketLimit;
+}
+
+void Unet::ServiceReplay::SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel)
+{
+	OnPacketSent(peerId, channel, data, size);
+}
+
+size_t Unet::ServiceReplay::ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel)
+{
+	if (channel >= m_channels.size()) {
+		assert(false);
+		return 0;
+	}
+
+	auto &queue = m_channels[channel];
+	auto &packet = queue.front();
+
+	size_t actualSize = std::min(packet.Data.size(), maxSize);
+	memcpy(data, packet.Data.data(), actualSize);
+
+	if (peerId != nullptr) {
+		*peerId = packet.Peer;
+	}
+
+	OnPacketReceived(packet.Peer, channel, packet.Data.data(), packet.Data.size());
+
+	queue.pop();
+	return actualSize;
+}
+
+bool Unet::ServiceReplay::IsPacketAvailable(size_t* outPacketSize, uint8_t channel)
+{
+	if (channel >= m_channels.size()) {
+		assert(false);
+		return false;
+	}
+
+	auto &queue = m_channels[channel];
+	if (queue.size() == 0) {
+		return false;
+	}
+
+	if (outPacketSize != nullptr) {
+		*outPacketSize = queue.front().Data.size();
+	}
+	return true;
+}
+
+void Unet::ServiceReplay::Start()
+{
+	m_playing = true;
+	m_startTime = std::chrono::steady_clock::now();
+
+	if (m_hasNext) {
+		m_firstTime = m_next.Time;
+	}
+}
+
+void Unet::ServiceReplay::ReadNext()
+{
+	m_hasNext = m_reader.Next(m_next);
+}
@@ -1,6 +1,7 @@
 #include <Unet_common.h>
 #include <Unet/Services/ServiceSteam.h>
 #include <Unet/LobbyPacket.h>
+#include <Unet/Trace.h>
 
 Unet::ServiceSteam::ServiceSteam(Internal::Context* ctx, int numChannels) :
 	Service(ctx, numChannels),
@@ -222,27 +223,54 @@ size_t Unet::ServiceSteam::ReliablePacketLimit()
 	return 1024 * 1024;
 }
 
+bool Unet::ServiceSteam::ReliablePacketsVerified()
+{
+	return true;
+}
+
+size_t Unet::ServiceSteam::UnreliablePacketLimit()
+{
+	// Steam refuses unreliable packets bigger than this
+	return 1200;
+}
+
+void Unet::ServiceSteam::DisconnectPeer(const ServiceID &peerId)
+{
+	SteamNetworking()->CloseP2PSessionWithUser((uint64)peerId.ID);
+}
+
 void Unet::ServiceSteam::SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel)
 {
+	UNET_TRACE_ZONE("ServiceSteam::SendPacket");
+
 	assert(peerId.Service == ServiceType::Steam);
 
 	EP2PSend sendType = k_EP2PSendUnreliable;
 	switch (type) {
 	case PacketType::Unreliable: sendType = k_EP2PSendUnreliable; break;
 	case PacketType::Reliable: sendType = k_EP2PSendReliable; break;
+	case PacketType::UnreliableSequenced: sendType = k_EP2PSendUnreliable; break;
+	case PacketType::LatestOnly: sendType = k_EP2PSendUnreliable; break;
 	}
 	SteamNetworking()->SendP2PPacket((uint64)peerId.ID, data, (uint32)size, sendType, (int)channel);
+
+	OnPacketSent(peerId, channel, data, size);
 }
 
 size_t Unet::ServiceSteam::ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel)
 {
+	UNET_TRACE_ZONE("ServiceSteam::ReadPacket");
+
 	uint32 readSize;
 	CSteamID peer;
 	SteamNetworking()->ReadP2PPacket(data, (uint32)maxSize, &readSize, &peer, (int)channel);
 
+	auto id = ServiceID(ServiceType::Steam, peer.ConvertToUint64());
 	if (peerId != nullptr) {
-		*peerId = ServiceID(ServiceType::Steam, peer.ConvertToUint64());
+		*peerId = id;
 	}
+
+	OnPacketReceived(id, channel, data, (size_t)readSize);
 	return (size_t)readSize;
 }
 
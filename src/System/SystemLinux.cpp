@@ -1,7 +1,11 @@
 #include <Unet_common.h>
 #include <Unet/System.h>
 
+#include <thread>
+
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <unistd.h>
 
 std::string Unet::System::ResolvePathName(const std::string &path)
 {
@@ -23,3 +27,55 @@ void Unet::System::FolderCreate(const char* path)
 {
 	mkdir(path, 0775);
 }
+
+Unet::System::SocketWaiter::SocketWaiter()
+{
+	m_epoll = epoll_create1(EPOLL_CLOEXEC);
+}
+
+Unet::System::SocketWaiter::~SocketWaiter()
+{
+	if (m_epoll != -1) {
+		close(m_epoll);
+	}
+}
+
+void Unet::System::SocketWaiter::SetSockets(const std::vector<SocketHandle> &sockets)
+{
+	if (m_epoll == -1) {
+		m_sockets = sockets;
+		return;
+	}
+
+	for (auto socket : m_sockets) {
+		if (std::find(sockets.begin(), sockets.end(), socket) == sockets.end()) {
+			// Fails if the socket was closed in the meantime, which already removed it from the set
+			epoll_ctl(m_epoll, EPOLL_CTL_DEL, (int)socket, nullptr);
+		}
+	}
+
+	// A service can close its socket and get the same descriptor back for a new one (like when Enet
+	// recreates its host), and closing it silently drops it from the epoll set. So we can't trust the
+	// descriptor numbers alone, and add every socket again, which fails with EEXIST for the ones that
+	// are still registered.
+	for (auto socket : sockets) {
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = (int)socket;
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, (int)socket, &ev);
+	}
+
+	m_sockets = sockets;
+}
+
+bool Unet::System::SocketWaiter::Wait(int timeoutMs)
+{
+	if (m_epoll == -1 || m_sockets.size() == 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+		return false;
+	}
+
+	epoll_event events[16];
+	int num = epoll_wait(m_epoll, events, 16, timeoutMs);
+	return num > 0;
+}
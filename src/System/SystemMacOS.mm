@@ -1,7 +1,10 @@
 #include <Unet_common.h>
 #include <Unet/System.h>
 
+#include <thread>
+
 #include <sys/stat.h>
+#include <poll.h>
 
 std::string Unet::System::ResolvePathName(const std::string &path)
 {
@@ -23,3 +26,35 @@ void Unet::System::FolderCreate(const char* path)
 {
 	mkdir(path, 0775);
 }
+
+Unet::System::SocketWaiter::SocketWaiter()
+{
+}
+
+Unet::System::SocketWaiter::~SocketWaiter()
+{
+}
+
+void Unet::System::SocketWaiter::SetSockets(const std::vector<SocketHandle> &sockets)
+{
+	m_sockets = sockets;
+}
+
+bool Unet::System::SocketWaiter::Wait(int timeoutMs)
+{
+	if (m_sockets.size() == 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+		return false;
+	}
+
+	std::vector<pollfd> fds;
+	for (auto socket : m_sockets) {
+		pollfd fd;
+		fd.fd = (int)socket;
+		fd.events = POLLIN;
+		fd.revents = 0;
+		fds.emplace_back(fd);
+	}
+
+	return poll(fds.data(), (nfds_t)fds.size(), timeoutMs) > 0;
+}
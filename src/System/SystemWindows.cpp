@@ -1,6 +1,10 @@
 #include <Unet_common.h>
 #include <Unet/System.h>
 
+#include <thread>
+
+#include <WinSock2.h>
+#pragma comment(lib, "Ws2_32.lib")
 #include <Windows.h>
 
 #include <Shlwapi.h>
@@ -28,3 +32,35 @@ void Unet::System::FolderCreate(const char* path)
 	std::string resolvedPath = ResolvePathName(path);
 	SHCreateDirectoryExA(NULL, resolvedPath.c_str(), NULL);
 }
+
+Unet::System::SocketWaiter::SocketWaiter()
+{
+}
+
+Unet::System::SocketWaiter::~SocketWaiter()
+{
+}
+
+void Unet::System::SocketWaiter::SetSockets(const std::vector<SocketHandle> &sockets)
+{
+	m_sockets = sockets;
+}
+
+bool Unet::System::SocketWaiter::Wait(int timeoutMs)
+{
+	if (m_sockets.size() == 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+		return false;
+	}
+
+	std::vector<WSAPOLLFD> fds;
+	for (auto socket : m_sockets) {
+		WSAPOLLFD fd;
+		fd.fd = (SOCKET)socket;
+		fd.events = POLLIN;
+		fd.revents = 0;
+		fds.emplace_back(fd);
+	}
+
+	return WSAPoll(fds.data(), (ULONG)fds.size(), timeoutMs) > 0;
+}
@@ -0,0 +1,191 @@
+#include <Unet_common.h>
+#include <Unet/TimerWheel.h>
+
+Unet::TimerWheel::TimerWheel()
+{
+	m_start = Clock::now();
+}
+
+Unet::TimerID Unet::TimerWheel::Schedule(Clock::duration delay, const Callback &func)
+{
+	return ScheduleAt(Clock::now() + delay, func);
+}
+
+Unet::TimerID Unet::TimerWheel::ScheduleAt(Clock::time_point when, const Callback &func)
+{
+	// Round up, so that timers never fire early
+	uint64_t tick = GetTick(when + std::chrono::microseconds(999));
+
+	TimerID id = m_nextId++;
+
+	Timer timer;
+	timer.Tick = tick;
+	timer.Func = func;
+	m_timers.emplace(id, std::move(timer));
+
+	Insert(id, tick);
+	return id;
+}
+
+void Unet::TimerWheel::Cancel(TimerID id)
+{
+	m_timers.erase(id);
+}
+
+bool Unet::TimerWheel::IsScheduled(TimerID id) const
+{
+	return m_timers.find(id) != m_timers.end();
+}
+
+size_t Unet::TimerWheel::Count() const
+{
+	return m_timers.size();
+}
+
+Unet::TimerWheel::Clock::time_point Unet::TimerWheel::GetNextDeadline() const
+{
+	if (m_timers.size() == 0) {
+		return Clock::time_point::max();
+	}
+
+	uint64_t next = (uint64_t)-1;
+
+	for (int level = 0; level < UNET_TIMER_LEVELS; level++) {
+		int shift = UNET_TIMER_SLOT_BITS * level;
+		uint64_t base = m_currentTick >> shift;
+
+		// Level 0 slots are due on their tick, higher level slots are cascaded when their level comes around
+		for (uint64_t i = 1; i <= UNET_TIMER_SLOTS; i++) {
+			uint64_t tick = (base + i) << shift;
+			if (tick >= next) {
+				break;
+			}
+
+			if (HasLiveTimers(m_slots[level][(base + i) & (UNET_TIMER_SLOTS - 1)])) {
+				next = tick;
+				break;
+			}
+		}
+	}
+
+	if (next == (uint64_t)-1) {
+		return Clock::time_point::max();
+	}
+	return m_start + std::chrono::milliseconds(next);
+}
+
+void Unet::TimerWheel::Advance(Clock::time_point now)
+{
+	uint64_t target = GetTick(now);
+
+	if (m_timers.size() == 0) {
+		// Nothing to run, so skip ahead and drop the IDs of cancelled timers
+		if (target > m_currentTick) {
+			m_currentTick = target;
+			for (int level = 0; level < UNET_TIMER_LEVELS; level++) {
+				for (int slot = 0; slot < UNET_TIMER_SLOTS; slot++) {
+					m_slots[level][slot].clear();
+				}
+			}
+		}
+		return;
+	}
+
+	std::vector<TimerID> ids;
+
+	while (m_currentTick < target) {
+		m_currentTick++;
+
+		// Move timers down from the higher levels that wrapped around on this tick, highest level first
+		int highest = 0;
+		for (int level = 1; level < UNET_TIMER_LEVELS; level++) {
+			uint64_t mask = (1ULL << (UNET_TIMER_SLOT_BITS * level)) - 1;
+			if ((m_currentTick & mask) != 0) {
+				break;
+			}
+			highest = level;
+		}
+		for (int level = highest; level > 0; level--) {
+			Cascade(level);
+		}
+
+		ids.clear();
+		ids.swap(m_slots[0][m_currentTick & (UNET_TIMER_SLOTS - 1)]);
+
+		for (auto id : ids) {
+			auto it = m_timers.find(id);
+			if (it == m_timers.end()) {
+				continue;
+			}
+
+			// Timers further away than the range of the highest level come around more than once
+			if (it->second.Tick > m_currentTick) {
+				Insert(id, it->second.Tick);
+				continue;
+			}
+
+			Callback func = std::move(it->second.Func);
+			m_timers.erase(it);
+			func();
+		}
+	}
+}
+
+uint64_t Unet::TimerWheel::GetTick(Clock::time_point time) const
+{
+	if (time <= m_start) {
+		return 0;
+	}
+	return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(time - m_start).count();
+}
+
+bool Unet::TimerWheel::HasLiveTimers(const std::vector<TimerID> &slot) const
+{
+	for (auto id : slot) {
+		if (m_timers.find(id) != m_timers.end()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Unet::TimerWheel::Insert(TimerID id, uint64_t tick)
+{
+	// Anything that's already due runs on the next tick
+	if (tick <= m_currentTick) {
+		tick = m_currentTick + 1;
+	}
+
+	uint64_t delta = tick - m_currentTick;
+
+	int level = 0;
+	while (level < UNET_TIMER_LEVELS - 1 && delta >= (1ULL << (UNET_TIMER_SLOT_BITS * (level + 1)))) {
+		level++;
+	}
+
+	size_t slot = (size_t)((tick >> (UNET_TIMER_SLOT_BITS * level)) & (UNET_TIMER_SLOTS - 1));
+	m_slots[level][slot].emplace_back(id);
+}
+
+void Unet::TimerWheel::Cascade(int level)
+{
+	size_t slot = (size_t)((m_currentTick >> (UNET_TIMER_SLOT_BITS * level)) & (UNET_TIMER_SLOTS - 1));
+
+	std::vector<TimerID> ids;
+	ids.swap(m_slots[level][slot]);
+
+	for (auto id : ids) {
+		auto it = m_timers.find(id);
+		if (it == m_timers.end()) {
+			continue;
+		}
+
+		uint64_t tick = it->second.Tick;
+		if (tick <= m_currentTick) {
+			// Due on this very tick, which is handled right after cascading
+			m_slots[0][m_currentTick & (UNET_TIMER_SLOTS - 1)].emplace_back(id);
+		} else {
+			Insert(id, tick);
+		}
+	}
+}
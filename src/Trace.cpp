@@ -0,0 +1,173 @@
+#include <Unet_common.h>
+#include <Unet/Trace.h>
+
+#if defined(UNET_TRACE)
+
+#include <mutex>
+
+namespace
+{
+	// A ring buffer that's only ever written to by one thread. Exporting copies the events out and then
+	// checks how far the writer got in the meantime, dropping anything that may have been overwritten.
+	struct ThreadBuffer
+	{
+		int ThreadID;
+		std::atomic<bool> InUse;
+
+		std::atomic<uint64_t> Head;
+		std::atomic<uint64_t> Tail;
+		std::unique_ptr<Unet::Trace::Event[]> Events;
+
+		ThreadBuffer(int threadId)
+			: ThreadID(threadId), InUse(true), Head(0), Tail(0), Events(new Unet::Trace::Event[UNET_TRACE_CAPACITY])
+		{
+		}
+	};
+
+	// Hands the buffer to the next new thread when this thread exits
+	struct ThreadBufferOwner
+	{
+		ThreadBuffer* Buffer = nullptr;
+
+		~ThreadBufferOwner()
+		{
+			if (Buffer != nullptr) {
+				Buffer->InUse.store(false, std::memory_order_release);
+			}
+		}
+	};
+}
+
+static std::mutex g_buffersMutex;
+static std::vector<std::unique_ptr<ThreadBuffer>> g_buffers;
+
+static std::atomic<bool> g_enabled(true);
+static const std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+
+static thread_local ThreadBufferOwner t_buffer;
+
+static uint64_t Now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_epoch).count();
+}
+
+static ThreadBuffer* GetThreadBuffer()
+{
+	if (t_buffer.Buffer != nullptr) {
+		return t_buffer.Buffer;
+	}
+
+	std::lock_guard<std::mutex> lock(g_buffersMutex);
+
+	for (auto &buffer : g_buffers) {
+		bool inUse = false;
+		if (buffer->InUse.compare_exchange_strong(inUse, true, std::memory_order_acquire)) {
+			t_buffer.Buffer = buffer.get();
+			return t_buffer.Buffer;
+		}
+	}
+
+	auto newBuffer = new ThreadBuffer((int)g_buffers.size() + 1);
+	g_buffers.emplace_back(newBuffer);
+	t_buffer.Buffer = newBuffer;
+	return newBuffer;
+}
+
+Unet::Trace::Zone::Zone(const char* name)
+{
+	if (!g_enabled.load(std::memory_order_relaxed)) {
+		m_name = nullptr;
+		return;
+	}
+
+	m_name = name;
+	m_start = Now();
+}
+
+Unet::Trace::Zone::~Zone()
+{
+	if (m_name == nullptr) {
+		return;
+	}
+
+	uint64_t end = Now();
+	auto buffer = GetThreadBuffer();
+
+	uint64_t head = buffer->Head.load(std::memory_order_relaxed);
+	auto &ev = buffer->Events[head % UNET_TRACE_CAPACITY];
+	ev.Name = m_name;
+	ev.Start = m_start;
+	ev.Duration = end - m_start;
+	buffer->Head.store(head + 1, std::memory_order_release);
+}
+
+void Unet::Trace::SetEnabled(bool enabled)
+{
+	g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Unet::Trace::IsEnabled()
+{
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+void Unet::Trace::Clear()
+{
+	std::lock_guard<std::mutex> lock(g_buffersMutex);
+
+	for (auto &buffer : g_buffers) {
+		buffer->Tail.store(buffer->Head.load(std::memory_order_acquire), std::memory_order_relaxed);
+	}
+}
+
+int Unet::Trace::Export(const char* filename)
+{
+	FILE* fh = fopen(filename, "wb");
+	if (fh == nullptr) {
+		return -1;
+	}
+
+	int numWritten = 0;
+	std::vector<Event> events;
+
+	fprintf(fh, "{\"traceEvents\":[\n");
+
+	std::lock_guard<std::mutex> lock(g_buffersMutex);
+
+	for (auto &buffer : g_buffers) {
+		uint64_t head = buffer->Head.load(std::memory_order_acquire);
+		uint64_t begin = buffer->Tail.load(std::memory_order_relaxed);
+		if (head > UNET_TRACE_CAPACITY && begin < head - UNET_TRACE_CAPACITY) {
+			begin = head - UNET_TRACE_CAPACITY;
+		}
+
+		events.clear();
+		for (uint64_t i = begin; i < head; i++) {
+			events.emplace_back(buffer->Events[i % UNET_TRACE_CAPACITY]);
+		}
+
+		// Slot i is overwritten by event i + capacity, which the writer may have reached by now
+		uint64_t newHead = buffer->Head.load(std::memory_order_acquire);
+		size_t skip = 0;
+		if (newHead + 1 > begin + UNET_TRACE_CAPACITY) {
+			skip = (size_t)std::min<uint64_t>(newHead + 1 - (begin + UNET_TRACE_CAPACITY), events.size());
+		}
+
+		fprintf(fh, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}", numWritten > 0 ? ",\n" : "", buffer->ThreadID, buffer->ThreadID);
+		numWritten++;
+
+		for (size_t i = skip; i < events.size(); i++) {
+			auto &ev = events[i];
+			fprintf(fh, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 "}", ev.Name, buffer->ThreadID, ev.Start, ev.Duration);
+			numWritten++;
+		}
+	}
+
+	fprintf(fh, "\n]}\n");
+	fclose(fh);
+
+	// Don't count the thread name entries
+	return numWritten - (int)g_buffers.size();
+}
+
+#endif
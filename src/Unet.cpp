@@ -1,6 +1,7 @@
 #include <Unet_common.h>
 #include <Unet.h>
 #include <Unet/Context.h>
+#include <Unet/Server.h>
 
 Unet::IContext* Unet::CreateContext(int numChannels)
 {
@@ -12,6 +13,20 @@ void Unet::DestroyContext(IContext* ctx)
 	delete ctx;
 }
 
+Unet::IServer* Unet::CreateServer(uint16_t port, int maxPeers, int numChannels)
+{
+#if defined(UNET_MODULE_ENET)
+	return new Internal::Server(port, maxPeers, numChannels);
+#else
+	return nullptr;
+#endif
+}
+
+void Unet::DestroyServer(IServer* server)
+{
+	delete server;
+}
+
 const char* Unet::GetVersion()
 {
 	return "0.00.1";